@@ -28,6 +28,7 @@
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <gtk/gtkx.h>
 #include <polkit/polkit.h>
@@ -39,11 +40,13 @@
 #include "um-cell-renderer-user-image.h"
 
 #include "um-account-dialog.h"
+#include "um-import-dialog.h"
 #include "um-password-dialog.h"
 #include "um-photo-dialog.h"
 #include "um-fingerprint-dialog.h"
 #include "um-utils.h"
 #include "um-history-dialog.h"
+#include "um-user-index.h"
 
 #include "um-realm-manager.h"
 
@@ -51,6 +54,38 @@
 
 #include "cc-user-panel.h"
 
+/* The user properties currently shown, so that show_user()
+ * only touches the widgets whose backing property changed. */
+typedef struct {
+	ActUser             *user;
+	gchar               *icon_file;
+	gint64               icon_mtime;
+	gchar               *real_name;
+	gchar               *user_name;
+	ActUserAccountType   account_type;
+	gboolean             show_account_type;
+	ActUserPasswordMode  password_mode;
+	gboolean             locked;
+	gboolean             local_account;
+	gboolean             automatic_login;
+	gboolean             show_last_login;
+	gboolean             logged_in;
+	gint64               login_time;
+	gboolean             has_history;
+} UserSnapshot;
+
+/* Facts about the selected user that do not change unless the
+ * user does, memoised to avoid repeated lookups on each refresh. */
+typedef struct {
+	ActUser  *user;
+	gboolean  valid;
+	gboolean  is_self;
+	gboolean  is_local;
+	gboolean  is_admin;
+} SelectedUserInfo;
+
+typedef struct _BatchOperation BatchOperation;
+
 struct _CcUserPanel {
 	GtkWindow        _parent;
 
@@ -63,15 +98,32 @@ struct _CcUserPanel {
 
 	GtkWidget        *main_box;
 	GPermission      *permission;
+	gboolean          is_authorized;
+
+	ActUser          *current_user;
+	SelectedUserInfo  selected;
 
 	UmPasswordDialog *password_dialog;
 	UmPhotoDialog    *photo_dialog;
 	UmHistoryDialog  *history_dialog;
 
+	GtkListStore     *user_store;
+	GtkTreeModel     *user_filter;
+	UmUserIndex      *user_index;
+
+	GHashTable       *changed_users;
+	guint             changed_users_id;
+
+	UserSnapshot      shown;
+	guint             skipped_updates;
+
 	gint              other_accounts;
 	GtkTreeIter      *other_iter;
 
 	UmAccountDialog  *account_dialog;
+
+	GtkWidget        *user_menu;
+	BatchOperation   *batch;
 };
 
 G_DEFINE_TYPE (CcUserPanel, cc_user_panel, GTK_TYPE_WINDOW)
@@ -133,6 +185,23 @@ show_error_dialog (CcUserPanel *d,
 	gtk_window_present (GTK_WINDOW (dialog));
 }
 
+/* The details of a user are only shown when it is the only one selected */
+static gboolean
+get_single_selected (GtkTreeSelection  *selection,
+                     GtkTreeModel     **model,
+                     GtkTreeIter       *iter)
+{
+	GList *rows;
+	gboolean found = FALSE;
+
+	rows = gtk_tree_selection_get_selected_rows (selection, model);
+	if (rows != NULL && rows->next == NULL)
+		found = gtk_tree_model_get_iter (*model, iter, rows->data);
+	g_list_free_full (rows, (GDestroyNotify) gtk_tree_path_free);
+
+	return found;
+}
+
 static ActUser *
 get_selected_user (CcUserPanel *d)
 {
@@ -145,7 +214,7 @@ get_selected_user (CcUserPanel *d)
 	tv = (GtkTreeView *)get_widget (d, "list-treeview");
 	selection = gtk_tree_view_get_selection (tv);
 
-	if (gtk_tree_selection_get_selected (selection, &model, &iter)) {
+	if (get_single_selected (selection, &model, &iter)) {
 		gtk_tree_model_get (model, &iter, USER_COL, &user, -1);
 		return user;
 	}
@@ -153,6 +222,34 @@ get_selected_user (CcUserPanel *d)
 	return NULL;
 }
 
+static GPtrArray *
+get_selected_users (CcUserPanel *d)
+{
+	GtkTreeView *tv;
+	GtkTreeSelection *selection;
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+	GPtrArray *users;
+	GList *rows, *l;
+	ActUser *user;
+
+	tv = (GtkTreeView *)get_widget (d, "list-treeview");
+	selection = gtk_tree_view_get_selection (tv);
+	rows = gtk_tree_selection_get_selected_rows (selection, &model);
+
+	users = g_ptr_array_new_with_free_func (g_object_unref);
+	for (l = rows; l != NULL; l = l->next) {
+		if (!gtk_tree_model_get_iter (model, &iter, l->data))
+			continue;
+		gtk_tree_model_get (model, &iter, USER_COL, &user, -1);
+		if (user != NULL)
+			g_ptr_array_add (users, user);
+	}
+	g_list_free_full (rows, (GDestroyNotify) gtk_tree_path_free);
+
+	return users;
+}
+
 static const gchar *
 get_real_or_user_name (ActUser *user)
 {
@@ -173,6 +270,40 @@ get_name_col_str (ActUser *user)
 	                                act_user_get_user_name (user));
 }
 
+static const SelectedUserInfo *
+get_selected_info (CcUserPanel *d,
+                   ActUser     *user)
+{
+	SelectedUserInfo *info = &d->selected;
+
+	if (info->user != user) {
+		g_clear_object (&info->user);
+		info->user = g_object_ref (user);
+		info->valid = FALSE;
+	}
+
+	if (!info->valid) {
+		info->is_self = act_user_get_uid (user) == getuid ();
+		info->is_local = act_user_is_local_account (user);
+		info->is_admin = act_user_get_account_type (user) == ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR;
+		info->valid = TRUE;
+	}
+
+	return info;
+}
+
+static gboolean
+current_user_is_admin (CcUserPanel *d)
+{
+	if (d->current_user == NULL)
+		return FALSE;
+
+	if (d->current_user == d->selected.user)
+		return get_selected_info (d, d->current_user)->is_admin;
+
+	return act_user_get_account_type (d->current_user) == ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR;
+}
+
 static void show_user (ActUser *user, CcUserPanel *d);
 
 static void
@@ -193,13 +324,15 @@ user_added (ActUserManager *um, ActUser *user, CcUserPanel *d)
 
 	g_debug ("user added: %d %s\n", act_user_get_uid (user), get_real_or_user_name (user));
 	widget = get_widget (d, "list-treeview");
-	model = gtk_tree_view_get_model (GTK_TREE_VIEW (widget));
-	store = GTK_LIST_STORE (model);
+	store = d->user_store;
 	selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (widget));
 
+	um_user_index_add (d->user_index, user);
+
 	text = get_name_col_str (user);
 
 	if (act_user_get_uid (user) == getuid ()) {
+		g_set_object (&d->current_user, user);
 		sort_key = 1;
 	}
 	else {
@@ -219,8 +352,10 @@ user_added (ActUserManager *um, ActUser *user, CcUserPanel *d)
 	g_free (text);
 
 	if (sort_key == 1 &&
-	    !gtk_tree_selection_get_selected (selection, &model, &dummy)) {
-		gtk_tree_selection_select_iter (selection, &iter);
+	    gtk_tree_selection_count_selected_rows (selection) == 0 &&
+	    gtk_tree_model_filter_convert_child_iter_to_iter (GTK_TREE_MODEL_FILTER (d->user_filter),
+	                                                      &dummy, &iter)) {
+		gtk_tree_selection_select_iter (selection, &dummy);
 	}
 
 	/* Show heading for other accounts if new one have been added. */
@@ -237,13 +372,14 @@ user_added (ActUserManager *um, ActUser *user, CcUserPanel *d)
 	}
 }
 
-static void
+static gboolean
 get_previous_user_row (GtkTreeModel *model,
                        GtkTreeIter  *iter,
                        GtkTreeIter  *prev)
 {
 	GtkTreePath *path;
 	ActUser *user;
+	gboolean found = FALSE;
 
 	path = gtk_tree_model_get_path (model, iter);
 	while (gtk_tree_path_prev (path)) {
@@ -251,10 +387,13 @@ get_previous_user_row (GtkTreeModel *model,
 		gtk_tree_model_get (model, prev, USER_COL, &user, -1);
 		if (user) {
 			g_object_unref (user);
+			found = TRUE;
 			break;
 		}
 	}
 	gtk_tree_path_free (path);
+
+	return found;
 }
 
 static gboolean
@@ -281,17 +420,28 @@ user_removed (ActUserManager *um, ActUser *user, CcUserPanel *d)
 {
 	GtkTreeView *tv;
 	GtkTreeModel *model;
+	GtkTreeModelFilter *filter;
 	GtkTreeSelection *selection;
 	GtkListStore *store;
-	GtkTreeIter iter, next;
+	GtkTreeIter iter, next, filter_iter, filter_next;
 	ActUser *u;
+	gboolean has_next;
 	gint key = 0;
 
 	g_debug ("user removed: %s\n", act_user_get_user_name (user));
 	tv = (GtkTreeView *)get_widget (d, "list-treeview");
 	selection = gtk_tree_view_get_selection (tv);
-	model = gtk_tree_view_get_model (tv);
-	store = GTK_LIST_STORE (model);
+	filter = GTK_TREE_MODEL_FILTER (d->user_filter);
+	store = d->user_store;
+	model = GTK_TREE_MODEL (store);
+
+	um_user_index_remove (d->user_index, user);
+	g_hash_table_remove (d->changed_users, user);
+	if (d->current_user == user)
+		g_clear_object (&d->current_user);
+	if (d->selected.user == user)
+		g_clear_object (&d->selected.user);
+
 	if (gtk_tree_model_get_iter_first (model, &iter))
 	{
 		do {
@@ -299,13 +449,24 @@ user_removed (ActUserManager *um, ActUser *user, CcUserPanel *d)
 
 			if (u != NULL) {
 				if (act_user_get_uid (user) == act_user_get_uid (u)) {
-					if (!get_next_user_row (model, &iter, &next))
-						get_previous_user_row (model, &iter, &next);
+					/* Look for the closest visible user to select instead,
+					 * unless a batch operation is removing users */
+					has_next = FALSE;
+					if (d->batch == NULL &&
+					    gtk_tree_model_filter_convert_child_iter_to_iter (filter, &filter_iter, &iter)) {
+						has_next = get_next_user_row (d->user_filter, &filter_iter, &filter_next) ||
+						           get_previous_user_row (d->user_filter, &filter_iter, &filter_next);
+						if (has_next)
+							gtk_tree_model_filter_convert_iter_to_child_iter (filter, &next, &filter_next);
+					}
 					if (key == 3) {
 						d->other_accounts--;
 					}
 					gtk_list_store_remove (store, &iter);
-					gtk_tree_selection_select_iter (selection, &next);
+					if (has_next &&
+					    gtk_tree_selection_count_selected_rows (selection) == 0 &&
+					    gtk_tree_model_filter_convert_child_iter_to_iter (filter, &filter_next, &next))
+						gtk_tree_selection_select_iter (selection, &filter_next);
 					g_object_unref (u);
 					break;
 				}
@@ -322,49 +483,155 @@ user_removed (ActUserManager *um, ActUser *user, CcUserPanel *d)
 	}
 }
 
-static void
-user_changed (ActUserManager *um, ActUser *user, CcUserPanel *d)
+static gboolean
+flush_changed_users (gpointer data)
 {
+	CcUserPanel *d = data;
 	GtkTreeView *tv;
 	GtkTreeSelection *selection;
 	GtkTreeModel *model;
 	GtkTreeIter iter;
+	GtkTreePath *path;
 	ActUser *current;
-	char *text;
+	gchar *text, *old_text;
+	guint pending;
 
-	tv = (GtkTreeView *)get_widget (d, "list-treeview");
-	model = gtk_tree_view_get_model (tv);
-	selection = gtk_tree_view_get_selection (tv);
+	d->changed_users_id = 0;
 
-	g_assert (gtk_tree_model_get_iter_first (model, &iter));
-	do {
-		gtk_tree_model_get (model, &iter, USER_COL, &current, -1);
-		if (current == user) {
-			text = get_name_col_str (user);
+	if (d->selected.user != NULL &&
+	    g_hash_table_contains (d->changed_users, d->selected.user))
+		d->selected.valid = FALSE;
 
-			gtk_list_store_set (GTK_LIST_STORE (model), &iter,
-				USER_COL, user,
-				NAME_COL, text,
-				-1);
-			g_free (text);
-			g_object_unref (current);
+	pending = g_hash_table_size (d->changed_users);
+	g_debug ("applying changes of %u users\n", pending);
 
-			break;
-		}
-		if (current)
-			g_object_unref (current);
+	tv = (GtkTreeView *)get_widget (d, "list-treeview");
+	model = GTK_TREE_MODEL (d->user_store);
+	selection = gtk_tree_view_get_selection (tv);
 
-	} while (gtk_tree_model_iter_next (model, &iter));
+	if (gtk_tree_model_get_iter_first (model, &iter)) {
+		do {
+			gtk_tree_model_get (model, &iter, USER_COL, &current, NAME_COL, &old_text, -1);
+			if (current != NULL && g_hash_table_contains (d->changed_users, current)) {
+				text = get_name_col_str (current);
+
+				/* Refresh the index first, the row change refilters it */
+				um_user_index_add (d->user_index, current);
+				if (g_strcmp0 (text, old_text) != 0) {
+					gtk_list_store_set (d->user_store, &iter,
+						NAME_COL, text,
+						-1);
+				} else {
+					/* The avatar is drawn from USER_COL, which
+					 * does not change when only the icon did */
+					path = gtk_tree_model_get_path (model, &iter);
+					gtk_tree_model_row_changed (model, path, &iter);
+					gtk_tree_path_free (path);
+				}
+				g_free (text);
+				pending--;
+			}
+			if (current)
+				g_object_unref (current);
+			g_free (old_text);
+
+		} while (pending > 0 && gtk_tree_model_iter_next (model, &iter));
+	}
 
-	if (gtk_tree_selection_get_selected (selection, &model, &iter)) {
+	if (get_single_selected (selection, &model, &iter)) {
 		gtk_tree_model_get (model, &iter, USER_COL, &current, -1);
 
-		if (current == user) {
-			show_user (user, d);
+		if (current != NULL && g_hash_table_contains (d->changed_users, current)) {
+			show_user (current, d);
 		}
 		if (current)
 			g_object_unref (current);
 	}
+
+	g_hash_table_remove_all (d->changed_users);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+user_changed (ActUserManager *um, ActUser *user, CcUserPanel *d)
+{
+	/* Changes usually come in bursts, so just note the user and
+	 * update the list and the details once the burst is over. A
+	 * batch operation applies them when it is done. */
+	if (!g_hash_table_contains (d->changed_users, user))
+		g_hash_table_add (d->changed_users, g_object_ref (user));
+
+	if (d->changed_users_id == 0 && d->batch == NULL)
+		d->changed_users_id = g_idle_add (flush_changed_users, d);
+}
+
+static gboolean
+user_row_visible (GtkTreeModel *model,
+                  GtkTreeIter  *iter,
+                  gpointer      data)
+{
+	CcUserPanel *d = data;
+	ActUser *user;
+	gboolean visible;
+
+	if (d->user_index == NULL || !um_user_index_is_filtering (d->user_index))
+		return TRUE;
+
+	/* Headings are hidden while searching */
+	gtk_tree_model_get (model, iter, USER_COL, &user, -1);
+	if (user == NULL)
+		return FALSE;
+
+	visible = um_user_index_matches (d->user_index, user);
+	g_object_unref (user);
+
+	return visible;
+}
+
+static void
+apply_user_search (CcUserPanel *d)
+{
+	GtkTreeView *tv;
+	GtkTreeSelection *selection;
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+	const gchar *text;
+	gboolean is_user;
+
+	text = gtk_entry_get_text (GTK_ENTRY (get_widget (d, "user-search-entry")));
+	if (!um_user_index_set_query (d->user_index, text))
+		return;
+
+	gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (d->user_filter));
+
+	/* Keep some user selected while there are matches */
+	tv = (GtkTreeView *)get_widget (d, "list-treeview");
+	model = gtk_tree_view_get_model (tv);
+	selection = gtk_tree_view_get_selection (tv);
+	if (gtk_tree_selection_count_selected_rows (selection) > 0)
+		return;
+
+	if (!gtk_tree_model_get_iter_first (model, &iter))
+		return;
+
+	gtk_tree_model_get (model, &iter, USER_ROW_COL, &is_user, -1);
+	if (is_user || get_next_user_row (model, &iter, &iter))
+		gtk_tree_selection_select_iter (selection, &iter);
+}
+
+static void
+user_search_changed (GtkSearchEntry *entry,
+                     CcUserPanel    *d)
+{
+	apply_user_search (d);
+}
+
+static void
+user_search_stopped (GtkSearchEntry *entry,
+                     CcUserPanel    *d)
+{
+	gtk_entry_set_text (GTK_ENTRY (entry), "");
 }
 
 static void
@@ -403,6 +670,10 @@ select_created_user (GObject      *object,
 	g_free (defaut_avatar);
 	g_object_unref (settings);
 
+	/* The new user may not match the current search */
+	gtk_entry_set_text (GTK_ENTRY (get_widget (d, "user-search-entry")), "");
+	apply_user_search (d);
+
 	tv = (GtkTreeView *)get_widget (d, "list-treeview");
 	model = gtk_tree_view_get_model (tv);
 	selection = gtk_tree_view_get_selection (tv);
@@ -415,6 +686,7 @@ select_created_user (GObject      *object,
 			if (user_uid == act_user_get_uid (current)) {
 				path = gtk_tree_model_get_path (model, &iter);
 				gtk_tree_view_scroll_to_cell (tv, path, NULL, FALSE, 0.0, 0.0);
+				gtk_tree_selection_unselect_all (selection);
 				gtk_tree_selection_select_path (selection, path);
 				gtk_tree_path_free (path);
 				g_object_unref (current);
@@ -663,6 +935,8 @@ delete_enterprise_user_response (GtkWidget          *dialog,
 	                                     data);
 }
 
+static void delete_selected_users (CcUserPanel *d);
+
 static void
 delete_user (GtkButton *button, CcUserPanel *d)
 {
@@ -671,6 +945,7 @@ delete_user (GtkButton *button, CcUserPanel *d)
 
 	user = get_selected_user (d);
 	if (user == NULL) {
+		delete_selected_users (d);
 		return;
 	}
 	else if (act_user_get_uid (user) == getuid ()) {
@@ -746,6 +1021,639 @@ delete_user (GtkButton *button, CcUserPanel *d)
 	g_object_unref (user);
 }
 
+/* Operations on all the selected users. The AccountsService calls are
+ * issued a few at a time, and the list and the details are only
+ * refreshed once every call has returned. */
+
+#define MAX_BATCH_IN_FLIGHT 8
+
+typedef enum {
+	BATCH_DELETE,
+	BATCH_LOCK,
+	BATCH_UNLOCK,
+	BATCH_SET_ADMINISTRATOR,
+	BATCH_SET_STANDARD
+} BatchAction;
+
+struct _BatchOperation {
+	CcUserPanel     *self;
+	BatchAction      action;
+	gboolean         remove_files;
+	GPtrArray       *users;
+	guint            next;
+	guint            in_flight;
+	guint            n_done;
+	guint            n_failed;
+	GString         *errors;
+	GCancellable    *cancellable;
+	GDBusConnection *bus;
+	GtkWidget       *dialog;
+	GtkWidget       *progress_bar;
+	gint64           start_time;
+};
+
+typedef struct {
+	BatchOperation *batch;
+	ActUser        *user;
+} BatchItem;
+
+static void selected_user_changed (GtkTreeSelection *selection, CcUserPanel *d);
+static void batch_operation_next (BatchOperation *batch);
+
+static void
+batch_operation_free (BatchOperation *batch)
+{
+	g_object_unref (batch->self);
+	g_ptr_array_unref (batch->users);
+	g_string_free (batch->errors, TRUE);
+	g_object_unref (batch->cancellable);
+	g_clear_object (&batch->bus);
+	g_free (batch);
+}
+
+/* Stops issuing calls, the batch is freed once the running ones return */
+static void
+batch_operation_cancel (BatchOperation *batch)
+{
+	g_cancellable_cancel (batch->cancellable);
+}
+
+static void
+batch_operation_finish (BatchOperation *batch)
+{
+	CcUserPanel *d = batch->self;
+	GtkTreeSelection *selection;
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+	GError *error;
+	gchar *message;
+	gboolean is_user;
+
+	g_debug ("Batch operation on %u users done in %.2f seconds, %u failed\n",
+	         batch->n_done,
+	         (gdouble) (g_get_monotonic_time () - batch->start_time) / G_USEC_PER_SEC,
+	         batch->n_failed);
+
+	/* The panel went away meanwhile */
+	if (d->batch != batch) {
+		batch_operation_free (batch);
+		return;
+	}
+
+	d->batch = NULL;
+	gtk_widget_destroy (batch->dialog);
+
+	if (batch->n_failed > 0) {
+		error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED, batch->errors->str);
+		message = g_strdup_printf (ngettext ("Failed to change %u user account",
+		                                     "Failed to change %u user accounts",
+		                                     batch->n_failed),
+		                           batch->n_failed);
+		show_error_dialog (d, message, error);
+		g_free (message);
+		g_error_free (error);
+	}
+
+	/* Apply the changes held back during the batch */
+	if (g_hash_table_size (d->changed_users) > 0 && d->changed_users_id == 0)
+		d->changed_users_id = g_idle_add (flush_changed_users, d);
+
+	selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (get_widget (d, "list-treeview")));
+	model = gtk_tree_view_get_model (GTK_TREE_VIEW (get_widget (d, "list-treeview")));
+	if (gtk_tree_selection_count_selected_rows (selection) == 0 &&
+	    gtk_tree_model_get_iter_first (model, &iter)) {
+		gtk_tree_model_get (model, &iter, USER_ROW_COL, &is_user, -1);
+		if (is_user || get_next_user_row (model, &iter, &iter))
+			gtk_tree_selection_select_iter (selection, &iter);
+	}
+	selected_user_changed (selection, d);
+
+	batch_operation_free (batch);
+}
+
+static void
+batch_item_done (BatchItem *item,
+                 GError    *error)
+{
+	BatchOperation *batch = item->batch;
+	gchar *text;
+
+	batch->in_flight--;
+	batch->n_done++;
+
+	if (error != NULL) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_dbus_error_strip_remote_error (error);
+			g_debug ("Batch operation failed for %s: %s\n",
+			         act_user_get_user_name (item->user), error->message);
+			g_string_append_printf (batch->errors, "%s: %s\n",
+			                        act_user_get_user_name (item->user), error->message);
+			batch->n_failed++;
+		}
+		g_error_free (error);
+	}
+	g_free (item);
+
+	if (batch->self->batch == batch) {
+		text = g_strdup_printf (_("%u of %u"), batch->n_done, batch->users->len);
+		gtk_progress_bar_set_text (GTK_PROGRESS_BAR (batch->progress_bar), text);
+		gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (batch->progress_bar),
+		                               (gdouble) batch->n_done / batch->users->len);
+		g_free (text);
+	}
+
+	batch_operation_next (batch);
+}
+
+static void
+batch_delete_done (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+	GError *error = NULL;
+
+	act_user_manager_delete_user_finish (ACT_USER_MANAGER (source), result, &error);
+	batch_item_done (user_data, error);
+}
+
+static void
+batch_call_done (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	GVariant *ret;
+	GError *error = NULL;
+
+	ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+	if (ret != NULL)
+		g_variant_unref (ret);
+	batch_item_done (user_data, error);
+}
+
+/* ActUser only offers blocking setters, so the AccountsService methods
+ * are called directly to have several calls running at once. */
+static void
+batch_call_user_method_full (BatchItem           *item,
+                             const gchar         *method,
+                             GVariant            *parameters,
+                             GAsyncReadyCallback  callback)
+{
+	g_dbus_connection_call (item->batch->bus,
+	                        "org.freedesktop.Accounts",
+	                        act_user_get_object_path (item->user),
+	                        "org.freedesktop.Accounts.User",
+	                        method,
+	                        parameters,
+	                        NULL,
+	                        G_DBUS_CALL_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION,
+	                        -1,
+	                        item->batch->cancellable,
+	                        callback,
+	                        item);
+}
+
+static void
+batch_call_user_method (BatchItem   *item,
+                        const gchar *method,
+                        GVariant    *parameters)
+{
+	batch_call_user_method_full (item, method, parameters, batch_call_done);
+}
+
+static void
+batch_delete_user (BatchItem *item)
+{
+	act_user_manager_delete_user_async (item->batch->self->um,
+	                                    item->user,
+	                                    item->batch->remove_files,
+	                                    item->batch->cancellable,
+	                                    batch_delete_done,
+	                                    item);
+}
+
+/* Deleting goes on even if automatic login could not be turned off,
+ * as it did when done one user at a time */
+static void
+batch_autologin_done (GObject      *source,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+	BatchItem *item = user_data;
+	GVariant *ret;
+	GError *error = NULL;
+
+	ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+	if (ret != NULL) {
+		g_variant_unref (ret);
+	} else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		batch_item_done (item, error);
+		return;
+	} else {
+		g_debug ("Failed to disable automatic login of %s: %s\n",
+		         act_user_get_user_name (item->user), error->message);
+		g_error_free (error);
+	}
+
+	batch_delete_user (item);
+}
+
+static void
+batch_operation_next (BatchOperation *batch)
+{
+	BatchItem *item;
+
+	while (batch->in_flight < MAX_BATCH_IN_FLIGHT &&
+	       batch->next < batch->users->len &&
+	       !g_cancellable_is_cancelled (batch->cancellable)) {
+		item = g_new0 (BatchItem, 1);
+		item->batch = batch;
+		item->user = g_ptr_array_index (batch->users, batch->next++);
+		batch->in_flight++;
+
+		switch (batch->action) {
+		case BATCH_DELETE:
+			if (act_user_get_automatic_login (item->user))
+				batch_call_user_method_full (item, "SetAutomaticLogin",
+				                             g_variant_new ("(b)", FALSE),
+				                             batch_autologin_done);
+			else
+				batch_delete_user (item);
+			break;
+		case BATCH_LOCK:
+		case BATCH_UNLOCK:
+			batch_call_user_method (item, "SetLocked",
+			                        g_variant_new ("(b)", batch->action == BATCH_LOCK));
+			break;
+		case BATCH_SET_ADMINISTRATOR:
+			batch_call_user_method (item, "SetAccountType",
+			                        g_variant_new ("(i)", ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR));
+			break;
+		case BATCH_SET_STANDARD:
+			batch_call_user_method (item, "SetAccountType",
+			                        g_variant_new ("(i)", ACT_USER_ACCOUNT_TYPE_STANDARD));
+			break;
+		}
+	}
+
+	if (batch->in_flight == 0)
+		batch_operation_finish (batch);
+}
+
+static void
+batch_dialog_response (GtkDialog      *dialog,
+                       gint            response_id,
+                       BatchOperation *batch)
+{
+	gtk_dialog_set_response_sensitive (dialog, GTK_RESPONSE_CANCEL, FALSE);
+	batch_operation_cancel (batch);
+}
+
+static void
+batch_operation_start (CcUserPanel *d,
+                       BatchAction  action,
+                       gboolean     remove_files,
+                       GPtrArray   *users)
+{
+	BatchOperation *batch;
+	GError *error = NULL;
+	const gchar *title;
+
+	batch = g_new0 (BatchOperation, 1);
+	batch->self = g_object_ref (d);
+	batch->action = action;
+	batch->remove_files = remove_files;
+	batch->users = g_ptr_array_ref (users);
+	batch->errors = g_string_new (NULL);
+	batch->cancellable = g_cancellable_new ();
+	batch->start_time = g_get_monotonic_time ();
+
+	batch->bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+	if (batch->bus == NULL) {
+		show_error_dialog (d, _("Failed to contact the accounts service"), error);
+		g_error_free (error);
+		batch_operation_free (batch);
+		return;
+	}
+
+	switch (action) {
+	case BATCH_DELETE:
+		title = _("Deleting user accounts…");
+		break;
+	case BATCH_LOCK:
+		title = _("Disabling user accounts…");
+		break;
+	case BATCH_UNLOCK:
+		title = _("Enabling user accounts…");
+		break;
+	default:
+		title = _("Changing account types…");
+		break;
+	}
+
+	batch->dialog = gtk_message_dialog_new (GTK_WINDOW (gtk_widget_get_toplevel (d->main_box)),
+	                                        GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+	                                        GTK_MESSAGE_OTHER,
+	                                        GTK_BUTTONS_CANCEL,
+	                                        "%s", title);
+	batch->progress_bar = gtk_progress_bar_new ();
+	gtk_progress_bar_set_show_text (GTK_PROGRESS_BAR (batch->progress_bar), TRUE);
+	gtk_box_pack_start (GTK_BOX (gtk_message_dialog_get_message_area (GTK_MESSAGE_DIALOG (batch->dialog))),
+	                    batch->progress_bar, FALSE, FALSE, 0);
+	gtk_widget_show (batch->progress_bar);
+	g_signal_connect (batch->dialog, "response", G_CALLBACK (batch_dialog_response), batch);
+	gtk_window_present (GTK_WINDOW (batch->dialog));
+
+	d->batch = batch;
+	batch_operation_next (batch);
+}
+
+/* Returns the selected users the action applies to. Your own account
+ * and remotely managed ones are left alone, as are users who are still
+ * logged in when deleting. Users the action would not change are
+ * silently dropped. */
+static GPtrArray *
+get_batch_targets (CcUserPanel *d,
+                   BatchAction  action,
+                   guint       *n_skipped)
+{
+	GPtrArray *users, *targets;
+	ActUser *user;
+	gboolean noop;
+	guint i;
+
+	users = get_selected_users (d);
+	targets = g_ptr_array_new_with_free_func (g_object_unref);
+	*n_skipped = 0;
+
+	for (i = 0; i < users->len; i++) {
+		user = g_ptr_array_index (users, i);
+
+		switch (action) {
+		case BATCH_LOCK:
+			noop = act_user_get_locked (user);
+			break;
+		case BATCH_UNLOCK:
+			noop = !act_user_get_locked (user);
+			break;
+		case BATCH_SET_ADMINISTRATOR:
+			noop = act_user_get_account_type (user) == ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR;
+			break;
+		case BATCH_SET_STANDARD:
+			noop = act_user_get_account_type (user) == ACT_USER_ACCOUNT_TYPE_STANDARD;
+			break;
+		default:
+			noop = FALSE;
+			break;
+		}
+		if (noop)
+			continue;
+
+		if (act_user_get_uid (user) == getuid () ||
+		    !act_user_is_local_account (user) ||
+		    (action == BATCH_DELETE && act_user_is_logged_in_anywhere (user))) {
+			(*n_skipped)++;
+			continue;
+		}
+
+		g_ptr_array_add (targets, g_object_ref (user));
+	}
+
+	g_ptr_array_unref (users);
+
+	return targets;
+}
+
+/* Prevent removing every enabled administrator at once, as
+ * would_demote_only_admin() does for a single user. */
+static gboolean
+batch_keeps_an_admin (CcUserPanel *d,
+                      BatchAction  action,
+                      GPtrArray   *targets)
+{
+	guint n_demoted = 0;
+	guint i;
+
+	if (action == BATCH_UNLOCK || action == BATCH_SET_ADMINISTRATOR)
+		return TRUE;
+
+	for (i = 0; i < targets->len; i++) {
+		if (is_active_admin (g_ptr_array_index (targets, i)))
+			n_demoted++;
+	}
+	if (n_demoted == 0)
+		return TRUE;
+
+	return get_num_active_admin (d->um) > n_demoted;
+}
+
+static void
+run_batch (CcUserPanel *d,
+           BatchAction  action,
+           gboolean     remove_files,
+           GPtrArray   *targets)
+{
+	if (d->batch != NULL || targets->len == 0)
+		return;
+
+	if (!batch_keeps_an_admin (d, action, targets)) {
+		show_error_dialog (d, _("At least one administrator account must remain enabled"), NULL);
+		return;
+	}
+
+	batch_operation_start (d, action, remove_files, targets);
+}
+
+static void
+delete_selected_users_response (GtkWidget   *dialog,
+                                gint         response_id,
+                                CcUserPanel *d)
+{
+	GPtrArray *targets;
+
+	targets = g_ptr_array_ref (g_object_get_data (G_OBJECT (dialog), "targets"));
+	gtk_widget_destroy (dialog);
+
+	if (response_id == GTK_RESPONSE_NO)
+		run_batch (d, BATCH_DELETE, TRUE, targets);
+	else if (response_id == GTK_RESPONSE_YES)
+		run_batch (d, BATCH_DELETE, FALSE, targets);
+
+	g_ptr_array_unref (targets);
+}
+
+/* Asks once for all the selected users, instead of once per user */
+static void
+delete_selected_users (CcUserPanel *d)
+{
+	GPtrArray *targets;
+	GtkWidget *dialog;
+	guint n_skipped;
+
+	targets = get_batch_targets (d, BATCH_DELETE, &n_skipped);
+
+	if (targets->len == 0 && n_skipped == 0) {
+		g_ptr_array_unref (targets);
+		return;
+	}
+	else if (targets->len == 0) {
+		dialog = gtk_message_dialog_new (GTK_WINDOW (gtk_widget_get_toplevel (d->main_box)),
+		                                 0,
+		                                 GTK_MESSAGE_INFO,
+		                                 GTK_BUTTONS_CLOSE,
+		                                 _("None of the selected accounts can be deleted"));
+		gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (dialog),
+			_("Your own account, remotely managed accounts and users who are still logged in are not deleted."));
+		g_signal_connect (dialog, "response",
+			G_CALLBACK (gtk_widget_destroy), NULL);
+		g_ptr_array_unref (targets);
+	}
+	else {
+		dialog = gtk_message_dialog_new (GTK_WINDOW (gtk_widget_get_toplevel (d->main_box)),
+		                                 0,
+		                                 GTK_MESSAGE_QUESTION,
+		                                 GTK_BUTTONS_NONE,
+		                                 ngettext ("Do you want to keep the files of %u user?",
+		                                           "Do you want to keep the files of %u users?",
+		                                           targets->len),
+		                                 targets->len);
+
+		if (n_skipped > 0)
+			gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (dialog),
+				ngettext ("%u of the selected accounts cannot be deleted and will be kept.",
+				          "%u of the selected accounts cannot be deleted and will be kept.",
+				          n_skipped),
+				n_skipped);
+		else
+			gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (dialog),
+				_("It is possible to keep the home directory, mail spool and temporary files around when deleting a user account."));
+
+		gtk_dialog_add_buttons (GTK_DIALOG (dialog),
+		                        _("_Delete Files"), GTK_RESPONSE_NO,
+		                        _("_Keep Files"), GTK_RESPONSE_YES,
+		                        _("_Cancel"), GTK_RESPONSE_CANCEL,
+		                        NULL);
+
+		gtk_window_set_icon_name (GTK_WINDOW (dialog), "system-users");
+
+		g_object_set_data_full (G_OBJECT (dialog), "targets", targets,
+		                        (GDestroyNotify) g_ptr_array_unref);
+		g_signal_connect (dialog, "response",
+			G_CALLBACK (delete_selected_users_response), d);
+	}
+
+	g_signal_connect (dialog, "close",
+		G_CALLBACK (gtk_widget_destroy), NULL);
+
+	gtk_window_set_modal (GTK_WINDOW (dialog), TRUE);
+
+	gtk_window_present (GTK_WINDOW (dialog));
+}
+
+static void
+user_menu_item_activated (GtkMenuItem *item,
+                          CcUserPanel *d)
+{
+	BatchAction action;
+	GPtrArray *targets;
+	guint n_skipped;
+
+	action = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (item), "batch-action"));
+	if (action == BATCH_DELETE) {
+		delete_selected_users (d);
+		return;
+	}
+
+	targets = get_batch_targets (d, action, &n_skipped);
+	run_batch (d, action, FALSE, targets);
+	g_ptr_array_unref (targets);
+}
+
+static void
+add_user_menu_item (CcUserPanel *d,
+                    const gchar *label,
+                    BatchAction  action)
+{
+	GtkWidget *item;
+
+	item = gtk_menu_item_new_with_mnemonic (label);
+	g_object_set_data (G_OBJECT (item), "batch-action", GINT_TO_POINTER (action));
+	g_signal_connect (item, "activate", G_CALLBACK (user_menu_item_activated), d);
+	gtk_menu_shell_append (GTK_MENU_SHELL (d->user_menu), item);
+}
+
+static void
+setup_user_menu (CcUserPanel *d,
+                 GtkWidget   *userlist)
+{
+	d->user_menu = gtk_menu_new ();
+	add_user_menu_item (d, _("Make _Administrator"), BATCH_SET_ADMINISTRATOR);
+	add_user_menu_item (d, _("Make _Standard"), BATCH_SET_STANDARD);
+	gtk_menu_shell_append (GTK_MENU_SHELL (d->user_menu), gtk_separator_menu_item_new ());
+	add_user_menu_item (d, _("_Enable"), BATCH_UNLOCK);
+	add_user_menu_item (d, _("D_isable"), BATCH_LOCK);
+	gtk_menu_shell_append (GTK_MENU_SHELL (d->user_menu), gtk_separator_menu_item_new ());
+	add_user_menu_item (d, _("_Delete…"), BATCH_DELETE);
+	gtk_widget_show_all (d->user_menu);
+
+	gtk_menu_attach_to_widget (GTK_MENU (d->user_menu), userlist, NULL);
+}
+
+static void
+popup_user_menu (CcUserPanel *d,
+                 GdkEvent    *event)
+{
+	GtkTreeSelection *selection;
+	gboolean sensitive;
+	GList *items, *l;
+
+	selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (get_widget (d, "list-treeview")));
+	sensitive = d->is_authorized && d->batch == NULL &&
+	            gtk_tree_selection_count_selected_rows (selection) > 0;
+
+	items = gtk_container_get_children (GTK_CONTAINER (d->user_menu));
+	for (l = items; l != NULL; l = l->next)
+		gtk_widget_set_sensitive (l->data, sensitive);
+	g_list_free (items);
+
+	gtk_menu_popup_at_pointer (GTK_MENU (d->user_menu), event);
+}
+
+static gboolean
+user_list_button_press (GtkWidget      *widget,
+                        GdkEventButton *event,
+                        CcUserPanel    *d)
+{
+	GtkTreeSelection *selection;
+	GtkTreePath *path;
+
+	if (!gdk_event_triggers_context_menu ((GdkEvent *) event))
+		return FALSE;
+
+	/* Clicking outside of the selection selects that row alone */
+	if (gtk_tree_view_get_path_at_pos (GTK_TREE_VIEW (widget), event->x, event->y,
+	                                   &path, NULL, NULL, NULL)) {
+		selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (widget));
+		if (!gtk_tree_selection_path_is_selected (selection, path)) {
+			gtk_tree_selection_unselect_all (selection);
+			gtk_tree_selection_select_path (selection, path);
+		}
+		gtk_tree_path_free (path);
+	}
+
+	popup_user_menu (d, (GdkEvent *) event);
+
+	return TRUE;
+}
+
+static gboolean
+user_list_popup_menu (GtkWidget   *widget,
+                      CcUserPanel *d)
+{
+	popup_user_menu (d, NULL);
+
+	return TRUE;
+}
+
 static const gchar *
 get_invisible_text (void)
 {
@@ -809,6 +1717,8 @@ autologin_changed (GObject     *object,
 
 	active = gtk_switch_get_active (GTK_SWITCH (object));
 	user = get_selected_user (d);
+	if (user == NULL)
+		return;
 
 	if (active != act_user_get_automatic_login (user)) {
 		act_user_set_automatic_login (user, active);
@@ -876,82 +1786,208 @@ get_autologin_possible (ActUser *user)
 
 static void on_permission_changed (GPermission *permission, GParamSpec *pspec, gpointer data);
 
+static void
+user_snapshot_clear (UserSnapshot *shown)
+{
+	g_clear_object (&shown->user);
+	g_clear_pointer (&shown->icon_file, g_free);
+	g_clear_pointer (&shown->real_name, g_free);
+	g_clear_pointer (&shown->user_name, g_free);
+}
+
+static gint64
+get_icon_mtime (const gchar *icon_file)
+{
+	GStatBuf buf;
+
+	/* AccountsService keeps the icon path when the icon changes */
+	if (icon_file == NULL || *icon_file == '\0' || g_stat (icon_file, &buf) != 0)
+		return 0;
+
+	return (gint64) buf.st_mtime;
+}
+
 static void
 show_user (ActUser *user, CcUserPanel *d)
 {
+	UserSnapshot *shown = &d->shown;
+	const SelectedUserInfo *info;
 	GtkWidget *image;
 	GtkWidget *label;
 	GtkWidget *widget;
-	gboolean show, enable;
-	ActUser *current;
+	gboolean show, same_user;
+	const gchar *icon_file;
+	gint64 icon_mtime;
+	ActUserAccountType account_type;
+	ActUserPasswordMode password_mode;
+	gboolean locked, local, logged_in;
+	gint64 login_time;
+	guint skipped = 0;
 	gchar *text;
 
-	image = get_widget (d, "user-icon-image");
-	um_user_image_set_user (UM_USER_IMAGE (image), user);
-	image = get_widget (d, "user-icon-image2");
-	um_user_image_set_user (UM_USER_IMAGE (image), user);
+	info = get_selected_info (d, user);
 
-	um_photo_dialog_set_user (d->photo_dialog, user);
+	same_user = (shown->user == user);
+	if (!same_user) {
+		user_snapshot_clear (shown);
+		shown->user = g_object_ref (user);
+	}
 
-	widget = get_widget (d, "full-name-entry");
-	gtk_entry_set_text (GTK_ENTRY (widget), act_user_get_real_name (user));
-	gtk_widget_set_tooltip_text (widget, act_user_get_user_name (user));
+	icon_file = act_user_get_icon_file (user);
+	icon_mtime = get_icon_mtime (icon_file);
+	if (!same_user ||
+	    g_strcmp0 (icon_file, shown->icon_file) != 0 ||
+	    icon_mtime != shown->icon_mtime) {
+		image = get_widget (d, "user-icon-image");
+		um_user_image_set_user (UM_USER_IMAGE (image), user);
+		image = get_widget (d, "user-icon-image2");
+		um_user_image_set_user (UM_USER_IMAGE (image), user);
 
-	widget = get_widget (d, act_user_get_account_type (user) ? "account-type-admin" : "account-type-standard");
-	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), TRUE);
+		um_photo_dialog_set_user (d->photo_dialog, user);
+
+		g_free (shown->icon_file);
+		shown->icon_file = g_strdup (icon_file);
+		shown->icon_mtime = icon_mtime;
+	}
+	else {
+		skipped++;
+	}
+
+	if (!same_user ||
+	    g_strcmp0 (act_user_get_real_name (user), shown->real_name) != 0 ||
+	    g_strcmp0 (act_user_get_user_name (user), shown->user_name) != 0) {
+		widget = get_widget (d, "full-name-entry");
+		gtk_entry_set_text (GTK_ENTRY (widget), act_user_get_real_name (user));
+		gtk_widget_set_tooltip_text (widget, act_user_get_user_name (user));
+
+		g_free (shown->real_name);
+		shown->real_name = g_strdup (act_user_get_real_name (user));
+		g_free (shown->user_name);
+		shown->user_name = g_strdup (act_user_get_user_name (user));
+	}
+	else {
+		skipped++;
+	}
+
+	account_type = act_user_get_account_type (user);
+	if (!same_user || account_type != shown->account_type) {
+		widget = get_widget (d, account_type ? "account-type-admin" : "account-type-standard");
+		gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), TRUE);
+		shown->account_type = account_type;
+	}
+	else {
+		skipped++;
+	}
 
         /* Do not show the "Account Type" option when there's a single user account. */
 	show = (d->other_accounts != 0);
-	gtk_widget_set_visible (get_widget (d, "account-type-label"), show);
-	gtk_widget_set_visible (get_widget (d, "account-type-box"), show);
+	if (!same_user || show != shown->show_account_type) {
+		gtk_widget_set_visible (get_widget (d, "account-type-label"), show);
+		gtk_widget_set_visible (get_widget (d, "account-type-box"), show);
+		shown->show_account_type = show;
+	}
+	else {
+		skipped++;
+	}
 
-	widget = get_widget (d, "account-password-button-label");
-	gtk_label_set_label (GTK_LABEL (widget), get_password_mode_text (user));
-	enable = act_user_is_local_account (user);
-	gtk_widget_set_sensitive (widget, enable);
+	/* The password label and the autologin sensitivity depend on the same properties */
+	password_mode = act_user_get_password_mode (user);
+	locked = act_user_get_locked (user);
+	local = info->is_local;
+	if (!same_user ||
+	    password_mode != shown->password_mode ||
+	    locked != shown->locked ||
+	    local != shown->local_account) {
+		widget = get_widget (d, "account-password-button-label");
+		gtk_label_set_label (GTK_LABEL (widget), get_password_mode_text (user));
+		gtk_widget_set_sensitive (widget, local);
 
-	widget = get_widget (d, "autologin-switch");
-	g_signal_handlers_block_by_func (widget, autologin_changed, d);
-	gtk_switch_set_active (GTK_SWITCH (widget), act_user_get_automatic_login (user));
-	g_signal_handlers_unblock_by_func (widget, autologin_changed, d);
-	gtk_widget_set_sensitive (widget, get_autologin_possible (user));
+		widget = get_widget (d, "autologin-switch");
+		gtk_widget_set_sensitive (widget, get_autologin_possible (user));
 
-        /* Fingerprint: show when self, local, enabled, and possible */
-	widget = get_widget (d, "account-fingerprint-button");
-	label = get_widget (d, "account-fingerprint-label");
-	show = (act_user_get_uid (user) == getuid() &&
-		act_user_is_local_account (user) &&
-		(d->login_screen_settings &&
-			g_settings_get_boolean (d->login_screen_settings, "enable-fingerprint-authentication")) &&
-		set_fingerprint_label (widget));
-	gtk_widget_set_visible (label, show);
-	gtk_widget_set_visible (widget, show);
-
-        /* Autologin: show when local account */
-	widget = get_widget (d, "autologin-box");
-	label = get_widget (d, "autologin-label");
-	show = act_user_is_local_account (user);
-	gtk_widget_set_visible (widget, show);
-	gtk_widget_set_visible (label, show);
+		shown->password_mode = password_mode;
+		shown->locked = locked;
+	}
+	else {
+		skipped++;
+	}
+
+	if (!same_user || act_user_get_automatic_login (user) != shown->automatic_login) {
+		widget = get_widget (d, "autologin-switch");
+		g_signal_handlers_block_by_func (widget, autologin_changed, d);
+		gtk_switch_set_active (GTK_SWITCH (widget), act_user_get_automatic_login (user));
+		g_signal_handlers_unblock_by_func (widget, autologin_changed, d);
+		shown->automatic_login = act_user_get_automatic_login (user);
+	}
+	else {
+		skipped++;
+	}
+
+	/* Fingerprint and autologin rows only depend on who is shown, and the
+	 * fingerprint label costs a D-Bus round trip, so skip both otherwise. */
+	if (!same_user || local != shown->local_account) {
+	        /* Fingerprint: show when self, local, enabled, and possible */
+		widget = get_widget (d, "account-fingerprint-button");
+		label = get_widget (d, "account-fingerprint-label");
+		show = (info->is_self &&
+			local &&
+			(d->login_screen_settings &&
+				g_settings_get_boolean (d->login_screen_settings, "enable-fingerprint-authentication")) &&
+			set_fingerprint_label (widget));
+		gtk_widget_set_visible (label, show);
+		gtk_widget_set_visible (widget, show);
+
+	        /* Autologin: show when local account */
+		widget = get_widget (d, "autologin-box");
+		label = get_widget (d, "autologin-label");
+		gtk_widget_set_visible (widget, local);
+		gtk_widget_set_visible (label, local);
+
+		shown->local_account = local;
+	}
+	else {
+		skipped++;
+	}
 
         /* Last login: show when administrator or current user */
-	widget = get_widget (d, "last-login-button");
-	label = get_widget (d, "last-login-button-label");
-
-	current = act_user_manager_get_user_by_id (d->um, getuid ());
-	show = act_user_get_uid (user) == getuid () ||
-	act_user_get_account_type (current) == ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR;
-	if (show) {
-		text = get_login_time_text (user);
-		gtk_label_set_label (GTK_LABEL (label), text);
-		g_free (text);
+	show = info->is_self || current_user_is_admin (d);
+	logged_in = act_user_is_logged_in (user);
+	login_time = act_user_get_login_time (user);
+	if (!same_user ||
+	    show != shown->show_last_login ||
+	    logged_in != shown->logged_in ||
+	    login_time != shown->login_time) {
+		widget = get_widget (d, "last-login-button");
+		label = get_widget (d, "last-login-button-label");
+		if (show) {
+			text = get_login_time_text (user);
+			gtk_label_set_label (GTK_LABEL (label), text);
+			g_free (text);
+		}
+		label = get_widget (d, "last-login-label");
+		gtk_widget_set_visible (widget, show);
+		gtk_widget_set_visible (label, show);
+
+		shown->show_last_login = show;
+		shown->logged_in = logged_in;
+		shown->login_time = login_time;
+	}
+	else {
+		skipped++;
+	}
+
+	show = act_user_get_login_history (user) != NULL;
+	if (!same_user || show != shown->has_history) {
+		gtk_widget_set_sensitive (get_widget (d, "last-login-button"), show);
+		shown->has_history = show;
+	}
+	else {
+		skipped++;
 	}
-	label = get_widget (d, "last-login-label");
-	gtk_widget_set_visible (widget, show);
-	gtk_widget_set_visible (label, show);
 
-	enable = act_user_get_login_history (user) != NULL;
-	gtk_widget_set_sensitive (widget, enable);
+	d->skipped_updates += skipped;
+	g_debug ("show user %s: %u widget updates skipped, %u in total\n",
+	         act_user_get_user_name (user), skipped, d->skipped_updates);
 
 	if (d->permission != NULL)
 		on_permission_changed (d->permission, NULL, d);
@@ -964,13 +2000,19 @@ selected_user_changed (GtkTreeSelection *selection, CcUserPanel *d)
 	GtkTreeIter iter;
 	ActUser *user;
 
-	if (gtk_tree_selection_get_selected (selection, &model, &iter)) {
+	/* Refreshed once the batch is done */
+	if (d->batch != NULL)
+		return;
+
+	if (get_single_selected (selection, &model, &iter)) {
 		gtk_tree_model_get (model, &iter, USER_COL, &user, -1);
 		show_user (user, d);
 		gtk_widget_set_sensitive (get_widget (d, "main-user-vbox"), TRUE);
 		g_object_unref (user);
 	} else {
 		gtk_widget_set_sensitive (get_widget (d, "main-user-vbox"), FALSE);
+		if (d->permission != NULL)
+			on_permission_changed (d->permission, NULL, d);
 	}
 }
 
@@ -982,6 +2024,8 @@ change_name_done (GtkWidget   *entry,
 	ActUser *user;
 
 	user = get_selected_user (d);
+	if (user == NULL)
+		return;
 
 	text = gtk_entry_get_text (GTK_ENTRY (entry));
 	if (g_strcmp0 (text, act_user_get_real_name (user)) != 0 &&
@@ -1008,6 +2052,8 @@ account_type_changed (GtkToggleButton *button,
 	gint account_type;
 
 	user = get_selected_user (d);
+	if (user == NULL)
+		return;
 
 	account_type = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (button)) ?  ACT_USER_ACCOUNT_TYPE_STANDARD : ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR;
 
@@ -1148,6 +2194,11 @@ users_loaded (ActUserManager  *manager,
 	}
 	g_slist_free (list);
 
+	/* The current user may be a system account not shown in the list,
+	 * and get_user_by_id() returns NULL when the manager cannot load it */
+	if (d->current_user == NULL)
+		g_set_object (&d->current_user, act_user_manager_get_user_by_id (d->um, getuid ()));
+
 	g_signal_connect (d->um, "user-added", G_CALLBACK (user_added), d);
 	g_signal_connect (d->um, "user-removed", G_CALLBACK (user_removed), d);
 }
@@ -1188,20 +2239,34 @@ on_permission_changed (GPermission *permission,
                        GParamSpec  *pspec,
                        gpointer     data)
 {
+	const SelectedUserInfo *info;
 	gboolean is_authorized;
 	gboolean self_selected;
+	gboolean only_admin;
 	ActUser *user;
 	GtkWidget *widget;
 
 	CcUserPanel *d = CC_USER_PANEL (data);
 
+	/* Only a real notification can change the permission state */
+	if (pspec != NULL)
+		d->is_authorized = g_permission_get_allowed (G_PERMISSION (d->permission));
+
 	user = get_selected_user (d);
 	if (!user) {
+		/* Only the batch operations apply to several users */
+		widget = get_widget (d, "remove-user-toolbutton");
+		gtk_widget_set_sensitive (widget, d->is_authorized &&
+			gtk_tree_selection_count_selected_rows (gtk_tree_view_get_selection (GTK_TREE_VIEW (get_widget (d, "list-treeview")))) > 1);
+		gtk_widget_set_sensitive (get_widget (d, "add-user-toolbutton"), d->is_authorized);
+		gtk_info_bar_set_revealed (GTK_INFO_BAR (get_widget (d, "infobar")), !d->is_authorized);
 		return;
 	}
 
-	is_authorized = g_permission_get_allowed (G_PERMISSION (d->permission));
-	self_selected = act_user_get_uid (user) == geteuid ();
+	info = get_selected_info (d, user);
+	is_authorized = d->is_authorized;
+	self_selected = info->is_self;
+	only_admin = would_demote_only_admin (user);
 
 	gtk_info_bar_set_revealed (GTK_INFO_BAR (get_widget (d, "infobar")), !is_authorized);
 
@@ -1227,7 +2292,7 @@ on_permission_changed (GPermission *permission,
 
 	widget = get_widget (d, "remove-user-toolbutton");
 	gtk_widget_set_sensitive (widget, is_authorized && !self_selected
-		&& !would_demote_only_admin (user));
+		&& !only_admin);
 	if (is_authorized) {
 		setup_tooltip_with_embedded_icon (widget, _("Delete the selected user account"), NULL, NULL);
 	}
@@ -1247,14 +2312,14 @@ on_permission_changed (GPermission *permission,
 		g_object_unref (icon);
 	}
 
-	if (!act_user_is_local_account (user)) {
+	if (!info->is_local) {
 		gtk_widget_set_sensitive (get_widget (d, "account-type-box"), FALSE);
 		remove_unlock_tooltip (get_widget (d, "account-type-box"));
 		gtk_widget_set_sensitive (GTK_WIDGET (get_widget (d, "autologin-switch")), FALSE);
 		remove_unlock_tooltip (get_widget (d, "autologin-switch"));
 
 	} else if (is_authorized) {
-		if (would_demote_only_admin (user)) {
+		if (only_admin) {
 			gtk_widget_set_sensitive (get_widget (d, "account-type-box"), FALSE);
 		} else {
 			gtk_widget_set_sensitive (get_widget (d, "account-type-box"), TRUE);
@@ -1266,7 +2331,7 @@ on_permission_changed (GPermission *permission,
 	}
 	else {
 		gtk_widget_set_sensitive (get_widget (d, "account-type-box"), FALSE);
-		if (would_demote_only_admin (user)) {
+		if (only_admin) {
 			remove_unlock_tooltip (get_widget (d, "account-type-box"));
 		} else {
 			add_unlock_tooltip (get_widget (d, "account-type-box"));
@@ -1277,7 +2342,7 @@ on_permission_changed (GPermission *permission,
 
         /* The full name entry: insensitive if remote or not authorized and not self */
 	widget = get_widget (d, "full-name-entry");
-	if (!act_user_is_local_account (user)) {
+	if (!info->is_local) {
 		gtk_widget_set_sensitive (widget, FALSE);
 		remove_unlock_tooltip (widget);
 
@@ -1387,6 +2452,7 @@ setup_main_window (CcUserPanel *d)
 {
 	GtkWidget *userlist;
 	GtkTreeModel *model;
+	GtkTreeModel *filter;
 	GtkListStore *store;
 	GtkTreeViewColumn *column;
 	GtkCellRenderer *cell;
@@ -1411,7 +2477,15 @@ setup_main_window (CcUserPanel *d)
 	model = (GtkTreeModel *)store;
 	gtk_tree_sortable_set_default_sort_func (GTK_TREE_SORTABLE (model), sort_users, NULL, NULL);
 	gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (model), GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
-	gtk_tree_view_set_model (GTK_TREE_VIEW (userlist), model);
+
+	d->user_index = um_user_index_new ();
+	d->changed_users = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
+	filter = gtk_tree_model_filter_new (model, NULL);
+	gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (filter), user_row_visible, d, NULL);
+	d->user_store = store;
+	d->user_filter = filter;
+
+	gtk_tree_view_set_model (GTK_TREE_VIEW (userlist), filter);
 	gtk_tree_view_set_search_column (GTK_TREE_VIEW (userlist), USER_COL);
 	gtk_tree_view_set_search_equal_func (GTK_TREE_VIEW (userlist), match_user, NULL, NULL);
 	g_object_unref (model);
@@ -1455,13 +2529,21 @@ setup_main_window (CcUserPanel *d)
 	gtk_tree_view_append_column (GTK_TREE_VIEW (userlist), column);
 
 	selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (userlist));
-	gtk_tree_selection_set_mode (selection, GTK_SELECTION_BROWSE);
+	gtk_tree_selection_set_mode (selection, GTK_SELECTION_MULTIPLE);
 	g_signal_connect (selection, "changed", G_CALLBACK (selected_user_changed), d);
 	gtk_tree_selection_set_select_function (selection, dont_select_headings, NULL, NULL);
 
+	g_signal_connect (userlist, "button-press-event", G_CALLBACK (user_list_button_press), d);
+	g_signal_connect (userlist, "popup-menu", G_CALLBACK (user_list_popup_menu), d);
+	setup_user_menu (d, userlist);
+
 	gtk_scrolled_window_set_min_content_width (GTK_SCROLLED_WINDOW (get_widget (d, "list-scrolledwindow")), 300);
 	gtk_widget_set_size_request (get_widget (d, "list-scrolledwindow"), 200, -1);
 
+	button = get_widget (d, "user-search-entry");
+	g_signal_connect (button, "search-changed", G_CALLBACK (user_search_changed), d);
+	g_signal_connect (button, "stop-search", G_CALLBACK (user_search_stopped), d);
+
 	button = get_widget (d, "add-user-toolbutton");
 	g_signal_connect (button, "clicked", G_CALLBACK (add_user), d);
 
@@ -1494,6 +2576,7 @@ setup_main_window (CcUserPanel *d)
 
 	d->permission = (GPermission *)polkit_permission_new_sync (USER_ACCOUNTS_PERMISSION, NULL, NULL, &error);
 	if (d->permission != NULL) {
+		d->is_authorized = g_permission_get_allowed (d->permission);
 		g_signal_connect (d->permission, "notify",
 			G_CALLBACK (on_permission_changed), d);
 		on_permission_changed (d->permission, NULL, d);
@@ -1634,6 +2717,10 @@ cc_user_panel_dispose (GObject *object)
 		gtk_dialog_response (GTK_DIALOG (self->account_dialog), GTK_RESPONSE_DELETE_EVENT);
 		self->account_dialog = NULL;
 	}
+	if (self->batch) {
+		batch_operation_cancel (self->batch);
+		self->batch = NULL;
+	}
 	if (self->permission) {
 		g_object_unref (self->permission);
 		self->permission = NULL;
@@ -1642,6 +2729,20 @@ cc_user_panel_dispose (GObject *object)
 		gtk_tree_iter_free (self->other_iter);
 		self->other_iter = NULL;
 	}
+	if (self->changed_users_id != 0) {
+		g_source_remove (self->changed_users_id);
+		self->changed_users_id = 0;
+	}
+	g_clear_pointer (&self->changed_users, g_hash_table_destroy);
+	user_snapshot_clear (&self->shown);
+	g_clear_object (&self->selected.user);
+	g_clear_object (&self->current_user);
+	g_clear_object (&self->user_filter);
+	self->user_store = NULL;
+	if (self->user_index) {
+		um_user_index_free (self->user_index);
+		self->user_index = NULL;
+	}
 	G_OBJECT_CLASS (cc_user_panel_parent_class)->dispose (object);
 }
 
@@ -1653,3 +2754,16 @@ cc_user_panel_class_init (CcUserPanelClass *klass)
 	object_class->dispose = cc_user_panel_dispose;
 }
 
+/* Opens a dialog creating the accounts listed in file */
+void
+cc_user_panel_import_users (CcUserPanel *self,
+                            GFile       *file)
+{
+	UmImportDialog *dialog;
+
+	g_return_if_fail (CC_IS_USER_PANEL (self));
+
+	dialog = um_import_dialog_new ();
+	um_import_dialog_show (dialog, GTK_WINDOW (self), self->permission, file);
+}
+
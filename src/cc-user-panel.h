@@ -28,6 +28,9 @@ G_BEGIN_DECLS
 #define CC_TYPE_USER_PANEL (cc_user_panel_get_type ())
 G_DECLARE_FINAL_TYPE (CcUserPanel, cc_user_panel, CC, USER_PANEL, GtkWindow)
 
+void cc_user_panel_import_users (CcUserPanel *self,
+                                 GFile       *file);
+
 G_END_DECLS
 
 #endif /* _CC_USER_PANEL_H */
@@ -0,0 +1,228 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "passwd-matcher.h"
+
+/* Aho-Corasick automaton over a fixed set of byte strings. Output is
+ * fed as it arrives, each byte costs one table lookup whatever the
+ * number of patterns, and the scan state carries matches across reads
+ * split in the middle of a word.
+ *
+ * Bytes not used by any pattern share class 0, which keeps the
+ * transition table small enough to be complete: no failure links are
+ * followed while scanning.
+ */
+
+#define NO_STATE G_MAXUINT
+
+struct _PasswdMatcher {
+	GPtrArray *patterns;       /* id -> pattern */
+	guint8     classes[256];   /* byte -> class */
+	guint      n_classes;
+	GArray    *delta;          /* state * n_classes + class -> state */
+	GPtrArray *outputs;        /* state -> GArray of ids, or NULL */
+	gboolean   compiled;
+};
+
+PasswdMatcher *
+passwd_matcher_new (void)
+{
+	PasswdMatcher *matcher;
+
+	matcher = g_new0 (PasswdMatcher, 1);
+	matcher->patterns = g_ptr_array_new_with_free_func (g_free);
+	matcher->delta = g_array_new (FALSE, FALSE, sizeof (guint));
+	matcher->outputs = g_ptr_array_new_with_free_func ((GDestroyNotify) g_array_unref);
+
+	return matcher;
+}
+
+void
+passwd_matcher_free (PasswdMatcher *matcher)
+{
+	g_ptr_array_unref (matcher->patterns);
+	g_array_unref (matcher->delta);
+	g_ptr_array_unref (matcher->outputs);
+	g_free (matcher);
+}
+
+/* Returns the id reported for pattern, which must not be empty.
+ * Patterns can only be added before passwd_matcher_compile(). */
+guint
+passwd_matcher_add (PasswdMatcher *matcher,
+                    const gchar   *pattern)
+{
+	g_return_val_if_fail (!matcher->compiled, 0);
+	g_return_val_if_fail (pattern != NULL && *pattern != '\0', 0);
+
+	g_ptr_array_add (matcher->patterns, g_strdup (pattern));
+
+	return matcher->patterns->len - 1;
+}
+
+guint
+passwd_matcher_get_n_patterns (PasswdMatcher *matcher)
+{
+	return matcher->patterns->len;
+}
+
+static guint
+add_state (PasswdMatcher *matcher)
+{
+	guint state, i, none = NO_STATE;
+
+	state = matcher->outputs->len;
+	for (i = 0; i < matcher->n_classes; i++)
+		g_array_append_val (matcher->delta, none);
+	g_ptr_array_add (matcher->outputs, NULL);
+
+	return state;
+}
+
+static guint *
+transition (PasswdMatcher *matcher,
+            guint          state,
+            guint          class)
+{
+	return &g_array_index (matcher->delta, guint, state * matcher->n_classes + class);
+}
+
+static void
+add_output (PasswdMatcher *matcher,
+            guint          state,
+            guint          id)
+{
+	GArray *ids;
+
+	ids = g_ptr_array_index (matcher->outputs, state);
+	if (ids == NULL) {
+		ids = g_array_new (FALSE, FALSE, sizeof (guint));
+		g_ptr_array_index (matcher->outputs, state) = ids;
+	}
+	g_array_append_val (ids, id);
+}
+
+void
+passwd_matcher_compile (PasswdMatcher *matcher)
+{
+	const guchar *p;
+	GArray *fail, *ids;
+	GQueue queue = G_QUEUE_INIT;
+	guint id, state, next, class, i;
+
+	g_return_if_fail (!matcher->compiled);
+
+	/* Byte classes */
+	memset (matcher->classes, 0, sizeof (matcher->classes));
+	matcher->n_classes = 1;
+	for (id = 0; id < matcher->patterns->len; id++) {
+		for (p = g_ptr_array_index (matcher->patterns, id); *p != '\0'; p++) {
+			if (matcher->classes[*p] == 0)
+				matcher->classes[*p] = matcher->n_classes++;
+		}
+	}
+
+	/* Trie of the patterns */
+	add_state (matcher);
+	for (id = 0; id < matcher->patterns->len; id++) {
+		state = 0;
+		for (p = g_ptr_array_index (matcher->patterns, id); *p != '\0'; p++) {
+			class = matcher->classes[*p];
+			next = *transition (matcher, state, class);
+			if (next == NO_STATE) {
+				next = add_state (matcher);
+				*transition (matcher, state, class) = next;
+			}
+			state = next;
+		}
+		add_output (matcher, state, id);
+	}
+
+	/* Breadth first, so the failure state of every state is complete
+	 * before its missing transitions are borrowed from it */
+	fail = g_array_sized_new (FALSE, TRUE, sizeof (guint), matcher->outputs->len);
+	g_array_set_size (fail, matcher->outputs->len);
+
+	for (class = 0; class < matcher->n_classes; class++) {
+		next = *transition (matcher, 0, class);
+		if (next == NO_STATE) {
+			*transition (matcher, 0, class) = 0;
+		} else {
+			g_array_index (fail, guint, next) = 0;
+			g_queue_push_tail (&queue, GUINT_TO_POINTER (next));
+		}
+	}
+
+	while (!g_queue_is_empty (&queue)) {
+		state = GPOINTER_TO_UINT (g_queue_pop_head (&queue));
+
+		for (class = 0; class < matcher->n_classes; class++) {
+			guint state_fail = g_array_index (fail, guint, state);
+
+			next = *transition (matcher, state, class);
+			if (next == NO_STATE) {
+				*transition (matcher, state, class) = *transition (matcher, state_fail, class);
+				continue;
+			}
+
+			g_array_index (fail, guint, next) = *transition (matcher, state_fail, class);
+
+			/* A state also ends every pattern its failure state ends */
+			ids = g_ptr_array_index (matcher->outputs, g_array_index (fail, guint, next));
+			for (i = 0; ids != NULL && i < ids->len; i++)
+				add_output (matcher, next, g_array_index (ids, guint, i));
+
+			g_queue_push_tail (&queue, GUINT_TO_POINTER (next));
+		}
+	}
+
+	g_array_unref (fail);
+	matcher->compiled = TRUE;
+}
+
+/* Scans length bytes of text from state, the value returned by the
+ * previous call or PASSWD_MATCHER_START. matched holds one flag per
+ * pattern id, set for every pattern found; flags are never cleared. */
+guint
+passwd_matcher_feed (PasswdMatcher *matcher,
+                     guint          state,
+                     const gchar   *text,
+                     gsize          length,
+                     gboolean      *matched)
+{
+	GArray *ids;
+	gsize i;
+	guint j;
+
+	g_return_val_if_fail (matcher->compiled, state);
+
+	for (i = 0; i < length; i++) {
+		state = *transition (matcher, state, matcher->classes[(guchar) text[i]]);
+
+		ids = g_ptr_array_index (matcher->outputs, state);
+		for (j = 0; ids != NULL && j < ids->len; j++)
+			matched[g_array_index (ids, guint, j)] = TRUE;
+	}
+
+	return state;
+}
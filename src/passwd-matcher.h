@@ -0,0 +1,46 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#ifndef __PASSWD_MATCHER_H__
+#define __PASSWD_MATCHER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* State of a scan that has not seen any text yet */
+#define PASSWD_MATCHER_START 0
+
+typedef struct _PasswdMatcher PasswdMatcher;
+
+PasswdMatcher *passwd_matcher_new            (void);
+void           passwd_matcher_free           (PasswdMatcher *matcher);
+
+guint          passwd_matcher_add            (PasswdMatcher *matcher,
+                                              const gchar   *pattern);
+void           passwd_matcher_compile        (PasswdMatcher *matcher);
+
+guint          passwd_matcher_get_n_patterns (PasswdMatcher *matcher);
+guint          passwd_matcher_feed           (PasswdMatcher *matcher,
+                                              guint          state,
+                                              const gchar   *text,
+                                              gsize          length,
+                                              gboolean      *matched);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,72 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+#include "passwd-rules.h"
+
+/* Errors are listed by priority, the first one found is reported */
+const PasswdRule passwd_builtin_rules[] = {
+	{ "assword: ",            PASSWD_MATCH_PROMPT,     0, NULL },
+	{ "new",                  PASSWD_MATCH_NEW,        0, NULL },
+	{ "New",                  PASSWD_MATCH_NEW,        0, NULL },
+	{ "failure",              PASSWD_MATCH_AUTH_ERROR, 0, NULL },
+	{ "wrong",                PASSWD_MATCH_AUTH_ERROR, 0, NULL },
+	{ "error",                PASSWD_MATCH_AUTH_ERROR, 0, NULL },
+	{ "successfully",         PASSWD_MATCH_SUCCESS,    0, NULL },
+	/* What does this indicate?
+	 * "Authentication information cannot be recovered?" from libpam? */
+	{ "recovered",            PASSWD_MATCH_ERROR, PASSWD_ERROR_UNKNOWN, NULL },
+	{ "short",                PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The new password is too short") },
+	{ "longer",               PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The new password is too short") },
+	{ "palindrome",           PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The new password is too simple") },
+	{ "simple",               PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The new password is too simple") },
+	{ "simplistic",           PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The new password is too simple") },
+	{ "dictionary",           PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The new password is too simple") },
+	{ "similar",              PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The old and new passwords are too similar") },
+	{ "different",            PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The old and new passwords are too similar") },
+	{ "case",                 PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The old and new passwords are too similar") },
+	{ "wrapped",              PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The old and new passwords are too similar") },
+	{ "recent",               PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The new password has already been used recently.") },
+	{ "1 numeric or special", PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The new password must contain numeric or special characters") },
+	{ "unchanged",            PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The old and new passwords are the same") },
+	{ "match",                PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The old and new passwords are the same") },
+	/* Authentication failure */
+	{ "failure",              PASSWD_MATCH_ERROR, PASSWD_ERROR_AUTH_FAILED,
+	  N_("Your password has been changed since you initially authenticated!") },
+	{ "DIFFERENT",            PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED,
+	  N_("The new password does not contain enough different characters") },
+	/* Any other pwquality refusal, reported with the text of passwd */
+	{ "BAD PASSWORD",         PASSWD_MATCH_ERROR, PASSWD_ERROR_UNKNOWN, NULL },
+};
+
+const guint passwd_n_builtin_rules = G_N_ELEMENTS (passwd_builtin_rules);
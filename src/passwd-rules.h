@@ -0,0 +1,49 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#ifndef __PASSWD_RULES_H__
+#define __PASSWD_RULES_H__
+
+#include <glib.h>
+
+#include "run-passwd.h"
+
+G_BEGIN_DECLS
+
+/* What a piece of passwd output means */
+typedef enum {
+	PASSWD_MATCH_PROMPT,            /* Passwd is waiting for a password */
+	PASSWD_MATCH_NEW,               /* The prompt is for the new password */
+	PASSWD_MATCH_AUTH_ERROR,        /* The current password was refused */
+	PASSWD_MATCH_SUCCESS,           /* The password was changed */
+	PASSWD_MATCH_ERROR              /* The new password was refused */
+} PasswdMatchKind;
+
+typedef struct {
+	const gchar     *pattern;
+	PasswdMatchKind  kind;
+	PasswdError      error;
+	const gchar     *message;       /* NULL to report the output of passwd */
+} PasswdRule;
+
+/* Built-in rules, errors listed by priority. Messages are untranslated. */
+extern const PasswdRule passwd_builtin_rules[];
+extern const guint      passwd_n_builtin_rules;
+
+G_END_DECLS
+
+#endif
@@ -22,51 +22,201 @@
 
 #include "pw-utils.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <gio/gio.h>
 
 #include <pwquality.h>
+#ifdef HAVE_CRACKLIB
+#include <crack.h>
+#endif
+
+#include "secure-memory.h"
+#include "xings-user-accounts-common.h"
+
+#define PWQUALITY_CONF "/etc/security/pwquality.conf"
+
+/* Used by cracklib when pwquality.conf does not set dictpath, if
+ * cracklib cannot tell */
+#ifndef CRACKLIB_DICTPATH
+#define CRACKLIB_DICTPATH "/usr/share/cracklib/pw_dict"
+#endif
+
+/* The pwquality settings are shared by every dialog and may be used
+ * from worker threads. A context is never modified once loaded: when
+ * the configuration changes a new one replaces it, and checks already
+ * running keep the one they started with. */
+struct _PwContext {
+	gint                  ref_count;
+	pwquality_settings_t *settings;
+	gint                  min_length;
+};
+
+static GMutex        context_lock;
+static PwContext    *default_context = NULL;
+static gboolean      default_context_stale = TRUE;
+static GFileMonitor *config_monitor = NULL;
+
+/* libpwquality, and cracklib below it, are not reentrant */
+static GMutex        check_lock;
+
+static void strength_memo_clear (void);
+static void generate_pool_clear (void);
+static void generate_pool_refill (void);
+
+/* Timing of the dictionary preload and of the first real check */
+static gint          dict_preloaded = 0;
+static gint          first_check_pending = 1;
 
-static pwquality_settings_t *
-get_pwq (void)
+static PwContext *
+pw_context_new (void)
 {
-	static pwquality_settings_t *settings;
+	PwContext *context;
+	gchar buf[PWQ_MAX_ERROR_MESSAGE_LEN];
+	void *auxerror = NULL;
+	gint rv;
 
-	if (settings == NULL) {
-		gchar *err = NULL;
-		settings = pwquality_default_settings ();
-		pwquality_set_int_value (settings, PWQ_SETTING_MAX_SEQUENCE, 4);
-		if (pwquality_read_config (settings, NULL, (gpointer)&err) < 0) {
-			g_error ("failed to read pwquality configuration: %s\n", err);
-		}
+	context = g_new0 (PwContext, 1);
+	context->ref_count = 1;
+
+	context->settings = pwquality_default_settings ();
+	if (context->settings == NULL) {
+		g_warning ("Failed to allocate the pwquality settings");
+		return context;
+	}
+
+	pwquality_set_int_value (context->settings, PWQ_SETTING_MAX_SEQUENCE, 4);
+
+	/* Keep the defaults when the configuration cannot be read */
+	rv = pwquality_read_config (context->settings, NULL, &auxerror);
+	if (rv < 0) {
+		g_warning ("Failed to read pwquality configuration: %s",
+		           pwquality_strerror (buf, sizeof (buf), rv, auxerror));
+	}
+
+	if (pwquality_get_int_value (context->settings, PWQ_SETTING_MIN_LENGTH, &context->min_length) < 0) {
+		g_warning ("Failed to read pwquality setting");
+		context->min_length = 0;
 	}
 
-	return settings;
+	return context;
 }
 
-gint
-pw_min_length (void)
+static void
+config_changed (GFileMonitor      *monitor,
+                GFile             *file,
+                GFile             *other_file,
+                GFileMonitorEvent  event_type,
+                gpointer           data)
+{
+	g_mutex_lock (&context_lock);
+	default_context_stale = TRUE;
+	g_mutex_unlock (&context_lock);
+}
+
+/* The monitor signals are delivered in the main context */
+static gboolean
+start_config_monitor (gpointer data)
+{
+	GFile *file;
+
+	file = g_file_new_for_path (PWQUALITY_CONF);
+	config_monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+	if (config_monitor != NULL)
+		g_signal_connect (config_monitor, "changed", G_CALLBACK (config_changed), NULL);
+	g_object_unref (file);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Returns a reference to the current settings, loading them again if
+ * the configuration file changed. May be called from any thread. */
+PwContext *
+pw_context_get_default (void)
 {
-	gint value = 0;
+	static gsize monitor_started = 0;
+	PwContext *context, *old = NULL;
 
-	if (pwquality_get_int_value (get_pwq (), PWQ_SETTING_MIN_LENGTH, &value) < 0) {
-		g_error ("Failed to read pwquality setting\n" );
+	if (g_once_init_enter (&monitor_started)) {
+		g_main_context_invoke (NULL, start_config_monitor, NULL);
+		g_once_init_leave (&monitor_started, 1);
 	}
 
-	return value;
+	g_mutex_lock (&context_lock);
+	if (default_context_stale) {
+		old = default_context;
+		default_context = pw_context_new ();
+		default_context_stale = FALSE;
+		strength_memo_clear ();
+		generate_pool_clear ();
+	}
+	context = pw_context_ref (default_context);
+	g_mutex_unlock (&context_lock);
+
+	if (old != NULL)
+		pw_context_unref (old);
+
+	return context;
+}
+
+PwContext *
+pw_context_ref (PwContext *context)
+{
+	g_atomic_int_inc (&context->ref_count);
+
+	return context;
 }
 
+void
+pw_context_unref (PwContext *context)
+{
+	if (!g_atomic_int_dec_and_test (&context->ref_count))
+		return;
+
+	if (context->settings != NULL)
+		pwquality_free_settings (context->settings);
+	g_free (context);
+}
+
+gint
+pw_context_get_min_length (PwContext *context)
+{
+	return context->min_length;
+}
+
+static void generate_stats_add (gint64 elapsed);
+
+/* entropy_bits of 0 uses the length configured in pwquality.conf */
 gchar *
-pw_generate (void)
+pw_context_generate (PwContext *context,
+                     gint       entropy_bits)
 {
-	gchar *res;
+	gchar *res = NULL;
+	gint64 start;
 	gint rv;
 
-	rv = pwquality_generate (get_pwq (), 0, &res);
+	if (context->settings == NULL)
+		return NULL;
+
+	start = g_get_monotonic_time ();
+
+	g_mutex_lock (&check_lock);
+	rv = pwquality_generate (context->settings, entropy_bits, &res);
+	g_mutex_unlock (&check_lock);
+
+	generate_stats_add (g_get_monotonic_time () - start);
 
 	if (rv < 0) {
-		g_error ("Password generation failed: %s\n",
-		         pwquality_strerror (NULL, 0, rv, NULL));
+		g_warning ("Password generation failed: %s",
+		           pwquality_strerror (NULL, 0, rv, NULL));
 		return NULL;
 	}
 
@@ -121,19 +271,34 @@ pw_error_hint (gint error)
 }
 
 gdouble
-pw_strength (const gchar  *password,
-             const gchar  *old_password,
-             const gchar  *username,
-             const gchar **hint,
-             gint         *strength_level)
+pw_context_strength (PwContext    *context,
+                     const gchar  *password,
+                     const gchar  *old_password,
+                     const gchar  *username,
+                     const gchar **hint,
+                     gint         *strength_level)
 {
 	gint rv, level, length = 0;
 	gdouble strength = 0.0;
 	void *auxerror;
 
-	rv = pwquality_check (get_pwq (),
-	                      password, old_password, username,
-	                      &auxerror);
+	if (context->settings != NULL) {
+		gint64 start = g_get_monotonic_time ();
+
+		g_mutex_lock (&check_lock);
+		rv = pwquality_check (context->settings,
+		                      password, old_password, username,
+		                      &auxerror);
+		g_mutex_unlock (&check_lock);
+
+		if (g_atomic_int_compare_and_exchange (&first_check_pending, 1, 0))
+			g_debug ("First password strength check took %.1f ms, dictionary %s",
+			         (g_get_monotonic_time () - start) / 1000.0,
+			         g_atomic_int_get (&dict_preloaded) ? "preloaded" : "cold");
+	}
+	else {
+		rv = PWQ_ERROR_FATAL_FAILURE;
+	}
 
 	if (password != NULL)
 		length = strlen (password);
@@ -152,7 +317,7 @@ pw_strength (const gchar  *password,
 		level = 5;
 	}
 
-	if (length && length < pw_min_length())
+	if (length && length < context->min_length)
 		*hint = pw_error_hint (PWQ_ERROR_MIN_LENGTH);
 	else
 		*hint = pw_error_hint (rv);
@@ -162,3 +327,683 @@ pw_strength (const gchar  *password,
 
 	return strength;
 }
+
+gint
+pw_min_length (void)
+{
+	PwContext *context;
+	gint value;
+
+	context = pw_context_get_default ();
+	value = pw_context_get_min_length (context);
+	pw_context_unref (context);
+
+	return value;
+}
+
+gdouble
+pw_strength (const gchar  *password,
+             const gchar  *old_password,
+             const gchar  *username,
+             const gchar **hint,
+             gint         *strength_level)
+{
+	PwContext *context;
+	gdouble strength;
+
+	context = pw_context_get_default ();
+	strength = pw_context_strength (context, password, old_password, username,
+	                                hint, strength_level);
+	pw_context_unref (context);
+
+	return strength;
+}
+
+/* Recent results are remembered, so going back to a password already
+ * typed (or deleting a character) does not ask cracklib again. Entries
+ * are keyed by a SHA-256 digest of the inputs, never by the password
+ * itself, and everything is wiped when it is dropped. */
+
+#define STRENGTH_MEMO_SIZE 32
+
+typedef struct {
+	gchar       *key;
+	gdouble      strength;
+	gint         level;
+	const gchar *hint;
+} PwStrength;
+
+typedef struct {
+	PwContext *context;
+	gchar     *password;
+	gchar     *old_password;
+	gchar     *username;
+	gchar     *key;
+} StrengthCheck;
+
+static GMutex      memo_lock;
+static GHashTable *memo = NULL;                   /* key -> PwStrength */
+static GQueue      memo_order = G_QUEUE_INIT;     /* most recent first */
+
+/* memset() on memory about to be freed may be optimised away */
+static void
+wipe_string (gchar *str)
+{
+	volatile gchar *p;
+
+	if (str == NULL)
+		return;
+
+	for (p = str; *p != '\0'; p++)
+		*p = '\0';
+}
+
+static void
+pw_strength_free (PwStrength *result)
+{
+	wipe_string (result->key);
+	g_free (result->key);
+	g_free (result);
+}
+
+static void
+strength_memo_clear (void)
+{
+	g_mutex_lock (&memo_lock);
+	if (memo != NULL)
+		g_hash_table_remove_all (memo);
+	g_queue_clear (&memo_order);
+	g_mutex_unlock (&memo_lock);
+}
+
+static gboolean
+strength_memo_lookup (const gchar *key,
+                      PwStrength  *result)
+{
+	PwStrength *entry = NULL;
+
+	if (key == NULL)
+		return FALSE;
+
+	g_mutex_lock (&memo_lock);
+	if (memo != NULL)
+		entry = g_hash_table_lookup (memo, key);
+	if (entry != NULL) {
+		g_queue_remove (&memo_order, entry);
+		g_queue_push_head (&memo_order, entry);
+		*result = *entry;
+		result->key = NULL;
+	}
+	g_mutex_unlock (&memo_lock);
+
+	return entry != NULL;
+}
+
+static void
+strength_memo_store (const gchar       *key,
+                     const PwStrength  *result)
+{
+	PwStrength *entry;
+
+	if (key == NULL)
+		return;
+
+	g_mutex_lock (&memo_lock);
+
+	if (memo == NULL)
+		memo = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+		                              (GDestroyNotify) pw_strength_free);
+
+	if (!g_hash_table_contains (memo, key)) {
+		if (g_queue_get_length (&memo_order) >= STRENGTH_MEMO_SIZE) {
+			entry = g_queue_pop_tail (&memo_order);
+			g_hash_table_remove (memo, entry->key);
+		}
+
+		entry = g_new (PwStrength, 1);
+		*entry = *result;
+		entry->key = g_strdup (key);
+		g_hash_table_insert (memo, entry->key, entry);
+		g_queue_push_head (&memo_order, entry);
+	}
+
+	g_mutex_unlock (&memo_lock);
+}
+
+#define MEMO_SECRET_SIZE 32
+
+static const guchar memo_no_secret[1];
+
+/* A plain hash of the password could be brute-forced from a memory
+ * dump, so keys are keyed with a random secret of the process. The
+ * secret comes from the kernel generator and lives in locked memory,
+ * kept out of core dumps. Without it, nothing is memoized. */
+static const guchar *
+get_memo_secret (void)
+{
+	static guchar *secret = NULL;
+
+	if (g_once_init_enter (&secret)) {
+		guchar *value;
+
+		value = secure_alloc (MEMO_SECRET_SIZE);
+		if (!secure_random (value, MEMO_SECRET_SIZE)) {
+			secure_free (value);
+			value = (guchar *) memo_no_secret;
+		}
+
+		g_once_init_leave (&secret, value);
+	}
+
+	return secret != memo_no_secret ? secret : NULL;
+}
+
+static void
+hmac_add (GHmac       *hmac,
+          const gchar *str)
+{
+	/* Tell NULL apart from "" and keep the fields separated */
+	g_hmac_update (hmac, (const guchar *) (str != NULL ? "+" : "-"), 1);
+	if (str != NULL)
+		g_hmac_update (hmac, (const guchar *) str, strlen (str) + 1);
+}
+
+static gchar *
+get_strength_key (const gchar *password,
+                  const gchar *old_password,
+                  const gchar *username)
+{
+	const guchar *secret;
+	GHmac *hmac;
+	gchar *key;
+
+	secret = get_memo_secret ();
+	if (secret == NULL)
+		return NULL;
+
+	hmac = g_hmac_new (G_CHECKSUM_SHA256, secret, MEMO_SECRET_SIZE);
+	hmac_add (hmac, password);
+	hmac_add (hmac, old_password);
+	hmac_add (hmac, username);
+	key = g_strdup (g_hmac_get_string (hmac));
+	g_hmac_unref (hmac);
+
+	return key;
+}
+
+static void
+strength_check_free (StrengthCheck *check)
+{
+	pw_context_unref (check->context);
+	secure_free (check->password);
+	secure_free (check->old_password);
+	wipe_string (check->key);
+	g_free (check->username);
+	g_free (check->key);
+	g_free (check);
+}
+
+static void
+strength_thread (GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+	StrengthCheck *check = task_data;
+	PwStrength *result;
+
+	result = g_new0 (PwStrength, 1);
+	result->strength = pw_context_strength (check->context,
+	                                        check->password,
+	                                        check->old_password,
+	                                        check->username,
+	                                        &result->hint,
+	                                        &result->level);
+
+	strength_memo_store (check->key, result);
+
+	g_task_return_pointer (task, result, (GDestroyNotify) pw_strength_free);
+}
+
+/* Same as pw_strength(), but cracklib is asked in a worker thread.
+ * Callers typing a password cancel the previous check when starting
+ * a new one, so only the latest result is reported. */
+void
+pw_strength_async (const gchar         *password,
+                   const gchar         *old_password,
+                   const gchar         *username,
+                   GCancellable        *cancellable,
+                   GAsyncReadyCallback  callback,
+                   gpointer             user_data)
+{
+	StrengthCheck *check;
+	PwStrength *result;
+	GTask *task;
+	gchar *key;
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, pw_strength_async);
+
+	key = get_strength_key (password, old_password, username);
+
+	result = g_new0 (PwStrength, 1);
+	if (strength_memo_lookup (key, result)) {
+		wipe_string (key);
+		g_free (key);
+		g_task_return_pointer (task, result, (GDestroyNotify) pw_strength_free);
+		g_object_unref (task);
+		return;
+	}
+	g_free (result);
+
+	check = g_new0 (StrengthCheck, 1);
+	check->context = pw_context_get_default ();
+	/* Same protection as the entries the passwords come from */
+	check->password = secure_strdup (password);
+	check->old_password = secure_strdup (old_password);
+	check->username = g_strdup (username);
+	check->key = key;
+	g_task_set_task_data (task, check, (GDestroyNotify) strength_check_free);
+
+	g_task_set_return_on_cancel (task, TRUE);
+	g_task_run_in_thread (task, strength_thread);
+	g_object_unref (task);
+}
+
+gboolean
+pw_strength_finish (GAsyncResult  *result,
+                    gdouble       *strength,
+                    const gchar  **hint,
+                    gint          *strength_level,
+                    GError       **error)
+{
+	PwStrength *ret;
+
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+	ret = g_task_propagate_pointer (G_TASK (result), error);
+	if (ret == NULL)
+		return FALSE;
+
+	if (strength != NULL)
+		*strength = ret->strength;
+	if (hint != NULL)
+		*hint = ret->hint;
+	if (strength_level != NULL)
+		*strength_level = ret->level;
+
+	pw_strength_free (ret);
+
+	return TRUE;
+}
+
+/* cracklib opens its dictionary again for every check, so the first
+ * one after the dialog opens usually waits for the disk. The dictionary
+ * files are mapped once in the background and read through, and the
+ * mappings are kept for the life of the process so the pages stay
+ * referenced. They are not mlock()ed: the dictionary is several
+ * megabytes, far over the usual RLIMIT_MEMLOCK. */
+
+static const gchar *dict_suffixes[] = { ".pwd", ".pwi", ".hwm" };
+
+static gsize
+map_dictionary_file (const gchar *path)
+{
+	struct stat st;
+	volatile const guchar *data;
+	guchar sum = 0;
+	glong page_size;
+	gsize offset;
+	int fd;
+
+	fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	if (fstat (fd, &st) < 0 || st.st_size == 0) {
+		close (fd);
+		return 0;
+	}
+
+	data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (data == MAP_FAILED) {
+		g_debug ("Failed to map %s: %s", path, g_strerror (errno));
+		return 0;
+	}
+
+	madvise ((void *) data, st.st_size, MADV_WILLNEED);
+
+	/* MADV_WILLNEED only starts the readahead, wait for it here
+	 * rather than in the first check */
+	page_size = sysconf (_SC_PAGESIZE);
+	for (offset = 0; offset < (gsize) st.st_size; offset += page_size)
+		sum += data[offset];
+	(void) sum;
+
+	return st.st_size;
+}
+
+static void
+preload_thread (GTask        *task,
+                gpointer      source_object,
+                gpointer      task_data,
+                GCancellable *cancellable)
+{
+	PwContext *context = task_data;
+	const gchar *dict_path = NULL;
+	gchar *path;
+	gsize total = 0;
+	gint64 start;
+	void *auxerror;
+	guint i;
+
+	if (context->settings == NULL) {
+		g_task_return_boolean (task, FALSE);
+		return;
+	}
+
+	start = g_get_monotonic_time ();
+
+	if (pwquality_get_str_value (context->settings, PWQ_SETTING_DICT_PATH, &dict_path) < 0 ||
+	    dict_path == NULL || *dict_path == '\0') {
+#ifdef HAVE_CRACKLIB
+		/* Distributions put it in different places */
+		dict_path = GetDefaultCracklibDict ();
+#else
+		dict_path = CRACKLIB_DICTPATH;
+#endif
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (dict_suffixes); i++) {
+		path = g_strconcat (dict_path, dict_suffixes[i], NULL);
+		total += map_dictionary_file (path);
+		g_free (path);
+	}
+
+	/* One throwaway check also loads whatever cracklib and
+	 * libpwquality need besides the dictionary */
+	g_mutex_lock (&check_lock);
+	pwquality_check (context->settings, "preload-Check-1", NULL, NULL, &auxerror);
+	g_mutex_unlock (&check_lock);
+
+	g_atomic_int_set (&dict_preloaded, 1);
+
+	if (total == 0)
+		g_message ("No cracklib dictionary found at %s, it was not preloaded", dict_path);
+	else
+		g_debug ("Preloaded %" G_GSIZE_FORMAT " bytes of %s in %.1f ms",
+		         total, dict_path, (g_get_monotonic_time () - start) / 1000.0);
+
+	g_task_return_boolean (task, total > 0);
+}
+
+static gboolean
+preload_enabled (void)
+{
+	GSettings *settings;
+	gboolean enabled;
+
+	settings = g_settings_new (XUA_SETTINGS_SCHEMA);
+	enabled = g_settings_get_boolean (settings, XUA_SETTINGS_KEY_PRELOAD_PASSWORD_CHECKS);
+	g_object_unref (settings);
+
+	return enabled;
+}
+
+/* Warms the cracklib dictionary in a worker thread and starts filling
+ * the pool of generated passwords, unless the preload-password-checks
+ * setting is off. Dialogs call this when they open; only the first
+ * call does anything. */
+void
+pw_preload_dictionary (void)
+{
+	static gsize started = 0;
+	GTask *task;
+
+	if (!g_once_init_enter (&started))
+		return;
+
+	if (!preload_enabled ()) {
+		g_debug ("Password checks are not preloaded, as configured");
+		g_once_init_leave (&started, 1);
+		return;
+	}
+
+	task = g_task_new (NULL, NULL, NULL, NULL);
+	g_task_set_source_tag (task, pw_preload_dictionary);
+	g_task_set_task_data (task, pw_context_get_default (), (GDestroyNotify) pw_context_unref);
+	g_task_run_in_thread (task, preload_thread);
+	g_object_unref (task);
+
+	/* The generate icon is next to the entry the dictionary is for */
+	generate_pool_refill ();
+
+	g_once_init_leave (&started, 1);
+}
+
+/* pwquality_generate() reads /dev/urandom and can block for a while when
+ * the entropy pool is starved, early at boot or in virtual machines. A
+ * few passwords made with the default settings are kept ready, and
+ * refilled in a worker thread after being handed out. Waiting passwords
+ * are kept in secure memory. */
+
+#define GENERATE_POOL_SIZE 8
+
+static GMutex           pool_lock;
+static GQueue           pool = G_QUEUE_INIT;
+static guint            pool_generation = 0;
+static gboolean         pool_refilling = FALSE;
+static PwGenerateStats  generate_stats;
+
+static void
+free_password (gchar *password)
+{
+	wipe_string (password);
+	free (password);
+}
+
+/* Moves a password made by libpwquality to secure memory */
+static gchar *
+secure_password (gchar *password)
+{
+	gchar *res;
+
+	if (password == NULL)
+		return NULL;
+
+	res = secure_strdup (password);
+	free_password (password);
+
+	return res;
+}
+
+static void
+generate_stats_add (gint64 elapsed)
+{
+	gdouble ms = elapsed / 1000.0;
+
+	g_mutex_lock (&pool_lock);
+	generate_stats.generated++;
+	generate_stats.last_ms = ms;
+	generate_stats.total_ms += ms;
+	generate_stats.max_ms = MAX (generate_stats.max_ms, ms);
+	g_mutex_unlock (&pool_lock);
+}
+
+void
+pw_get_generate_stats (PwGenerateStats *stats)
+{
+	g_mutex_lock (&pool_lock);
+	*stats = generate_stats;
+	g_mutex_unlock (&pool_lock);
+}
+
+static void
+generate_pool_clear (void)
+{
+	gchar *pwd;
+
+	g_mutex_lock (&pool_lock);
+	while ((pwd = g_queue_pop_head (&pool)) != NULL)
+		secure_free (pwd);
+	pool_generation++;
+	g_mutex_unlock (&pool_lock);
+}
+
+static gchar *
+generate_pool_take (void)
+{
+	gchar *res;
+
+	g_mutex_lock (&pool_lock);
+	res = g_queue_pop_head (&pool);
+	if (res != NULL)
+		generate_stats.pool_hits++;
+	g_mutex_unlock (&pool_lock);
+
+	return res;
+}
+
+static void
+pool_refill_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+	PwContext *context;
+	guint generation;
+	gchar *pwd;
+
+	context = pw_context_get_default ();
+
+	g_mutex_lock (&pool_lock);
+	generation = pool_generation;
+	g_mutex_unlock (&pool_lock);
+
+	for (;;) {
+		g_mutex_lock (&pool_lock);
+		if (pool_generation != generation ||
+		    g_queue_get_length (&pool) >= GENERATE_POOL_SIZE) {
+			g_mutex_unlock (&pool_lock);
+			break;
+		}
+		g_mutex_unlock (&pool_lock);
+
+		pwd = secure_password (pw_context_generate (context, 0));
+		if (pwd == NULL)
+			break;
+
+		/* Drop passwords made with settings no longer in use */
+		g_mutex_lock (&pool_lock);
+		if (pool_generation == generation) {
+			g_queue_push_tail (&pool, pwd);
+			pwd = NULL;
+		}
+		g_mutex_unlock (&pool_lock);
+
+		secure_free (pwd);
+	}
+
+	g_mutex_lock (&pool_lock);
+	pool_refilling = FALSE;
+	g_mutex_unlock (&pool_lock);
+
+	pw_context_unref (context);
+
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+generate_pool_refill (void)
+{
+	gboolean start = FALSE;
+	GTask *task;
+
+	g_mutex_lock (&pool_lock);
+	if (!pool_refilling && g_queue_get_length (&pool) < GENERATE_POOL_SIZE) {
+		pool_refilling = TRUE;
+		start = TRUE;
+	}
+	g_mutex_unlock (&pool_lock);
+
+	if (!start)
+		return;
+
+	task = g_task_new (NULL, NULL, NULL, NULL);
+	g_task_set_source_tag (task, generate_pool_refill);
+	g_task_run_in_thread (task, pool_refill_thread);
+	g_object_unref (task);
+}
+
+/* Free the result with secure_free() */
+gchar *
+pw_generate (void)
+{
+	PwContext *context;
+	gchar *res;
+
+	/* Make sure a changed configuration has dropped the pool */
+	context = pw_context_get_default ();
+
+	res = generate_pool_take ();
+	if (res == NULL)
+		res = secure_password (pw_context_generate (context, 0));
+	pw_context_unref (context);
+
+	generate_pool_refill ();
+
+	return res;
+}
+
+/* Returns a NULL-terminated array of n_passwords passwords, or NULL if
+ * none could be made. entropy_bits of 0 uses the configured length and
+ * takes passwords from the pool first; any other value always asks
+ * libpwquality. The pool is not refilled, this is meant for one-shot
+ * callers such as the command line. Free the result with
+ * pw_free_passwords(). */
+gchar **
+pw_generate_many (guint n_passwords,
+                  gint  entropy_bits)
+{
+	PwContext *context;
+	GPtrArray *passwords;
+	gchar *pwd;
+	guint i;
+
+	context = pw_context_get_default ();
+	passwords = g_ptr_array_sized_new (n_passwords + 1);
+
+	for (i = 0; i < n_passwords; i++) {
+		pwd = (entropy_bits == 0) ? generate_pool_take () : NULL;
+		if (pwd == NULL)
+			pwd = secure_password (pw_context_generate (context, entropy_bits));
+		if (pwd == NULL)
+			break;
+		g_ptr_array_add (passwords, pwd);
+	}
+
+	pw_context_unref (context);
+
+	if (passwords->len == 0) {
+		g_ptr_array_free (passwords, TRUE);
+		return NULL;
+	}
+
+	g_ptr_array_add (passwords, NULL);
+
+	return (gchar **) g_ptr_array_free (passwords, FALSE);
+}
+
+void
+pw_free_passwords (gchar **passwords)
+{
+	gchar **p;
+
+	if (passwords == NULL)
+		return;
+
+	for (p = passwords; *p != NULL; p++)
+		secure_free (*p);
+	g_free (passwords);
+}
@@ -21,11 +21,52 @@
 #pragma once
 
 #include <glib.h>
+#include <gio/gio.h>
+
+typedef struct _PwContext PwContext;
+
+typedef struct {
+	guint   generated;  /* passwords made by libpwquality */
+	guint   pool_hits;  /* requests served from the pool */
+	gdouble last_ms;
+	gdouble max_ms;
+	gdouble total_ms;
+} PwGenerateStats;
+
+PwContext *pw_context_get_default    (void);
+PwContext *pw_context_ref            (PwContext    *context);
+void       pw_context_unref          (PwContext    *context);
+gint       pw_context_get_min_length (PwContext    *context);
+gchar     *pw_context_generate       (PwContext    *context,
+                                      gint          entropy_bits);
+gdouble    pw_context_strength       (PwContext    *context,
+                                      const gchar  *password,
+                                      const gchar  *old_password,
+                                      const gchar  *username,
+                                      const gchar **hint,
+                                      gint         *strength_level);
+
+void       pw_preload_dictionary     (void);
 
 gint     pw_min_length (void);
 gchar   *pw_generate   (void);
+gchar  **pw_generate_many      (guint            n_passwords,
+                                gint             entropy_bits);
+void     pw_free_passwords     (gchar          **passwords);
+void     pw_get_generate_stats (PwGenerateStats *stats);
 gdouble  pw_strength   (const gchar  *password,
                         const gchar  *old_password,
                         const gchar  *username,
                         const gchar **hint,
                         gint         *strength_level);
+void     pw_strength_async  (const gchar          *password,
+                             const gchar          *old_password,
+                             const gchar          *username,
+                             GCancellable         *cancellable,
+                             GAsyncReadyCallback   callback,
+                             gpointer              user_data);
+gboolean pw_strength_finish (GAsyncResult         *result,
+                             gdouble              *strength,
+                             const gchar         **hint,
+                             gint                 *strength_level,
+                             GError              **error);
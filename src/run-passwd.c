@@ -29,18 +29,29 @@
 
 #include <config.h>
 #include <glib/gi18n.h>
+#include <gio/gio.h>
 
 #include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
+#ifdef HAVE_PAM_BACKEND
+#include <security/pam_appl.h>
+#endif
+
 #if __sun
 #include <sys/types.h>
 #include <signal.h>
 #endif
 
 #include "run-passwd.h"
+#include "passwd-matcher.h"
+#include "passwd-rules.h"
+#include "secure-memory.h"
+#include "xings-user-accounts-common.h"
 
 /* Passwd states */
 typedef enum {
@@ -52,9 +63,15 @@ typedef enum {
 	PASSWD_STATE_ERR                /* Passwd reported an error but has not yet exited */
 } PasswdState;
 
+/* First prompt of a backend, when it arrived before any password was queued */
+typedef enum {
+	PASSWD_PROMPT_NONE,
+	PASSWD_PROMPT_CURRENT,          /* Passwd asked for the current password */
+	PASSWD_PROMPT_NEW               /* The user has no password, passwd asked for a new one */
+} PasswdPrompt;
+
 struct PasswdHandler {
-	const char    *current_password;
-	const char    *new_password;
+	gchar         *current_password;                 /* In secure memory */
 
 	/* Communication with the passwd program */
 	GPid           backend_pid;
@@ -70,18 +87,53 @@ struct PasswdHandler {
 
 	/* State of the passwd program */
 	PasswdState    backend_state;
+	PasswdPrompt   backend_prompt;
 	gboolean       changing_password;
 
+	/* After a wrong current password passwd exits, and a new one is
+	 * spawned right away so the next attempt finds it prompting */
+	gboolean       respawn_on_exit;
+	gboolean       backend_idle;                     /* Spawned ahead, nothing sent yet */
+
+	/* Watchdog, armed while waiting for an answer of the backend */
+	guint          timeouts[PASSWD_N_STAGES];        /* In seconds, 0 for none */
+	guint          watchdog_id;
+	PasswdStage    watchdog_stage;
+
+	/* How long the backend took to answer in each stage, for diagnostics */
+	gint64         answer_started;                   /* 0 when not waiting */
+	gint64         durations[PASSWD_N_STAGES];
+
+	/* Output of passwd since the last prompt was answered */
+	GString       *output;
+	guint          output_state;                     /* Of the output matcher */
+	gboolean      *output_matched;                   /* One per output rule */
+
 	PasswdCallback auth_cb;
 	gpointer       auth_cb_data;
 
 	PasswdCallback chpasswd_cb;
 	gpointer       chpasswd_cb_data;
+
+#ifdef HAVE_PAM_BACKEND
+	/* In-process PAM conversation, used instead of passwd when set */
+	gboolean       use_pam;
+	GCancellable  *pam_cancellable;
+#endif
 };
 
 /* Buffer size for backend output */
 #define BUFSIZE 64
 
+/* Seconds given to the backend to answer, in every stage */
+#define DEFAULT_TIMEOUT 30
+
+/* Seconds given to passwd to exit after SIGTERM, before SIGKILL */
+#define KILL_DELAY 2
+
+/* Extra messages of the PAM stack, in DATADIR */
+#define PASSWD_MESSAGES_FILE "passwd-messages.conf"
+
 
 static GQuark
 passwd_error_quark (void)
@@ -108,6 +160,337 @@ free_passwd_resources (PasswdHandler *passwd_handler);
 static gboolean
 io_watch_stdout (GIOChannel *source, GIOCondition condition, PasswdHandler *passwd_handler);
 
+static gboolean
+spawn_passwd (PasswdHandler *passwd_handler, GError **error);
+
+#ifdef HAVE_PAM_BACKEND
+static void
+pam_cancel_request (PasswdHandler *passwd_handler);
+#endif
+
+
+/*
+ * Output matching {{
+ */
+
+static PasswdMatcher *output_matcher = NULL;
+static GArray        *output_rules = NULL;   /* PasswdRule, by pattern id */
+
+/* Messages of other PAM modules can be added in PASSWD_MESSAGES_FILE,
+ * one group per piece of text passwd may print after being given the
+ * new password:
+ *
+ *   [is too weak]
+ *   Error=rejected
+ *   Message=The new password is too weak
+ *
+ * Error is one of rejected (the default), auth-failed or unknown.
+ * Message may be translated as Message[ll]; without it the output of
+ * passwd is shown. These rules are checked before the built-in ones.
+ */
+static void
+load_custom_rules (GArray *rules)
+{
+	GKeyFile *keyfile;
+	GError *error = NULL;
+	gchar **groups;
+	gchar *path;
+	gchar *value;
+	gsize n_groups, i;
+
+	path = g_build_filename (DATADIR, PASSWD_MESSAGES_FILE, NULL);
+	keyfile = g_key_file_new ();
+
+	if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, &error)) {
+		if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_warning ("Could not load %s: %s", path, error->message);
+		g_error_free (error);
+		g_key_file_free (keyfile);
+		g_free (path);
+		return;
+	}
+
+	groups = g_key_file_get_groups (keyfile, &n_groups);
+	for (i = 0; i < n_groups; i++) {
+		PasswdRule rule = { NULL, PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED, NULL };
+
+		if (*groups[i] == '\0')
+			continue;
+
+		value = g_key_file_get_string (keyfile, groups[i], "Error", NULL);
+		if (value == NULL || g_strcmp0 (value, "rejected") == 0) {
+			rule.error = PASSWD_ERROR_REJECTED;
+		} else if (g_strcmp0 (value, "auth-failed") == 0) {
+			rule.error = PASSWD_ERROR_AUTH_FAILED;
+		} else if (g_strcmp0 (value, "unknown") == 0) {
+			rule.error = PASSWD_ERROR_UNKNOWN;
+		} else {
+			g_warning ("%s: unknown error “%s” for “%s”", path, value, groups[i]);
+			g_free (value);
+			continue;
+		}
+		g_free (value);
+
+		/* Rules live as long as the process */
+		rule.pattern = g_intern_string (groups[i]);
+
+		value = g_key_file_get_locale_string (keyfile, groups[i], "Message", NULL, NULL);
+		rule.message = g_intern_string (value);
+		g_free (value);
+
+		g_array_append_val (rules, rule);
+	}
+
+	g_strfreev (groups);
+	g_key_file_free (keyfile);
+	g_free (path);
+}
+
+static PasswdMatcher *
+get_output_matcher (void)
+{
+	static gsize initialized = 0;
+	PasswdRule rule;
+	guint i;
+
+	if (g_once_init_enter (&initialized)) {
+		output_rules = g_array_new (FALSE, FALSE, sizeof (PasswdRule));
+		load_custom_rules (output_rules);
+
+		for (i = 0; i < passwd_n_builtin_rules; i++) {
+			rule = passwd_builtin_rules[i];
+			if (rule.message != NULL)
+				rule.message = _(rule.message);
+			g_array_append_val (output_rules, rule);
+		}
+
+		output_matcher = passwd_matcher_new ();
+		for (i = 0; i < output_rules->len; i++)
+			passwd_matcher_add (output_matcher,
+			                    g_array_index (output_rules, PasswdRule, i).pattern);
+		passwd_matcher_compile (output_matcher);
+
+		g_once_init_leave (&initialized, 1);
+	}
+
+	return output_matcher;
+}
+
+static gboolean
+output_has (PasswdHandler   *passwd_handler,
+            PasswdMatchKind  kind)
+{
+	guint i;
+
+	for (i = 0; i < output_rules->len; i++) {
+		if (passwd_handler->output_matched[i] &&
+		    g_array_index (output_rules, PasswdRule, i).kind == kind)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Returns the refusal of the new password with the highest priority */
+static const PasswdRule *
+output_find_error (PasswdHandler *passwd_handler)
+{
+	const PasswdRule *rule;
+	guint i;
+
+	for (i = 0; i < output_rules->len; i++) {
+		rule = &g_array_index (output_rules, PasswdRule, i);
+		if (passwd_handler->output_matched[i] && rule->kind == PASSWD_MATCH_ERROR)
+			return rule;
+	}
+
+	return NULL;
+}
+
+static void
+reset_output (PasswdHandler *passwd_handler)
+{
+	g_string_truncate (passwd_handler->output, 0);
+	passwd_handler->output_state = PASSWD_MATCHER_START;
+	memset (passwd_handler->output_matched, 0,
+	        output_rules->len * sizeof (gboolean));
+}
+
+/*
+ * }} Output matching
+ */
+
+/*
+ * Watchdog and diagnostics {{
+ */
+
+static const gchar *
+get_stage_name (PasswdStage stage)
+{
+	switch (stage) {
+		case PASSWD_STAGE_AUTH:
+			return "authentication";
+		case PASSWD_STAGE_NEW:
+			return "new password";
+		case PASSWD_STAGE_RETYPE:
+			return "retyped password";
+		default:
+			return "unknown";
+	}
+}
+
+static gboolean
+get_state_stage (PasswdState state, PasswdStage *stage)
+{
+	switch (state) {
+		case PASSWD_STATE_NONE:
+		case PASSWD_STATE_AUTH:
+			*stage = PASSWD_STAGE_AUTH;
+			return TRUE;
+		case PASSWD_STATE_NEW:
+			*stage = PASSWD_STAGE_NEW;
+			return TRUE;
+		case PASSWD_STATE_RETYPE:
+			*stage = PASSWD_STAGE_RETYPE;
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/* Every state change goes through here, to time the stages. A stage
+ * is timed from the moment its password was written, so the time the
+ * user takes to type is not counted. */
+static void
+set_backend_state (PasswdHandler *passwd_handler, PasswdState state)
+{
+	PasswdStage stage;
+	gint64 elapsed;
+
+	if (passwd_handler->answer_started != 0 &&
+	    get_state_stage (passwd_handler->backend_state, &stage)) {
+		elapsed = g_get_monotonic_time () - passwd_handler->answer_started;
+		passwd_handler->durations[stage] = elapsed;
+		g_debug ("passwd answered in %.1f ms in the %s stage",
+		         elapsed / 1000.0, get_stage_name (stage));
+	}
+
+	passwd_handler->backend_state = state;
+	passwd_handler->answer_started = 0;
+}
+
+static void
+watchdog_disarm (PasswdHandler *passwd_handler)
+{
+	if (passwd_handler->watchdog_id != 0) {
+		g_source_remove (passwd_handler->watchdog_id);
+		passwd_handler->watchdog_id = 0;
+	}
+}
+
+static gboolean
+watchdog_expired (PasswdHandler *passwd_handler)
+{
+	GError *error;
+
+	passwd_handler->watchdog_id = 0;
+
+	/* Nobody waits for a passwd spawned ahead of time, the next
+	 * request will spawn another one */
+	if (passwd_handler->backend_idle) {
+		g_debug ("passwd spawned ahead of time did not prompt, stopping it");
+		stop_passwd (passwd_handler);
+		return FALSE;
+	}
+
+	g_warning ("The password backend did not answer in %u seconds, during the %s stage",
+	           passwd_handler->timeouts[passwd_handler->watchdog_stage],
+	           get_stage_name (passwd_handler->watchdog_stage));
+
+	error = g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_TIMEOUT,
+	                             _("The password service is not responding"));
+
+	/* Kill a stalled passwd, or forget a stalled PAM authentication */
+	stop_passwd (passwd_handler);
+#ifdef HAVE_PAM_BACKEND
+	pam_cancel_request (passwd_handler);
+#endif
+
+	if (passwd_handler->changing_password) {
+		passwd_handler->changing_password = FALSE;
+		if (passwd_handler->chpasswd_cb)
+			passwd_handler->chpasswd_cb (passwd_handler,
+			                             error,
+			                             passwd_handler->chpasswd_cb_data);
+	} else if (passwd_handler->auth_cb) {
+		passwd_handler->auth_cb (passwd_handler,
+		                         error,
+		                         passwd_handler->auth_cb_data);
+	}
+
+	g_error_free (error);
+
+	return FALSE;
+}
+
+/* Starts waiting for the backend to answer in the given stage */
+static void
+watchdog_arm (PasswdHandler *passwd_handler, PasswdStage stage)
+{
+	watchdog_disarm (passwd_handler);
+
+	if (passwd_handler->timeouts[stage] == 0)
+		return;
+
+	passwd_handler->watchdog_stage = stage;
+	passwd_handler->watchdog_id = g_timeout_add_seconds (passwd_handler->timeouts[stage],
+	                                                     (GSourceFunc) watchdog_expired,
+	                                                     passwd_handler);
+}
+
+/* passwd gets SIGTERM first, to let PAM modules clean up, and SIGKILL
+ * if it is still there after KILL_DELAY. Either way it is reaped. */
+typedef struct {
+	GPid  pid;
+	guint kill_id;
+} PasswdReaper;
+
+static gboolean
+reaper_kill (PasswdReaper *reaper)
+{
+	reaper->kill_id = 0;
+	kill (reaper->pid, SIGKILL);
+
+	return FALSE;
+}
+
+static void
+reaper_child_exited (GPid pid, gint status, PasswdReaper *reaper)
+{
+	if (reaper->kill_id != 0)
+		g_source_remove (reaper->kill_id);
+
+	g_spawn_close_pid (pid);
+	g_free (reaper);
+}
+
+static void
+terminate_passwd (GPid pid)
+{
+	PasswdReaper *reaper;
+
+	reaper = g_new0 (PasswdReaper, 1);
+	reaper->pid = pid;
+
+	kill (pid, SIGTERM);
+
+	g_child_watch_add (pid, (GChildWatchFunc) reaper_child_exited, reaper);
+	reaper->kill_id = g_timeout_add_seconds (KILL_DELAY, (GSourceFunc) reaper_kill, reaper);
+}
+
+/*
+ * }} Watchdog and diagnostics
+ */
 
 /*
  * Spawning and closing of backend {{
@@ -123,7 +506,7 @@ child_watch_cb (GPid pid, gint status, PasswdHandler *passwd_handler)
 		}
 		if (WEXITSTATUS (status) == 0) {
 			if (passwd_handler->backend_state == PASSWD_STATE_RETYPE) {
-				passwd_handler->backend_state = PASSWD_STATE_DONE;
+				set_backend_state (passwd_handler, PASSWD_STATE_DONE);
 				if (passwd_handler->chpasswd_cb)
 					passwd_handler->chpasswd_cb (passwd_handler,
 					                             NULL,
@@ -132,7 +515,36 @@ child_watch_cb (GPid pid, gint status, PasswdHandler *passwd_handler)
 		}
 	}
 
+	/* passwd gave up on the new password without any output we know */
+	if (passwd_handler->backend_state == PASSWD_STATE_RETYPE) {
+		GError *error;
+
+		set_backend_state (passwd_handler, PASSWD_STATE_ERR);
+		passwd_handler->changing_password = FALSE;
+
+		error = g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_UNKNOWN,
+		                             _("Unknown error"));
+		if (passwd_handler->chpasswd_cb)
+			passwd_handler->chpasswd_cb (passwd_handler,
+			                             error,
+			                             passwd_handler->chpasswd_cb_data);
+		g_error_free (error);
+	}
+
 	free_passwd_resources (passwd_handler);
+
+	if (passwd_handler->respawn_on_exit) {
+		GError *error = NULL;
+
+		passwd_handler->respawn_on_exit = FALSE;
+
+		if (spawn_passwd (passwd_handler, &error)) {
+			passwd_handler->backend_idle = TRUE;
+		} else {
+			g_debug ("Could not spawn passwd ahead of time: %s", error->message);
+			g_error_free (error);
+		}
+	}
 }
 
 static void
@@ -220,6 +632,9 @@ spawn_passwd (PasswdHandler *passwd_handler, GError **error)
 	/* Add child watcher */
 	passwd_handler->backend_child_watch_id = g_child_watch_add (passwd_handler->backend_pid, (GChildWatchFunc) child_watch_cb, passwd_handler);
 
+	/* passwd must show its first prompt in time */
+	watchdog_arm (passwd_handler, PASSWD_STAGE_AUTH);
+
 	/* Success! */
 
 	return TRUE;
@@ -234,18 +649,20 @@ stop_passwd (PasswdHandler *passwd_handler)
 	 * its task.
 	 */
 
-	if (passwd_handler->backend_pid != -1) {
-		kill (passwd_handler->backend_pid, 9);
-	}
+	GPid pid;
+
+	passwd_handler->respawn_on_exit = FALSE;
 
 	/* We must run free_passwd_resources here and not let our child
 	 * watcher do it, since it will access invalid memory after the
-	 * dialog has been closed and cleaned up.
-	 *
-	 * If we had more than a single thread we'd need to remove
-	 * the child watch before trying to kill the child.
+	 * dialog has been closed and cleaned up. It removes our child
+	 * watch, so the reaper can add its own.
 	 */
+	pid = passwd_handler->backend_pid;
 	free_passwd_resources (passwd_handler);
+
+	if (pid != -1)
+		terminate_passwd (pid);
 }
 
 /* Clean up passwd resources */
@@ -294,6 +711,9 @@ free_passwd_resources (PasswdHandler *passwd_handler)
 		passwd_handler->backend_stdout_watch_id = 0;
 	}
 
+	/* Nothing to wait for anymore */
+	watchdog_disarm (passwd_handler);
+
 	/* Close PID */
 	if (passwd_handler->backend_pid != -1) {
 
@@ -302,8 +722,13 @@ free_passwd_resources (PasswdHandler *passwd_handler)
 		passwd_handler->backend_pid = -1;
 	}
 
+	/* Forget any output of the previous backend */
+	reset_output (passwd_handler);
+
 	/* Clear backend state */
 	passwd_handler->backend_state = PASSWD_STATE_NONE;
+	passwd_handler->backend_prompt = PASSWD_PROMPT_NONE;
+	passwd_handler->backend_idle = FALSE;
 }
 
 /*
@@ -314,53 +739,71 @@ free_passwd_resources (PasswdHandler *passwd_handler)
  * Backend communication code {{
  */
 
-/* Write the first element of queue through channel */
+/* Write the first element of the queue to passwd, followed by a
+ * newline. The password goes straight from its secure buffer to the
+ * pipe, without a copy holding the newline. */
 static void
-io_queue_pop (GQueue *queue, GIOChannel *channel)
+io_queue_pop (PasswdHandler *passwd_handler)
 {
+	GQueue  *queue = passwd_handler->backend_stdin_queue;
+	GIOChannel *channel = passwd_handler->backend_stdin;
+	PasswdStage stage;
 	gchar   *buf;
-	gsize   bytes_written;
-	GError  *error = NULL;
+	struct iovec iov[2];
+	gssize  written;
 
 	buf = g_queue_pop_head (queue);
 
 	if (buf != NULL) {
+		iov[0].iov_base = buf;
+		iov[0].iov_len = strlen (buf);
+		iov[1].iov_base = (gchar *) "\n";
+		iov[1].iov_len = 1;
 
-		if (g_io_channel_write_chars (channel, buf, -1, &bytes_written, &error) != G_IO_STATUS_NORMAL) {
-			g_warning ("Could not write queue element \"%s\" to channel: %s", buf, error->message);
-			g_error_free (error);
-		}
+		do {
+			written = writev (g_io_channel_unix_get_fd (channel), iov, 2);
+		} while (written < 0 && errno == EINTR);
+
+		if (written < 0)
+			g_warning ("Could not write to passwd: %s", g_strerror (errno));
+		else if ((gsize) written < iov[0].iov_len + 1)
+			g_warning ("Could not write the whole password to passwd");
 
 		/* Ensure passwords are cleared from memory */
-		memset (buf, 0, strlen (buf));
-		g_free (buf);
+		secure_free (buf);
+
+		/* Now passwd has to answer */
+		passwd_handler->answer_started = g_get_monotonic_time ();
+		if (get_state_stage (passwd_handler->backend_state, &stage))
+			watchdog_arm (passwd_handler, stage);
 	}
 }
 
-/* Goes through the argument list, checking if one of them occurs in str
- * Returns: TRUE as soon as an element is found to match, FALSE otherwise */
-static gboolean
-is_string_complete (gchar *str, ...)
+/* Sends the queued password matching the first prompt of passwd */
+static void
+answer_first_prompt (PasswdHandler *passwd_handler)
 {
-	va_list ap;
-	gchar   *arg;
+	gchar *pw;
 
-	if (strlen (str) == 0) {
-		return FALSE;
-	}
+	if (passwd_handler->backend_prompt == PASSWD_PROMPT_NEW) {
+		set_backend_state (passwd_handler, PASSWD_STATE_NEW);
 
-	va_start (ap, str);
+		/* since passwd didn't ask for our old password
+		 * in this case, simply remove it from the queue */
+		pw = g_queue_pop_head (passwd_handler->backend_stdin_queue);
+		secure_free (pw);
 
-	while ((arg = va_arg (ap, char *)) != NULL) {
-		if (strstr (str, arg) != NULL) {
-			va_end (ap);
-			return TRUE;
-		}
-	}
+		/* Pop the IO queue, i.e. send new password */
+		io_queue_pop (passwd_handler);
+	} else {
+		set_backend_state (passwd_handler, PASSWD_STATE_AUTH);
 
-	va_end (ap);
+		/* Pop the IO queue, i.e. send current password */
+		io_queue_pop (passwd_handler);
+	}
 
-	return FALSE;
+	passwd_handler->backend_prompt = PASSWD_PROMPT_NONE;
+	passwd_handler->backend_idle = FALSE;
 }
 
 /*
@@ -370,20 +813,14 @@ is_string_complete (gchar *str, ...)
 static gboolean
 io_watch_stdout (GIOChannel *source, GIOCondition condition, PasswdHandler *passwd_handler)
 {
-	static GString *str = NULL;             /* Persistent buffer */
-
 	gchar           buf[BUFSIZE];           /* Temporary buffer */
 	gsize           bytes_read;
 	GError          *gio_error = NULL;      /* Error returned by functions */
 	GError          *error = NULL;          /* Error sent to callbacks */
+	const PasswdRule *rule;
 
 	gboolean        reinit = FALSE;
 
-	/* Initialize buffer */
-	if (str == NULL) {
-		str = g_string_new ("");
-	}
-
 	if (g_io_channel_read_chars (source, buf, BUFSIZE, &bytes_read, &gio_error) != G_IO_STATUS_NORMAL) {
 		g_warning ("IO Channel read error: %s", gio_error->message);
 		g_error_free (gio_error);
@@ -391,174 +828,113 @@ io_watch_stdout (GIOChannel *source, GIOCondition condition, PasswdHandler *pass
 		return TRUE;
 	}
 
-	str = g_string_append_len (str, buf, bytes_read);
+	/* Only the new bytes are scanned */
+	g_string_append_len (passwd_handler->output, buf, bytes_read);
+	passwd_handler->output_state = passwd_matcher_feed (get_output_matcher (),
+	                                                    passwd_handler->output_state,
+	                                                    buf, bytes_read,
+	                                                    passwd_handler->output_matched);
 
 	/* In which state is the backend? */
 	switch (passwd_handler->backend_state) {
 		case PASSWD_STATE_AUTH:
 			/* Passwd is asking for our current password */
-			if (is_string_complete (str->str, "assword: ", "failure", "wrong", "error", NULL)) {
-				if (strstr (str->str, "assword: ") != NULL) {
-					/* Authentication successful */
-					passwd_handler->backend_state = PASSWD_STATE_NEW;
-
-					/* Trigger callback to update authentication status */
-					if (passwd_handler->auth_cb)
-						passwd_handler->auth_cb (passwd_handler,
-						                         NULL,
-						                         passwd_handler->auth_cb_data);
-
-				} else {
-					/* Authentication failed */
-					error = g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_AUTH_FAILED,
-					                             _("Authentication failed"));
-
-					passwd_handler->changing_password = FALSE;
-
-					/* This error can happen both while authenticating or while changing password:
-					 * if chpasswd_cb is set, this means we're already changing password */
-					if (passwd_handler->chpasswd_cb) {
-						passwd_handler->chpasswd_cb (passwd_handler,
-						                             error,
-						                             passwd_handler->chpasswd_cb_data);
-					} else if (passwd_handler->auth_cb) {
-						passwd_handler->auth_cb (passwd_handler,
-						                         error,
-						                         passwd_handler->auth_cb_data);
-					}
-					g_error_free (error);
+			if (output_has (passwd_handler, PASSWD_MATCH_PROMPT)) {
+				/* Authentication successful, passwd now waits
+				 * for the user to choose a new password */
+				watchdog_disarm (passwd_handler);
+				set_backend_state (passwd_handler, PASSWD_STATE_NEW);
+
+				/* Trigger callback to update authentication status */
+				if (passwd_handler->auth_cb)
+					passwd_handler->auth_cb (passwd_handler,
+					                         NULL,
+					                         passwd_handler->auth_cb_data);
+
+				reinit = TRUE;
+			} else if (output_has (passwd_handler, PASSWD_MATCH_AUTH_ERROR)) {
+				/* Authentication failed */
+				error = g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_AUTH_FAILED,
+				                             _("Authentication failed"));
+
+				passwd_handler->changing_password = FALSE;
+
+				/* The user will most likely try again */
+				passwd_handler->respawn_on_exit = TRUE;
+
+				/* This error can happen both while authenticating or while changing password:
+				 * if chpasswd_cb is set, this means we're already changing password */
+				if (passwd_handler->chpasswd_cb) {
+					passwd_handler->chpasswd_cb (passwd_handler,
+					                             error,
+					                             passwd_handler->chpasswd_cb_data);
+				} else if (passwd_handler->auth_cb) {
+					passwd_handler->auth_cb (passwd_handler,
+					                         error,
+					                         passwd_handler->auth_cb_data);
 				}
+				g_error_free (error);
 
 				reinit = TRUE;
 			}
 			break;
 		case PASSWD_STATE_NEW:
 			/* Passwd is asking for our new password */
-			if (is_string_complete (str->str, "assword: ", NULL)) {
+			if (output_has (passwd_handler, PASSWD_MATCH_PROMPT)) {
 				/* Advance to next state */
-				passwd_handler->backend_state = PASSWD_STATE_RETYPE;
+				set_backend_state (passwd_handler, PASSWD_STATE_RETYPE);
 
 				/* Pop retyped password from queue and into IO channel */
-				io_queue_pop (passwd_handler->backend_stdin_queue, passwd_handler->backend_stdin);
+				io_queue_pop (passwd_handler);
 
 				reinit = TRUE;
 			}
 			break;
 		case PASSWD_STATE_RETYPE:
 			/* Passwd is asking for our retyped new password */
-			if (is_string_complete (str->str,
-			                        "successfully",
-			                        "short",
-			                        "longer",
-			                        "palindrome",
-			                        "dictionary",
-			                        "simple",
-			                        "simplistic",
-			                        "similar",
-			                        "case",
-			                        "different",
-			                        "wrapped",
-			                        "recovered",
-			                        "recent",
-			                        "unchanged",
-			                        "match",
-			                        "1 numeric or special",
-			                        "failure",
-			                        "DIFFERENT",
-			                        "BAD PASSWORD",
-			                        NULL))
-			{
-				if (strstr (str->str, "successfully") != NULL) {
-					/* Hooray! */
-					passwd_handler->backend_state = PASSWD_STATE_DONE;
-
-					/* Trigger callback to update status */
-					if (passwd_handler->chpasswd_cb)
-						passwd_handler->chpasswd_cb (passwd_handler,
-						                             NULL,
-						                             passwd_handler->chpasswd_cb_data);
-				} else {
-					/* Ohnoes! */
-					if (strstr (str->str, "recovered") != NULL)
-					{
-						/* What does this indicate?
-						 * "Authentication information cannot be recovered?" from libpam? */
-						error = g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_UNKNOWN,
-						                             str->str);
-					}
-					else if (strstr (str->str, "short") != NULL ||
-						 strstr (str->str, "longer") != NULL)
-					{
-						error = g_error_new (PASSWD_ERROR, PASSWD_ERROR_REJECTED,
-						                     _("The new password is too short"));
-					}
-					else if (strstr (str->str, "palindrome") != NULL ||
-					         strstr (str->str, "simple") != NULL ||
-					         strstr (str->str, "simplistic") != NULL ||
-					         strstr (str->str, "dictionary") != NULL)
-					{
-						error = g_error_new (PASSWD_ERROR, PASSWD_ERROR_REJECTED,
-						                     _("The new password is too simple"));
-					}
-					else if (strstr (str->str, "similar") != NULL ||
-					         strstr (str->str, "different") != NULL ||
-					         strstr (str->str, "case") != NULL ||
-					         strstr (str->str, "wrapped") != NULL)
-					{
-						error = g_error_new (PASSWD_ERROR, PASSWD_ERROR_REJECTED,
-						                     _("The old and new passwords are too similar"));
-					}
-					else if (strstr (str->str, "recent") != NULL)
-					{
-						error = g_error_new (PASSWD_ERROR, PASSWD_ERROR_REJECTED,
-						                     _("The new password has already been used recently."));
-					}
-					else if (strstr (str->str, "1 numeric or special") != NULL)
-					{
-						error = g_error_new (PASSWD_ERROR, PASSWD_ERROR_REJECTED,
-						                     _("The new password must contain numeric or special characters"));
-					}
-					else if (strstr (str->str, "unchanged") != NULL ||
-					         strstr (str->str, "match") != NULL)
-					{
-						error = g_error_new (PASSWD_ERROR, PASSWD_ERROR_REJECTED,
-						                     _("The old and new passwords are the same"));
-					}
-					else if (strstr (str->str, "failure") != NULL) {
-						/* Authentication failure */
-						error = g_error_new (PASSWD_ERROR, PASSWD_ERROR_AUTH_FAILED,
-						                     _("Your password has been changed since you initially authenticated!"));
-					}
-					else if (strstr (str->str, "DIFFERENT"))
-					{
-						error = g_error_new (PASSWD_ERROR, PASSWD_ERROR_REJECTED,
-						                   _("The new password does not contain enough different characters"));
-					}
-					else {
-						error = g_error_new (PASSWD_ERROR, PASSWD_ERROR_UNKNOWN,
-						                     _("Unknown error"));
-					}
-
-					/* At this point, passwd might have exited, in which case
-					 * child_watch_cb should clean up for us and remove this watcher.
-					 * On some error conditions though, passwd just re-prompts us
-					 * for our new password. */
-					passwd_handler->backend_state = PASSWD_STATE_ERR;
-
-					passwd_handler->changing_password = FALSE;
-
-					/* Trigger callback to update status */
-					if (passwd_handler->chpasswd_cb)
-					{
-						passwd_handler->chpasswd_cb (passwd_handler,
-						                             error,
-						                             passwd_handler->chpasswd_cb_data);
-					}
-
-					g_error_free (error);
+			if (output_has (passwd_handler, PASSWD_MATCH_SUCCESS)) {
+				/* Hooray! */
+				watchdog_disarm (passwd_handler);
+				set_backend_state (passwd_handler, PASSWD_STATE_DONE);
 
+				/* Trigger callback to update status */
+				if (passwd_handler->chpasswd_cb)
+					passwd_handler->chpasswd_cb (passwd_handler,
+					                             NULL,
+					                             passwd_handler->chpasswd_cb_data);
+
+				reinit = TRUE;
+			} else if ((rule = output_find_error (passwd_handler)) != NULL ||
+			           output_has (passwd_handler, PASSWD_MATCH_PROMPT)) {
+				/* Ohnoes! passwd either explained why, or just
+				 * asked again for the new password */
+				if (rule != NULL)
+					error = g_error_new_literal (PASSWD_ERROR, rule->error,
+					                             rule->message != NULL ?
+					                             rule->message : passwd_handler->output->str);
+				else
+					error = g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_UNKNOWN,
+					                             _("Unknown error"));
+
+				/* At this point, passwd might have exited, in which case
+				 * child_watch_cb should clean up for us and remove this watcher.
+				 * On some error conditions though, passwd just re-prompts us
+				 * for our new password. */
+				watchdog_disarm (passwd_handler);
+				set_backend_state (passwd_handler, PASSWD_STATE_ERR);
+
+				passwd_handler->changing_password = FALSE;
+
+				/* Trigger callback to update status */
+				if (passwd_handler->chpasswd_cb)
+				{
+					passwd_handler->chpasswd_cb (passwd_handler,
+					                             error,
+					                             passwd_handler->chpasswd_cb_data);
 				}
 
+				g_error_free (error);
+
 				reinit = TRUE;
 
 				/* child_watch_cb should clean up for us now */
@@ -566,29 +942,22 @@ io_watch_stdout (GIOChannel *source, GIOCondition condition, PasswdHandler *pass
 			break;
 		case PASSWD_STATE_NONE:
 			/* Passwd is not asking for anything yet */
-			if (is_string_complete (str->str, "assword: ", NULL))
+			if (output_has (passwd_handler, PASSWD_MATCH_PROMPT))
 			{
 				/* If the user does not have a password set,
 				 * passwd will immediately ask for the new password,
 				 * so skip the AUTH phase */
-				if (is_string_complete (str->str, "new", "New", NULL)) {
-					gchar *pw;
-
-					passwd_handler->backend_state = PASSWD_STATE_NEW;
-
-					/* since passwd didn't ask for our old password
-					 * in this case, simply remove it from the queue */
-					pw = g_queue_pop_head (passwd_handler->backend_stdin_queue);
-					g_free (pw);
-
-					/* Pop the IO queue, i.e. send new password */
-					io_queue_pop (passwd_handler->backend_stdin_queue, passwd_handler->backend_stdin);
-				} else {
-					passwd_handler->backend_state = PASSWD_STATE_AUTH;
-
-					/* Pop the IO queue, i.e. send current password */
-					io_queue_pop (passwd_handler->backend_stdin_queue, passwd_handler->backend_stdin);
-				}
+				if (output_has (passwd_handler, PASSWD_MATCH_NEW))
+					passwd_handler->backend_prompt = PASSWD_PROMPT_NEW;
+				else
+					passwd_handler->backend_prompt = PASSWD_PROMPT_CURRENT;
+
+				/* A backend spawned ahead of time waits for
+				 * passwd_authenticate() to queue the password */
+				if (!g_queue_is_empty (passwd_handler->backend_stdin_queue))
+					answer_first_prompt (passwd_handler);
+				else
+					watchdog_disarm (passwd_handler);
 
 				reinit = TRUE;
 			}
@@ -599,10 +968,8 @@ io_watch_stdout (GIOChannel *source, GIOCondition condition, PasswdHandler *pass
 			break;
 	}
 
-	if (reinit) {
-		g_string_free (str, TRUE);
-		str = NULL;
-	}
+	if (reinit)
+		reset_output (passwd_handler);
 
 	/* Continue calling us */
 	return TRUE;
@@ -612,29 +979,328 @@ io_watch_stdout (GIOChannel *source, GIOCondition condition, PasswdHandler *pass
  * }} Backend communication code
  */
 
+#ifdef HAVE_PAM_BACKEND
+
+/*
+ * PAM backend {{
+ */
+
+/* The same stack passwd itself goes through */
+#define PAM_SERVICE "passwd"
+
+typedef enum {
+	PAM_OPERATION_AUTHENTICATE,
+	PAM_OPERATION_CHAUTHTOK
+} PamOperation;
+
+typedef struct {
+	PamOperation  operation;
+	gchar        *username;
+	gchar        *current_password;
+	gchar        *new_password;
+
+	/* Conversation state, only touched by the worker thread */
+	gboolean      current_sent;
+	guint         new_sent;
+	gboolean      rejected;
+
+	gint          status;
+	gchar        *message;       /* Last error the PAM stack reported */
+} PamRequest;
+
+/* Replies are allocated with malloc(), as PAM frees them */
+static void
+wipe_reply (gchar *reply)
+{
+	if (reply != NULL) {
+		secure_wipe (reply, strlen (reply));
+		free (reply);
+	}
+}
+
+static void
+pam_request_free (PamRequest *request)
+{
+	g_free (request->username);
+	secure_free (request->current_password);
+	secure_free (request->new_password);
+	g_free (request->message);
+	g_free (request);
+}
+
+/* Answers the prompts of the PAM stack. Modules ask for the current
+ * password first, if the account has one, then for the new password
+ * and its confirmation. Being asked again means the new password was
+ * rejected, and the conversation is aborted rather than looping over
+ * the retries of the stack. */
+static int
+pam_conversation (int                        num_msg,
+                  const struct pam_message **msg,
+                  struct pam_response      **resp,
+                  void                      *appdata_ptr)
+{
+	PamRequest *request = appdata_ptr;
+	struct pam_response *replies;
+	const gchar *answer;
+	int i;
+
+	replies = calloc (num_msg, sizeof (struct pam_response));
+	if (replies == NULL)
+		return PAM_BUF_ERR;
+
+	for (i = 0; i < num_msg; i++) {
+		switch (msg[i]->msg_style) {
+			case PAM_PROMPT_ECHO_OFF:
+				if (request->current_password != NULL && !request->current_sent) {
+					answer = request->current_password;
+					request->current_sent = TRUE;
+				}
+				else if (request->new_password != NULL && request->new_sent < 2 && !request->rejected) {
+					answer = request->new_password;
+					request->new_sent++;
+				}
+				else {
+					if (request->new_sent > 0)
+						request->rejected = TRUE;
+					goto fail;
+				}
+
+				replies[i].resp = strdup (answer);
+				if (replies[i].resp == NULL)
+					goto fail;
+				break;
+			case PAM_ERROR_MSG:
+				g_free (request->message);
+				request->message = g_strdup (msg[i]->msg);
+				if (request->new_sent > 0)
+					request->rejected = TRUE;
+				break;
+			case PAM_TEXT_INFO:
+				break;
+			default:
+				/* The user name was given to pam_start() */
+				goto fail;
+		}
+	}
+
+	*resp = replies;
+
+	return PAM_SUCCESS;
+
+fail:
+	for (i = 0; i < num_msg; i++)
+		wipe_reply (replies[i].resp);
+	free (replies);
+
+	return PAM_CONV_ERR;
+}
+
+static void
+pam_thread (GTask        *task,
+            gpointer      source_object,
+            gpointer      task_data,
+            GCancellable *cancellable)
+{
+	PamRequest *request = task_data;
+	struct pam_conv conv = { pam_conversation, request };
+	pam_handle_t *pamh = NULL;
+	gint status;
+
+	status = pam_start (PAM_SERVICE, request->username, &conv, &pamh);
+	if (status == PAM_SUCCESS) {
+		if (request->operation == PAM_OPERATION_AUTHENTICATE)
+			status = pam_authenticate (pamh, 0);
+		else
+			status = pam_chauthtok (pamh, 0);
+	}
+
+	request->status = status;
+	if (status != PAM_SUCCESS && request->message == NULL)
+		request->message = g_strdup (pam_strerror (pamh, status));
+
+	if (pamh != NULL)
+		pam_end (pamh, status);
+
+	g_task_return_boolean (task, TRUE);
+}
+
+/* Maps the PAM result to the errors the passwd backend reports */
+static GError *
+pam_request_get_error (PamRequest *request)
+{
+	if (request->status == PAM_SUCCESS)
+		return NULL;
+
+	if (request->rejected) {
+		return g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_REJECTED,
+		                            request->message != NULL ?
+		                            request->message : _("The new password was rejected"));
+	}
+
+	switch (request->status) {
+		case PAM_AUTH_ERR:
+		case PAM_CRED_INSUFFICIENT:
+		case PAM_MAXTRIES:
+		case PAM_PERM_DENIED:
+		case PAM_USER_UNKNOWN:
+			return g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_AUTH_FAILED,
+			                            _("Authentication failed"));
+		case PAM_AUTHTOK_RECOVERY_ERR:
+			return g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_AUTH_FAILED,
+			                            _("Your password has been changed since you initially authenticated!"));
+		case PAM_AUTHTOK_ERR:
+			return g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_REJECTED,
+			                            request->message);
+		case PAM_ABORT:
+		case PAM_AUTHTOK_LOCK_BUSY:
+		case PAM_BUF_ERR:
+		case PAM_SERVICE_ERR:
+		case PAM_SYSTEM_ERR:
+		case PAM_TRY_AGAIN:
+			return g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_BACKEND,
+			                            request->message);
+		default:
+			return g_error_new_literal (PASSWD_ERROR, PASSWD_ERROR_UNKNOWN,
+			                            request->message);
+	}
+}
+
+static void
+pam_request_done (GObject      *source,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+	PasswdHandler *passwd_handler;
+	PamRequest *request;
+	GError *error = NULL;
+
+	if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+		/* Replaced by a newer request, or the handler is gone */
+		g_error_free (error);
+		return;
+	}
+
+	passwd_handler = user_data;
+	g_clear_object (&passwd_handler->pam_cancellable);
+	watchdog_disarm (passwd_handler);
+
+	request = g_task_get_task_data (G_TASK (result));
+	error = pam_request_get_error (request);
+
+	if (request->operation == PAM_OPERATION_AUTHENTICATE) {
+		if (passwd_handler->auth_cb)
+			passwd_handler->auth_cb (passwd_handler,
+			                         error,
+			                         passwd_handler->auth_cb_data);
+	} else {
+		passwd_handler->changing_password = FALSE;
+		if (passwd_handler->chpasswd_cb)
+			passwd_handler->chpasswd_cb (passwd_handler,
+			                             error,
+			                             passwd_handler->chpasswd_cb_data);
+	}
+
+	if (error != NULL)
+		g_error_free (error);
+}
+
+static void
+pam_cancel_request (PasswdHandler *passwd_handler)
+{
+	if (passwd_handler->pam_cancellable != NULL) {
+		g_cancellable_cancel (passwd_handler->pam_cancellable);
+		g_clear_object (&passwd_handler->pam_cancellable);
+	}
+}
+
+static void
+pam_start_request (PasswdHandler *passwd_handler,
+                   PamOperation   operation,
+                   const char    *new_password)
+{
+	PamRequest *request;
+	GTask *task;
+
+	request = g_new0 (PamRequest, 1);
+	request->operation = operation;
+	request->username = g_strdup (g_get_user_name ());
+	request->current_password = secure_strdup (passwd_handler->current_password);
+	request->new_password = secure_strdup (new_password);
+
+	pam_cancel_request (passwd_handler);
+	passwd_handler->pam_cancellable = g_cancellable_new ();
+
+	task = g_task_new (NULL, passwd_handler->pam_cancellable, pam_request_done, passwd_handler);
+	g_task_set_source_tag (task, pam_start_request);
+	g_task_set_task_data (task, request, (GDestroyNotify) pam_request_free);
+	g_task_run_in_thread (task, pam_thread);
+	g_object_unref (task);
+
+	/* pam_chauthtok() cannot be interrupted, and could still change the
+	 * password after a timeout was reported, so only authentication is
+	 * watched */
+	if (operation == PAM_OPERATION_AUTHENTICATE)
+		watchdog_arm (passwd_handler, PASSWD_STAGE_AUTH);
+}
+
+static gboolean
+use_pam_backend (void)
+{
+	GSettings *settings;
+	gchar *backend;
+	gboolean use_pam;
+
+	settings = g_settings_new (XUA_SETTINGS_SCHEMA);
+	backend = g_settings_get_string (settings, XUA_SETTINGS_KEY_PASSWD_BACKEND);
+	use_pam = g_strcmp0 (backend, "pam") == 0;
+	g_free (backend);
+	g_object_unref (settings);
+
+	return use_pam;
+}
+
+/*
+ * }} PAM backend
+ */
+
+#endif /* HAVE_PAM_BACKEND */
+
+static void
+set_current_password (PasswdHandler *passwd_handler,
+                      const char    *current_password)
+{
+	secure_free (passwd_handler->current_password);
+	passwd_handler->current_password = secure_strdup (current_password);
+}
+
+static void
+clear_queue (PasswdHandler *passwd_handler)
+{
+	gchar *pw;
+
+	while ((pw = g_queue_pop_head (passwd_handler->backend_stdin_queue)) != NULL)
+		secure_free (pw);
+}
+
 /* Adds the current password to the IO queue */
 static void
 authenticate (PasswdHandler *passwd_handler)
 {
-	gchar   *s;
+	const gchar *current;
 
-	s = g_strdup_printf ("%s\n", passwd_handler->current_password);
+	current = passwd_handler->current_password != NULL ? passwd_handler->current_password : "";
 
-	g_queue_push_tail (passwd_handler->backend_stdin_queue, s);
+	g_queue_push_tail (passwd_handler->backend_stdin_queue, secure_strdup (current));
 }
 
 /* Adds the new password twice to the IO queue */
 static void
-update_password (PasswdHandler *passwd_handler)
+update_password (PasswdHandler *passwd_handler,
+                 const char    *new_password)
 {
-	gchar   *s;
-
-	s = g_strdup_printf ("%s\n", passwd_handler->new_password);
-
-	g_queue_push_tail (passwd_handler->backend_stdin_queue, s);
-	/* We need to allocate new space because io_queue_pop() g_free()s
-	 * every element of the queue after it's done */
-	g_queue_push_tail (passwd_handler->backend_stdin_queue, g_strdup (s));
+	/* io_queue_pop() frees every element of the queue after it's done */
+	g_queue_push_tail (passwd_handler->backend_stdin_queue, secure_strdup (new_password));
+	g_queue_push_tail (passwd_handler->backend_stdin_queue, secure_strdup (new_password));
 }
 
 
@@ -642,6 +1308,7 @@ PasswdHandler *
 passwd_init (void)
 {
 	PasswdHandler *passwd_handler;
+	PasswdStage stage;
 
 	passwd_handler = g_new0 (PasswdHandler, 1);
 
@@ -655,6 +1322,12 @@ passwd_init (void)
 	/* Initialize write queue */
 	passwd_handler->backend_stdin_queue = g_queue_new ();
 
+	/* Initialize output matching */
+	passwd_handler->output = g_string_new ("");
+	passwd_handler->output_state = PASSWD_MATCHER_START;
+	passwd_handler->output_matched = g_new0 (gboolean,
+	                                         passwd_matcher_get_n_patterns (get_output_matcher ()));
+
 	/* Initialize watchers */
 	passwd_handler->backend_child_watch_id = 0;
 	passwd_handler->backend_stdout_watch_id = 0;
@@ -663,17 +1336,51 @@ passwd_init (void)
 	passwd_handler->backend_state = PASSWD_STATE_NONE;
 	passwd_handler->changing_password = FALSE;
 
+	/* Initialize watchdog */
+	for (stage = 0; stage < PASSWD_N_STAGES; stage++)
+		passwd_handler->timeouts[stage] = DEFAULT_TIMEOUT;
+
+#ifdef HAVE_PAM_BACKEND
+	passwd_handler->use_pam = use_pam_backend ();
+#endif
+
 	return passwd_handler;
 }
 
 void
 passwd_destroy (PasswdHandler *passwd_handler)
 {
+	clear_queue (passwd_handler);
 	g_queue_free (passwd_handler->backend_stdin_queue);
 	stop_passwd (passwd_handler);
+	g_string_free (passwd_handler->output, TRUE);
+	g_free (passwd_handler->output_matched);
+	set_current_password (passwd_handler, NULL);
+#ifdef HAVE_PAM_BACKEND
+	pam_cancel_request (passwd_handler);
+#endif
 	g_free (passwd_handler);
 }
 
+void
+passwd_set_timeout (PasswdHandler *passwd_handler,
+                    PasswdStage    stage,
+                    guint          seconds)
+{
+	g_return_if_fail (stage < PASSWD_N_STAGES);
+
+	passwd_handler->timeouts[stage] = seconds;
+}
+
+gint64
+passwd_get_stage_duration (PasswdHandler *passwd_handler,
+                           PasswdStage    stage)
+{
+	g_return_val_if_fail (stage < PASSWD_N_STAGES, 0);
+
+	return passwd_handler->durations[stage];
+}
+
 void
 passwd_authenticate (PasswdHandler *passwd_handler,
                      const char    *current_password,
@@ -687,16 +1394,32 @@ passwd_authenticate (PasswdHandler *passwd_handler,
 		return;
 
 	/* Clear data from possible previous attempts to change password */
-	passwd_handler->new_password = NULL;
 	passwd_handler->chpasswd_cb = NULL;
 	passwd_handler->chpasswd_cb_data = NULL;
-	g_queue_foreach (passwd_handler->backend_stdin_queue, (GFunc) g_free, NULL);
-	g_queue_clear (passwd_handler->backend_stdin_queue);
+	clear_queue (passwd_handler);
 
-	passwd_handler->current_password = current_password;
+	set_current_password (passwd_handler, current_password);
 	passwd_handler->auth_cb = cb;
 	passwd_handler->auth_cb_data = user_data;
 
+#ifdef HAVE_PAM_BACKEND
+	if (passwd_handler->use_pam) {
+		pam_start_request (passwd_handler, PAM_OPERATION_AUTHENTICATE, NULL);
+		return;
+	}
+#endif
+
+	/* Reuse the backend spawned after a failed attempt, which may
+	 * already be waiting for the current password */
+	if (passwd_handler->backend_idle && passwd_handler->backend_pid != -1) {
+		authenticate (passwd_handler);
+
+		if (passwd_handler->backend_prompt != PASSWD_PROMPT_NONE)
+			answer_first_prompt (passwd_handler);
+
+		return;
+	}
+
 	/* Spawn backend */
 	stop_passwd (passwd_handler);
 
@@ -722,12 +1445,20 @@ passwd_change_password (PasswdHandler *passwd_handler,
 
 	passwd_handler->changing_password = TRUE;
 
-	passwd_handler->new_password = new_password;
 	passwd_handler->chpasswd_cb = cb;
 	passwd_handler->chpasswd_cb_data = user_data;
 
-	/* Stop passwd if an error occured and it is still running */
-	if (passwd_handler->backend_state == PASSWD_STATE_ERR) {
+#ifdef HAVE_PAM_BACKEND
+	if (passwd_handler->use_pam) {
+		pam_start_request (passwd_handler, PAM_OPERATION_CHAUTHTOK, new_password);
+		return TRUE;
+	}
+#endif
+
+	/* Stop passwd if an error occured and it is still running, or
+	 * if it was spawned ahead of time and never authenticated */
+	if (passwd_handler->backend_state == PASSWD_STATE_ERR ||
+	    passwd_handler->backend_idle) {
 		/* Stop passwd, free resources */
 		stop_passwd (passwd_handler);
 	}
@@ -749,10 +1480,10 @@ passwd_change_password (PasswdHandler *passwd_handler,
 
 		/* Add current and new passwords to queue */
 		authenticate (passwd_handler);
-		update_password (passwd_handler);
+		update_password (passwd_handler, new_password);
 	} else {
 		/* Only add new passwords to queue */
-		update_password (passwd_handler);
+		update_password (passwd_handler, new_password);
 	}
 
 	/* Pop new password through the backend.
@@ -762,7 +1493,7 @@ passwd_change_password (PasswdHandler *passwd_handler,
 	 * and output the new one for us.
 	 */
 	if (passwd_handler->current_password)
-		io_queue_pop (passwd_handler->backend_stdin_queue, passwd_handler->backend_stdin);
+		io_queue_pop (passwd_handler);
 
 	/* Our IO watcher should now handle the rest */
 
@@ -35,9 +35,18 @@ typedef enum {
         PASSWD_ERROR_AUTH_FAILED,       /* Wrong old password, or PAM failure */
         PASSWD_ERROR_REAUTH_FAILED,     /* Password has changed since first authentication */
         PASSWD_ERROR_BACKEND,           /* Backend error */
+        PASSWD_ERROR_TIMEOUT,           /* Backend did not answer in time */
         PASSWD_ERROR_UNKNOWN            /* General error */
 } PasswdError;
 
+/* Steps of a password change, each with its own timeout */
+typedef enum {
+        PASSWD_STAGE_AUTH,              /* Checking the current password */
+        PASSWD_STAGE_NEW,               /* Sending the new password */
+        PASSWD_STAGE_RETYPE,            /* Confirming the new password */
+        PASSWD_N_STAGES
+} PasswdStage;
+
 
 PasswdHandler *passwd_init                (void);
 
@@ -53,5 +62,15 @@ gboolean       passwd_change_password     (PasswdHandler *passwd_handler,
                                            PasswdCallback cb,
                                            const gpointer user_data);
 
+/* Seconds to wait for the backend in a stage, 0 to wait forever.
+ * Password changes through PAM are never timed out. */
+void           passwd_set_timeout         (PasswdHandler *passwd_handler,
+                                           PasswdStage    stage,
+                                           guint          seconds);
+
+/* Microseconds passwd took to answer in a stage, during the last change */
+gint64         passwd_get_stage_duration  (PasswdHandler *passwd_handler,
+                                           PasswdStage    stage);
+
 #endif /* _RUN_PASSWD_H */
 
@@ -0,0 +1,251 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
+
+#include <glib.h>
+
+#include "secure-memory.h"
+
+/* Memory for passwords. Small blocks come from a pool of pages locked
+ * in RAM, so they are never written to swap, and left out of core
+ * dumps. Larger blocks, or any when the pool is full, fall back to the
+ * heap. Every block is wiped when freed, in a way the compiler cannot
+ * optimise away.
+ */
+
+#define POOL_SIZE  (16 * 1024)
+#define SLOT_SIZE  256
+#define N_SLOTS    (POOL_SIZE / SLOT_SIZE)
+
+/* Heap blocks start with their size, keeping the payload aligned */
+#define HEAP_HEADER (2 * sizeof (gsize))
+
+G_STATIC_ASSERT (N_SLOTS == 64);
+
+static GMutex   pool_lock;
+static guint8  *pool = NULL;
+static gboolean pool_failed = FALSE;
+static guint64  slots_used = 0;          /* One bit per slot */
+
+void
+secure_wipe (gpointer mem,
+             gsize    size)
+{
+	if (mem == NULL || size == 0)
+		return;
+
+#ifdef HAVE_EXPLICIT_BZERO
+	explicit_bzero (mem, size);
+#else
+	{
+		volatile guint8 *p = mem;
+
+		while (size--)
+			*p++ = 0;
+	}
+#endif
+}
+
+static gboolean
+pool_init (void)
+{
+	gpointer mem;
+
+	if (pool != NULL)
+		return TRUE;
+	if (pool_failed)
+		return FALSE;
+
+	mem = mmap (NULL, POOL_SIZE, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		g_debug ("Could not map secure memory: %s", g_strerror (errno));
+		pool_failed = TRUE;
+		return FALSE;
+	}
+
+	if (mlock (mem, POOL_SIZE) < 0) {
+		g_debug ("Could not lock secure memory: %s", g_strerror (errno));
+		munmap (mem, POOL_SIZE);
+		pool_failed = TRUE;
+		return FALSE;
+	}
+
+#ifdef MADV_DONTDUMP
+	madvise (mem, POOL_SIZE, MADV_DONTDUMP);
+#endif
+
+	pool = mem;
+
+	return TRUE;
+}
+
+static gpointer
+pool_alloc (gsize size)
+{
+	gpointer mem = NULL;
+	guint slot;
+
+	if (size > SLOT_SIZE)
+		return NULL;
+
+	g_mutex_lock (&pool_lock);
+
+	if (pool_init ()) {
+		for (slot = 0; slot < N_SLOTS; slot++) {
+			if ((slots_used & (G_GUINT64_CONSTANT (1) << slot)) == 0) {
+				slots_used |= G_GUINT64_CONSTANT (1) << slot;
+				mem = pool + slot * SLOT_SIZE;
+				break;
+			}
+		}
+	}
+
+	g_mutex_unlock (&pool_lock);
+
+	return mem;
+}
+
+static gboolean
+pool_contains (gpointer mem)
+{
+	return pool != NULL &&
+	       (guint8 *) mem >= pool &&
+	       (guint8 *) mem < pool + POOL_SIZE;
+}
+
+/* Returns size zeroed bytes, to be released with secure_free() */
+gpointer
+secure_alloc (gsize size)
+{
+	gpointer mem;
+	guint8 *block;
+
+	mem = pool_alloc (size);
+	if (mem != NULL)
+		return mem;
+
+	block = g_malloc0 (HEAP_HEADER + size);
+	*(gsize *) block = size;
+
+	return block + HEAP_HEADER;
+}
+
+void
+secure_free (gpointer mem)
+{
+	guint8 *block;
+	guint slot;
+
+	if (mem == NULL)
+		return;
+
+	if (pool_contains (mem)) {
+		slot = ((guint8 *) mem - pool) / SLOT_SIZE;
+		secure_wipe (pool + slot * SLOT_SIZE, SLOT_SIZE);
+
+		g_mutex_lock (&pool_lock);
+		slots_used &= ~(G_GUINT64_CONSTANT (1) << slot);
+		g_mutex_unlock (&pool_lock);
+		return;
+	}
+
+	block = (guint8 *) mem - HEAP_HEADER;
+	secure_wipe (block, HEAP_HEADER + *(gsize *) block);
+	g_free (block);
+}
+
+gchar *
+secure_strdup (const gchar *str)
+{
+	gchar *copy;
+	gsize length;
+
+	if (str == NULL)
+		return NULL;
+
+	length = strlen (str);
+	copy = secure_alloc (length + 1);
+	memcpy (copy, str, length);
+
+	return copy;
+}
+
+/* Fills mem with bytes of the kernel random generator, for secrets and
+ * salts. Unlike g_random_*(), the output cannot be predicted from
+ * earlier values. */
+gboolean
+secure_random (gpointer mem,
+               gsize    size)
+{
+	guint8 *p = mem;
+	gssize n;
+	gint fd;
+
+#ifdef HAVE_GETRANDOM
+	while (size > 0) {
+		n = getrandom (p, size, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOSYS)
+				break;
+			g_warning ("Failed to read random bytes: %s", g_strerror (errno));
+			return FALSE;
+		}
+		p += n;
+		size -= n;
+	}
+
+	if (size == 0)
+		return TRUE;
+#endif
+
+	fd = open ("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		g_warning ("Failed to open /dev/urandom: %s", g_strerror (errno));
+		return FALSE;
+	}
+
+	while (size > 0) {
+		n = read (fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			g_warning ("Failed to read /dev/urandom: %s",
+			           n < 0 ? g_strerror (errno) : "end of file");
+			close (fd);
+			return FALSE;
+		}
+		p += n;
+		size -= n;
+	}
+
+	close (fd);
+
+	return TRUE;
+}
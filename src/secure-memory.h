@@ -0,0 +1,35 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#ifndef __SECURE_MEMORY_H__
+#define __SECURE_MEMORY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gpointer secure_alloc   (gsize        size);
+void     secure_free    (gpointer     mem);
+gchar   *secure_strdup  (const gchar *str);
+void     secure_wipe    (gpointer     mem,
+                         gsize        size);
+gboolean secure_random  (gpointer     mem,
+                         gsize        size);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,297 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "um-login-history.h"
+
+/* Checks the indexed login history against the linear scan the history
+ * dialog used to do on every week it showed. Run with `make check`. */
+
+#define WEEK (7 * 24 * 60 * 60)
+
+typedef struct {
+	gint64       login_time;
+	gint64       logout_time;
+	const gchar *type;
+} Record;
+
+static GVariant *
+build_history (const Record *records, guint n_records)
+{
+	GVariantBuilder builder, details;
+	guint i;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xxa{sv})"));
+	for (i = 0; i < n_records; i++) {
+		g_variant_builder_init (&details, G_VARIANT_TYPE ("a{sv}"));
+		if (records[i].type != NULL)
+			g_variant_builder_add (&details, "{sv}", "type",
+			                       g_variant_new_string (records[i].type));
+		g_variant_builder_add (&builder, "(xxa{sv})",
+		                       records[i].login_time, records[i].logout_time,
+		                       &details);
+	}
+
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static gboolean
+is_session (const Record *record)
+{
+	return record->type != NULL &&
+	       (g_str_has_prefix (record->type, ":") || g_str_has_prefix (record->type, "tty"));
+}
+
+/* The previous show_week(), on records sorted by login time */
+static GArray *
+get_reference_events (const Record *records, guint n_records, gint64 from, gint64 to)
+{
+	UmLoginEvent event;
+	GArray *events;
+	gint i;
+
+	events = g_array_new (FALSE, FALSE, sizeof (UmLoginEvent));
+
+	for (i = n_records - 1; i >= 0; i--) {
+		if (records[i].login_time < to)
+			break;
+	}
+
+	for (; i >= 0; i--) {
+		if (!is_session (&records[i]))
+			continue;
+
+		if (records[i].logout_time > 0 && records[i].logout_time < from)
+			break;
+
+		if (records[i].logout_time > 0 && records[i].logout_time < to) {
+			event.time = records[i].logout_time;
+			event.login = FALSE;
+			g_array_append_val (events, event);
+		}
+
+		if (records[i].login_time >= from) {
+			event.time = records[i].login_time;
+			event.login = TRUE;
+			g_array_append_val (events, event);
+		}
+	}
+
+	return events;
+}
+
+static void
+assert_same_events (const Record *records, guint n_records, gint64 from, gint64 to)
+{
+	UmLoginHistory *history;
+	GVariant *value;
+	GArray *events, *expected;
+	UmLoginEvent *a, *b;
+	guint i;
+
+	value = build_history (records, n_records);
+	history = um_login_history_new (value);
+
+	events = um_login_history_get_events (history, from, to);
+	expected = get_reference_events (records, n_records, from, to);
+
+	g_assert_cmpuint (events->len, ==, expected->len);
+	for (i = 0; i < events->len; i++) {
+		a = &g_array_index (events, UmLoginEvent, i);
+		b = &g_array_index (expected, UmLoginEvent, i);
+		g_assert_cmpint (a->time, ==, b->time);
+		g_assert_cmpint (a->login, ==, b->login);
+	}
+
+	g_array_unref (events);
+	g_array_unref (expected);
+	um_login_history_free (history);
+	g_variant_unref (value);
+}
+
+static const Record fixed[] = {
+	{ 1000,         1500,         ":0" },
+	{ 2000,         0,            "pts/1" },
+	{ 2000,         WEEK + 10,    "tty2" },
+	{ 3000,         3100,         NULL },
+	{ WEEK - 1,     WEEK,         ":0" },
+	{ WEEK,         WEEK + 5,     ":1" },
+	{ WEEK,         WEEK + 7,     ":0" },
+	{ WEEK + 100,   0,            ":0" },
+	{ 3 * WEEK,     3 * WEEK + 1, "tty1" },
+};
+
+static void
+test_fixed_weeks (void)
+{
+	gint64 from;
+
+	for (from = -WEEK; from <= 4 * WEEK; from += WEEK)
+		assert_same_events (fixed, G_N_ELEMENTS (fixed), from, from + WEEK);
+
+	/* Weeks which do not start at a record boundary */
+	for (from = -WEEK + 1; from <= 4 * WEEK; from += WEEK / 2)
+		assert_same_events (fixed, G_N_ELEMENTS (fixed), from, from + WEEK);
+
+	assert_same_events (fixed, 0, 0, WEEK);
+}
+
+#define RANDOM_HISTORIES 200
+#define RANDOM_RECORDS   64
+
+static void
+test_random_weeks (void)
+{
+	static const gchar *types[] = { ":0", "tty1", "pts/0", NULL };
+	Record records[RANDOM_RECORDS];
+	gint64 login, from;
+	guint round, n, i;
+
+	for (round = 0; round < RANDOM_HISTORIES; round++) {
+		n = g_test_rand_int_range (0, RANDOM_RECORDS + 1);
+		login = 0;
+		for (i = 0; i < n; i++) {
+			/* Ties are kept, the sort must be stable */
+			login += g_test_rand_int_range (0, WEEK);
+			records[i].login_time = login;
+			records[i].logout_time = g_test_rand_int_range (0, 4) == 0 ? 0 :
+			                         login + g_test_rand_int_range (0, 3 * WEEK);
+			records[i].type = types[g_test_rand_int_range (0, G_N_ELEMENTS (types))];
+		}
+
+		for (from = -WEEK; from <= login + WEEK; from += WEEK)
+			assert_same_events (records, n, from, from + WEEK);
+	}
+}
+
+static void
+test_count_before (void)
+{
+	static const Record records[] = {
+		{ 10, 0, ":0" },
+		{ 20, 0, ":0" },
+		{ 20, 0, "pts/0" },
+		{ 20, 0, "tty1" },
+		{ 30, 0, ":0" },
+	};
+	UmLoginHistory *history;
+	GVariant *value;
+
+	value = build_history (records, 0);
+	history = um_login_history_new (value);
+	g_assert_cmpuint (um_login_history_count_before (history, G_MININT64), ==, 0);
+	g_assert_cmpuint (um_login_history_count_before (history, G_MAXINT64), ==, 0);
+	um_login_history_free (history);
+	g_variant_unref (value);
+
+	/* The pts record is not a session, so it is not indexed */
+	value = build_history (records, G_N_ELEMENTS (records));
+	history = um_login_history_new (value);
+	g_assert_cmpuint (um_login_history_count_before (history, G_MININT64), ==, 0);
+	g_assert_cmpuint (um_login_history_count_before (history, 10), ==, 0);
+	g_assert_cmpuint (um_login_history_count_before (history, 11), ==, 1);
+	g_assert_cmpuint (um_login_history_count_before (history, 20), ==, 1);
+	g_assert_cmpuint (um_login_history_count_before (history, 21), ==, 3);
+	g_assert_cmpuint (um_login_history_count_before (history, 30), ==, 3);
+	g_assert_cmpuint (um_login_history_count_before (history, G_MAXINT64), ==, 4);
+	um_login_history_free (history);
+	g_variant_unref (value);
+}
+
+static void
+test_start (void)
+{
+	static const Record records[] = {
+		{ 500, 600, ":0" },
+		{ 300, 400, "pts/0" },
+		{ 700, 0,   "tty1" },
+		{ 400, 450, ":0" },
+	};
+	UmLoginHistory *history;
+	GVariant *value;
+
+	value = build_history (records, 0);
+	history = um_login_history_new (value);
+	g_assert_cmpint (um_login_history_get_start (history), ==, G_MAXINT64);
+	um_login_history_free (history);
+	g_variant_unref (value);
+
+	/* The first record of any type, wherever it is */
+	value = build_history (records, G_N_ELEMENTS (records));
+	history = um_login_history_new (value);
+	g_assert_cmpint (um_login_history_get_start (history), ==, 300);
+	g_assert (um_login_history_get_source (history) == value);
+	um_login_history_free (history);
+	g_variant_unref (value);
+}
+
+static void
+assert_week_start (GTimeZone *tz, gint day, gint hour)
+{
+	GDateTime *date, *start;
+
+	date = g_date_time_new (tz, 2021, 3, day, hour, 30, 15);
+	start = um_login_history_week_start (date);
+
+	g_assert_cmpint (g_date_time_get_year (start), ==, 2021);
+	g_assert_cmpint (g_date_time_get_month (start), ==, 3);
+	g_assert_cmpint (g_date_time_get_day_of_month (start), ==, 22);
+	g_assert_cmpint (g_date_time_get_day_of_week (start), ==, 1);
+	g_assert_cmpint (g_date_time_get_hour (start), ==, 0);
+	g_assert_cmpint (g_date_time_get_minute (start), ==, 0);
+	g_assert_cmpint (g_date_time_get_second (start), ==, 0);
+	g_assert_cmpint (g_date_time_get_utc_offset (start), ==,
+	                 g_date_time_get_utc_offset (date));
+
+	g_date_time_unref (start);
+	g_date_time_unref (date);
+}
+
+static void
+test_week_start (void)
+{
+	GTimeZone *tz;
+
+	/* From Monday 22nd to Sunday 28th of March 2021 */
+	tz = g_time_zone_new_utc ();
+	assert_week_start (tz, 22, 0);
+	assert_week_start (tz, 24, 12);
+	assert_week_start (tz, 28, 23);
+	g_time_zone_unref (tz);
+
+	tz = g_time_zone_new ("+05:30");
+	assert_week_start (tz, 22, 0);
+	assert_week_start (tz, 28, 23);
+	g_time_zone_unref (tz);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/login-history/fixed-weeks", test_fixed_weeks);
+	g_test_add_func ("/login-history/random-weeks", test_random_weeks);
+	g_test_add_func ("/login-history/count-before", test_count_before);
+	g_test_add_func ("/login-history/start", test_start);
+	g_test_add_func ("/login-history/week-start", test_week_start);
+
+	return g_test_run ();
+}
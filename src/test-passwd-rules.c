@@ -0,0 +1,212 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "passwd-matcher.h"
+#include "passwd-rules.h"
+
+/* Checks the built-in rules of run-passwd.c against what passwd prints.
+ * Run with `make check`. */
+
+static PasswdMatcher *matcher = NULL;
+
+/* Words the original matcher of run-passwd.c waited for after the
+ * retyped password, each must end the password change. */
+static const gchar *retype_vocabulary[] = {
+	"successfully", "short", "longer", "palindrome", "dictionary",
+	"simple", "simplistic", "similar", "case", "different", "wrapped",
+	"recovered", "recent", "unchanged", "match", "1 numeric or special",
+	"failure", "DIFFERENT", "BAD PASSWORD",
+};
+
+typedef struct {
+	const gchar     *output;
+	PasswdMatchKind  kind;
+	PasswdError      error;         /* For PASSWD_MATCH_ERROR */
+	gboolean         has_message;   /* FALSE if passwd output is shown */
+} Sample;
+
+static const Sample retype_samples[] = {
+	{ "passwd: password updated successfully\n", PASSWD_MATCH_SUCCESS, 0, FALSE },
+	{ "BAD PASSWORD: The password is shorter than 8 characters\n",
+	  PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED, TRUE },
+	{ "BAD PASSWORD: The password fails the dictionary check - it is based on a dictionary word\n",
+	  PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED, TRUE },
+	{ "BAD PASSWORD: The password contains less than 1 digits\n",
+	  PASSWD_MATCH_ERROR, PASSWD_ERROR_UNKNOWN, FALSE },
+	{ "You must choose a longer password\n",
+	  PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED, TRUE },
+	{ "Password unchanged\n",
+	  PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED, TRUE },
+	{ "passwd: Authentication information cannot be recovered\n",
+	  PASSWD_MATCH_ERROR, PASSWD_ERROR_UNKNOWN, FALSE },
+	{ "passwd: Authentication token manipulation error\npasswd: password unchanged\n",
+	  PASSWD_MATCH_ERROR, PASSWD_ERROR_REJECTED, TRUE },
+};
+
+static PasswdMatcher *
+get_matcher (void)
+{
+	guint i;
+
+	if (matcher == NULL) {
+		matcher = passwd_matcher_new ();
+		for (i = 0; i < passwd_n_builtin_rules; i++)
+			passwd_matcher_add (matcher, passwd_builtin_rules[i].pattern);
+		passwd_matcher_compile (matcher);
+	}
+
+	return matcher;
+}
+
+/* Feeds text chunk bytes at a time, as reads from passwd would */
+static gboolean *
+feed (const gchar *text, gsize chunk)
+{
+	gboolean *matched;
+	guint state = PASSWD_MATCHER_START;
+	gsize length, offset, n;
+
+	matched = g_new0 (gboolean, passwd_n_builtin_rules);
+	length = strlen (text);
+
+	for (offset = 0; offset < length; offset += n) {
+		n = MIN (chunk, length - offset);
+		state = passwd_matcher_feed (get_matcher (), state, text + offset, n, matched);
+	}
+
+	return matched;
+}
+
+static gboolean
+has_kind (const gboolean *matched, PasswdMatchKind kind)
+{
+	guint i;
+
+	for (i = 0; i < passwd_n_builtin_rules; i++) {
+		if (matched[i] && passwd_builtin_rules[i].kind == kind)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Same priority as output_find_error() */
+static const PasswdRule *
+find_error (const gboolean *matched)
+{
+	guint i;
+
+	for (i = 0; i < passwd_n_builtin_rules; i++) {
+		if (matched[i] && passwd_builtin_rules[i].kind == PASSWD_MATCH_ERROR)
+			return &passwd_builtin_rules[i];
+	}
+
+	return NULL;
+}
+
+static void
+test_prompts (void)
+{
+	gboolean *matched;
+
+	matched = feed ("Changing password for user.\nCurrent password: ", 5);
+	g_assert_true (has_kind (matched, PASSWD_MATCH_PROMPT));
+	g_assert_false (has_kind (matched, PASSWD_MATCH_NEW));
+	g_free (matched);
+
+	matched = feed ("New password: ", 1);
+	g_assert_true (has_kind (matched, PASSWD_MATCH_PROMPT));
+	g_assert_true (has_kind (matched, PASSWD_MATCH_NEW));
+	g_free (matched);
+
+	matched = feed ("passwd: Authentication token manipulation error\n", 7);
+	g_assert_true (has_kind (matched, PASSWD_MATCH_AUTH_ERROR));
+	g_assert_false (has_kind (matched, PASSWD_MATCH_PROMPT));
+	g_free (matched);
+}
+
+static void
+test_retype_vocabulary (void)
+{
+	gboolean *matched;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (retype_vocabulary); i++) {
+		matched = feed (retype_vocabulary[i], 1);
+		if (!has_kind (matched, PASSWD_MATCH_SUCCESS) && find_error (matched) == NULL)
+			g_error ("“%s” does not end the password change", retype_vocabulary[i]);
+		g_free (matched);
+	}
+}
+
+static void
+test_retype_samples (void)
+{
+	const Sample *sample;
+	const PasswdRule *rule;
+	gboolean *matched, *whole;
+	gsize chunk;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (retype_samples); i++) {
+		sample = &retype_samples[i];
+		whole = feed (sample->output, G_MAXSIZE);
+
+		if (sample->kind == PASSWD_MATCH_SUCCESS) {
+			g_assert_true (has_kind (whole, PASSWD_MATCH_SUCCESS));
+		} else {
+			rule = find_error (whole);
+			g_assert_nonnull (rule);
+			g_assert_cmpint (rule->error, ==, sample->error);
+			g_assert_cmpint (rule->message != NULL, ==, sample->has_message);
+		}
+
+		/* Reads split anywhere must not change the outcome */
+		for (chunk = 1; chunk < 8; chunk++) {
+			matched = feed (sample->output, chunk);
+			g_assert_cmpmem (matched, passwd_n_builtin_rules * sizeof (gboolean),
+			                 whole, passwd_n_builtin_rules * sizeof (gboolean));
+			g_free (matched);
+		}
+
+		g_free (whole);
+	}
+}
+
+int
+main (int argc, char **argv)
+{
+	int status;
+
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/passwd-rules/prompts", test_prompts);
+	g_test_add_func ("/passwd-rules/retype-vocabulary", test_retype_vocabulary);
+	g_test_add_func ("/passwd-rules/retype-samples", test_retype_samples);
+
+	status = g_test_run ();
+
+	g_clear_pointer (&matcher, passwd_matcher_free);
+
+	return status;
+}
@@ -0,0 +1,350 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <locale.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "um-username-candidates.h"
+
+/* Checks um_username_candidates_get() against the algorithm it
+ * replaced, which transliterated with iconv, split the name with
+ * g_strsplit_set() and built each candidate in its own GString. Greek
+ * and Cyrillic, which the fold table handles and iconv does not, have
+ * pinned outputs instead. Run with `make check`, and with
+ * `test-username-candidates -m perf` to time both. */
+
+static const gchar *names[] = {
+	"John Doe",
+	"john",
+	"Mary-Jane Watson",
+	"Jean-Luc Picard",
+	"Jean--Paul  Sartre-",
+	"-Anne Marie",
+	"Anne- Marie-",
+	"  leading and trailing  ",
+	"A B C D E F G",
+	"O'Neil Mc.Donald Jr.",
+	"Bob 2nd",
+	"42 Answer",
+	"007",
+	"x",
+	"",
+	"   ",
+	"---",
+	"- -",
+	"under_score name",
+	"José García Márquez",
+	"Ødegård Åse",
+	"Björn Ulvæus",
+	"李小龍",
+	"Bruce 李小龍 Lee",
+	"Nguyễn Văn Đức",
+	"Trần Thị Hồng-Nhung",
+	"Seán O’Brien",
+	"Eﬁe Gräﬂ",
+	"Jean–Pierre Rampal",
+	"Kęstutis Žemaitis",
+	"Hubert Blaine Wolfeschlegelsteinhausenbergerdorff Sr. "
+	"Hubert Blaine Wolfeschlegelsteinhausenbergerdorff Sr. "
+	"Hubert Blaine Wolfeschlegelsteinhausenbergerdorff Sr. "
+	"Hubert Blaine Wolfeschlegelsteinhausenbergerdorff Sr. "
+	"Hubert Blaine Wolfeschlegelsteinhausenbergerdorff Sr.",
+};
+
+static void
+add_item (GPtrArray *items, const gchar *item)
+{
+	guint i;
+
+	if (g_ascii_isdigit (item[0]))
+		return;
+
+	for (i = 0; i < items->len; i++) {
+		if (strcmp (g_ptr_array_index (items, i), item) == 0)
+			return;
+	}
+
+	g_ptr_array_add (items, g_strdup (item));
+}
+
+/* The previous generate_username_choices(), with every name free */
+static GPtrArray *
+get_reference_candidates (const gchar *name)
+{
+	GPtrArray *result;
+	char *lc_name, *ascii_name, *stripped_name;
+	char **words1;
+	char **words2 = NULL;
+	char **w1, **w2;
+	char *c;
+	char *unicode_fallback = "?";
+	GString *first_word, *last_word;
+	GString *item0, *item1, *item2, *item3, *item4;
+	int len;
+	int nwords1, nwords2, i;
+
+	result = g_ptr_array_new_with_free_func (g_free);
+
+	ascii_name = g_convert_with_fallback (name, -1, "ASCII//TRANSLIT", "UTF-8",
+	                                      unicode_fallback, NULL, NULL, NULL);
+	if (ascii_name == NULL)
+		return result;
+
+	lc_name = g_ascii_strdown (ascii_name, -1);
+
+	stripped_name = g_strnfill (strlen (lc_name) + 1, '\0');
+	i = 0;
+	for (c = lc_name; *c; c++) {
+		if (!(g_ascii_isdigit (*c) || g_ascii_islower (*c) ||
+		    *c == ' ' || *c == '-' || *c == '_' ||
+		    *c == '?'))
+			continue;
+
+		stripped_name[i] = *c;
+		i++;
+	}
+
+	if (strlen (stripped_name) == 0) {
+		g_free (ascii_name);
+		g_free (lc_name);
+		g_free (stripped_name);
+		return result;
+	}
+
+	words1 = g_strsplit_set (stripped_name, " ", -1);
+	len = g_strv_length (words1);
+
+	item0 = g_string_sized_new (strlen (stripped_name));
+
+	g_free (ascii_name);
+	g_free (lc_name);
+	g_free (stripped_name);
+
+	item1 = g_string_new (NULL);
+	item3 = g_string_new (NULL);
+	item2 = g_string_new (NULL);
+	item4 = g_string_new (NULL);
+	first_word = g_string_new (NULL);
+	last_word = g_string_new (NULL);
+
+	nwords1 = 0;
+	nwords2 = 0;
+	for (w1 = words1; *w1; w1++) {
+		if (strlen (*w1) == 0)
+			continue;
+
+		if (strstr (*w1, unicode_fallback) != NULL)
+			continue;
+
+		nwords1++;
+
+		item0 = g_string_append (item0, *w1);
+
+		words2 = g_strsplit_set (*w1, "-", -1);
+		if (strlen (*words2) > 0)
+			last_word = g_string_set_size (last_word, 0);
+
+		for (w2 = words2; *w2; w2++) {
+			if (strlen (*w2) == 0)
+				continue;
+
+			nwords2++;
+
+			if (nwords1 == 1) {
+				item1 = g_string_append (item1, *w2);
+				first_word = g_string_append (first_word, *w2);
+			}
+			else {
+				item1 = g_string_append_unichar (item1,
+				                                 g_utf8_get_char (*w2));
+				item3 = g_string_append_unichar (item3,
+				                                 g_utf8_get_char (*w2));
+			}
+
+			if (w1 != words1 + len - 1) {
+				item2 = g_string_append_unichar (item2,
+				                                 g_utf8_get_char (*w2));
+				item4 = g_string_append_unichar (item4,
+				                                 g_utf8_get_char (*w2));
+			}
+
+			last_word = g_string_append (last_word, *w2);
+		}
+
+		g_strfreev (words2);
+	}
+
+	item2 = g_string_append (item2, last_word->str);
+	item3 = g_string_append (item3, first_word->str);
+	item4 = g_string_prepend (item4, last_word->str);
+
+	add_item (result, item0->str);
+
+	if (g_strcmp0 (item0->str, item1->str) != 0 && nwords2 > 0)
+		add_item (result, item1->str);
+
+	if (nwords2 > 1) {
+		add_item (result, item2->str);
+		add_item (result, item3->str);
+		add_item (result, item4->str);
+		add_item (result, last_word->str);
+		add_item (result, first_word->str);
+	}
+
+	g_strfreev (words1);
+	g_string_free (first_word, TRUE);
+	g_string_free (last_word, TRUE);
+	g_string_free (item0, TRUE);
+	g_string_free (item1, TRUE);
+	g_string_free (item2, TRUE);
+	g_string_free (item3, TRUE);
+	g_string_free (item4, TRUE);
+
+	return result;
+}
+
+static void
+test_same_as_reference (void)
+{
+	UmUsernameCandidates candidates;
+	GPtrArray *expected;
+	gchar *probe;
+	guint i, j;
+
+	probe = g_convert_with_fallback ("é", -1, "ASCII//TRANSLIT", "UTF-8", "?", NULL, NULL, NULL);
+	if (g_strcmp0 (probe, "e") != 0) {
+		g_free (probe);
+		g_test_skip ("iconv does not transliterate in this locale");
+		return;
+	}
+	g_free (probe);
+
+	for (i = 0; i < G_N_ELEMENTS (names); i++) {
+		expected = get_reference_candidates (names[i]);
+		um_username_candidates_get (names[i], &candidates);
+
+		if ((guint) candidates.n_items != expected->len)
+			g_error ("“%s”: %d candidates, expected %u",
+			         names[i], candidates.n_items, expected->len);
+
+		for (j = 0; j < expected->len; j++) {
+			if (strcmp (candidates.items[j], g_ptr_array_index (expected, j)) != 0)
+				g_error ("“%s”: candidate %u is “%s”, expected “%s”",
+				         names[i], j, candidates.items[j],
+				         (const gchar *) g_ptr_array_index (expected, j));
+		}
+
+		um_username_candidates_clear (&candidates);
+		g_ptr_array_unref (expected);
+	}
+}
+
+static const struct {
+	const gchar *name;
+	const gchar *candidates[UM_USERNAME_CANDIDATES_MAX + 1];
+} known[] = {
+	{ "John Doe",
+	  { "johndoe", "johnd", "jdoe", "djohn", "doej", "doe", "john" } },
+	{ "Ivan Петров",
+	  { "ivanpetrov", "ivanp", "ipetrov", "pivan", "petrovi", "petrov", "ivan" } },
+	{ "Юлия Ан-Ли",
+	  { "yuliyaan-li", "yuliyaal", "yanli", "alyuliya", "anliy", "anli", "yuliya" } },
+	{ "Αλέξανδρος Παπαδόπουλος",
+	  { "alexandrospapadopoylos", "alexandrosp", "apapadopoylos",
+	    "palexandros", "papadopoylosa", "papadopoylos", "alexandros" } },
+};
+
+static void
+test_known_candidates (void)
+{
+	UmUsernameCandidates candidates;
+	guint i;
+	gint j;
+
+	for (i = 0; i < G_N_ELEMENTS (known); i++) {
+		um_username_candidates_get (known[i].name, &candidates);
+
+		for (j = 0; known[i].candidates[j] != NULL; j++) {
+			g_assert_cmpint (j, <, candidates.n_items);
+			g_assert_cmpstr (candidates.items[j], ==, known[i].candidates[j]);
+		}
+		g_assert_cmpint (j, ==, candidates.n_items);
+
+		um_username_candidates_clear (&candidates);
+	}
+}
+
+#define PERF_ROUNDS 2000
+
+static void
+test_perf (void)
+{
+	UmUsernameCandidates candidates;
+	GPtrArray *expected;
+	GTimer *timer;
+	gdouble reference_time, time;
+	guint round, i;
+
+	timer = g_timer_new ();
+
+	for (round = 0; round < PERF_ROUNDS; round++) {
+		for (i = 0; i < G_N_ELEMENTS (names); i++) {
+			expected = get_reference_candidates (names[i]);
+			g_ptr_array_unref (expected);
+		}
+	}
+	reference_time = g_timer_elapsed (timer, NULL);
+
+	g_timer_start (timer);
+	for (round = 0; round < PERF_ROUNDS; round++) {
+		for (i = 0; i < G_N_ELEMENTS (names); i++) {
+			um_username_candidates_get (names[i], &candidates);
+			um_username_candidates_clear (&candidates);
+		}
+	}
+	time = g_timer_elapsed (timer, NULL);
+
+	g_timer_destroy (timer);
+
+	g_test_message ("Previous algorithm: %.2f µs per name",
+	                reference_time * G_USEC_PER_SEC / (PERF_ROUNDS * G_N_ELEMENTS (names)));
+	g_test_minimized_result (time * G_USEC_PER_SEC / (PERF_ROUNDS * G_N_ELEMENTS (names)),
+	                         "%.2f µs per name",
+	                         time * G_USEC_PER_SEC / (PERF_ROUNDS * G_N_ELEMENTS (names)));
+}
+
+int
+main (int argc, char **argv)
+{
+	/* ASCII//TRANSLIT depends on the locale, the reference needs one
+	 * that transliterates Latin letters */
+	if (setlocale (LC_ALL, "C.UTF-8") == NULL)
+		setlocale (LC_ALL, "");
+
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/username-candidates/same-as-reference", test_same_as_reference);
+	g_test_add_func ("/username-candidates/known", test_known_candidates);
+	if (g_test_perf ())
+		g_test_add_func ("/username-candidates/perf", test_perf);
+
+	return g_test_run ();
+}
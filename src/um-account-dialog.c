@@ -29,6 +29,7 @@
 #include "um-realm-manager.h"
 #include "um-utils.h"
 #include "pw-utils.h"
+#include "secure-memory.h"
 
 #define PASSWORD_CHECK_TIMEOUT 600
 #define DOMAIN_DEFAULT_HINT _("Should match the web address of your login provider.")
@@ -84,14 +85,19 @@ struct _UmAccountDialog {
 	gboolean             has_custom_username;
 	GtkWidget           *local_name;
 	gint                 local_name_timeout_id;
+	GCancellable        *local_choices_cancellable;
 	GtkWidget           *local_username_hint;
 	gint                 local_username_timeout_id;
+	GCancellable        *local_username_cancellable;
+	gboolean             local_username_valid;
 	GtkWidget           *account_type_standard;
 	ActUserPasswordMode  local_password_mode;
 	GtkWidget           *local_password_radio;
 	GtkWidget           *local_password;
 	GtkWidget           *local_verify;
 	gint                 local_password_timeout_id;
+	GCancellable        *local_strength_cancellable;
+	gint                 local_strength_level;
 	GtkWidget           *local_strength_indicator;
 	GtkWidget           *local_hint;
 	GtkWidget           *local_verify_hint;
@@ -265,19 +271,31 @@ local_create_user (UmAccountDialog *self)
 	                                    self);
 }
 
-static gint
-update_password_strength (UmAccountDialog *self)
+static void
+password_strength_done (GObject      *source,
+                        GAsyncResult *result,
+                        gpointer      user_data)
 {
+	UmAccountDialog *self;
 	const gchar *password;
-	const gchar *username;
 	const gchar *hint;
 	const gchar *verify;
 	gint strength_level;
+	GError *error = NULL;
 
-	password = gtk_entry_get_text (GTK_ENTRY (self->local_password));
-	username = gtk_combo_box_text_get_active_text (GTK_COMBO_BOX_TEXT (self->local_username));
+	if (!pw_strength_finish (result, NULL, &hint, &strength_level, &error)) {
+		/* A newer check replaced this one, or the dialog is gone */
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("Failed to check password strength: %s", error->message);
+		g_error_free (error);
+		return;
+	}
 
-	pw_strength (password, NULL, username, &hint, &strength_level);
+	self = UM_ACCOUNT_DIALOG (user_data);
+	g_clear_object (&self->local_strength_cancellable);
+	self->local_strength_level = strength_level;
+
+	password = gtk_entry_get_text (GTK_ENTRY (self->local_password));
 
 	gtk_label_set_label (GTK_LABEL (self->local_hint), hint);
 	gtk_level_bar_set_value (GTK_LEVEL_BAR (self->local_strength_indicator), strength_level);
@@ -295,7 +313,36 @@ update_password_strength (UmAccountDialog *self)
 		gtk_widget_set_sensitive (self->local_verify, strength_level > 1);
 	}
 
-	return strength_level;
+	dialog_validate (self);
+}
+
+static void
+cancel_password_strength (UmAccountDialog *self)
+{
+	if (self->local_strength_cancellable != NULL) {
+		g_cancellable_cancel (self->local_strength_cancellable);
+		g_clear_object (&self->local_strength_cancellable);
+	}
+}
+
+static void
+update_password_strength (UmAccountDialog *self)
+{
+	const gchar *password;
+	gchar *username;
+
+	cancel_password_strength (self);
+	self->local_strength_cancellable = g_cancellable_new ();
+
+	password = gtk_entry_get_text (GTK_ENTRY (self->local_password));
+	username = gtk_combo_box_text_get_active_text (GTK_COMBO_BOX_TEXT (self->local_username));
+
+	pw_strength_async (password, NULL, username,
+	                   self->local_strength_cancellable,
+	                   password_strength_done,
+	                   self);
+
+	g_free (username);
 }
 
 static gboolean
@@ -304,23 +351,12 @@ local_validate (UmAccountDialog *self)
 	gboolean valid_login;
 	gboolean valid_name;
 	gboolean valid_password;
-	GtkWidget *entry;
 	const gchar *name;
 	const gchar *password;
 	const gchar *verify;
-	gchar *tip;
-	gint strength;
 
-	name = gtk_combo_box_text_get_active_text (GTK_COMBO_BOX_TEXT (self->local_username));
-	valid_login = is_valid_username (name, &tip);
-
-	entry = gtk_bin_get_child (GTK_BIN (self->local_username));
-	gtk_label_set_label (GTK_LABEL (self->local_username_hint), tip);
-	g_free (tip);
-
-	if (valid_login) {
-		set_entry_validation_checkmark (GTK_ENTRY (entry));
-	}
+	/* Updated by local_username_check_done() */
+	valid_login = self->local_username_valid;
 
 	name = gtk_entry_get_text (GTK_ENTRY (self->local_name));
 	valid_name = is_valid_name (name);
@@ -331,8 +367,9 @@ local_validate (UmAccountDialog *self)
 	password = gtk_entry_get_text (GTK_ENTRY (self->local_password));
 	verify = gtk_entry_get_text (GTK_ENTRY (self->local_verify));
 	if (self->local_password_mode == ACT_USER_PASSWORD_MODE_REGULAR) {
-		strength = update_password_strength (self);
-		valid_password = strength > 1 && strcmp (password, verify) == 0;
+		/* Updated by password_strength_done() */
+		valid_password = self->local_strength_level > 1 &&
+		                 strcmp (password, verify) == 0;
 	} else {
 		valid_password = TRUE;
 	}
@@ -340,12 +377,75 @@ local_validate (UmAccountDialog *self)
 	return valid_name && valid_login && valid_password;
 }
 
+static void
+local_username_check_done (GObject      *source,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+	UmAccountDialog *self;
+	GtkWidget *entry;
+	GError *error = NULL;
+	gchar *tip = NULL;
+	gboolean valid;
+
+	valid = is_valid_username_finish (result, &tip, &error);
+	if (error != NULL) {
+		/* A newer check replaced this one, or the dialog is gone */
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("Failed to check username: %s", error->message);
+		g_error_free (error);
+		return;
+	}
+
+	self = UM_ACCOUNT_DIALOG (user_data);
+	g_clear_object (&self->local_username_cancellable);
+
+	gtk_label_set_label (GTK_LABEL (self->local_username_hint), tip);
+	g_free (tip);
+
+	self->local_username_valid = valid;
+	if (valid) {
+		entry = gtk_bin_get_child (GTK_BIN (self->local_username));
+		set_entry_validation_checkmark (GTK_ENTRY (entry));
+	}
+
+	dialog_validate (self);
+}
+
+static void
+local_username_cancel_check (UmAccountDialog *self)
+{
+	if (self->local_username_cancellable != NULL) {
+		g_cancellable_cancel (self->local_username_cancellable);
+		g_clear_object (&self->local_username_cancellable);
+	}
+}
+
+static void
+local_username_check (UmAccountDialog *self)
+{
+	gchar *username;
+
+	local_username_cancel_check (self);
+	self->local_username_cancellable = g_cancellable_new ();
+
+	username = gtk_combo_box_text_get_active_text (GTK_COMBO_BOX_TEXT (self->local_username));
+	is_valid_username_async (username,
+	                         self->local_username_cancellable,
+	                         local_username_check_done,
+	                         self);
+	g_free (username);
+}
+
 static gboolean
 local_username_timeout (UmAccountDialog *self)
 {
 	self->local_username_timeout_id = 0;
 
-	dialog_validate (self);
+	local_username_check (self);
+
+	/* The password is rated against the username too */
+	update_password_strength (self);
 
 	return FALSE;
 }
@@ -388,6 +488,10 @@ on_username_changed (GtkComboBoxText *combo,
 		self->local_username_timeout_id = 0;
 	}
 
+	/* Any check still running is about an older username */
+	local_username_cancel_check (self);
+	self->local_username_valid = FALSE;
+
 	clear_entry_validation_error (GTK_ENTRY (entry));
 	gtk_dialog_set_response_sensitive (GTK_DIALOG (self), GTK_RESPONSE_OK, FALSE);
 
@@ -421,6 +525,45 @@ on_name_focus_out (GtkEntry *entry,
 	return FALSE;
 }
 
+static void
+local_choices_done (GObject      *source,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+	UmAccountDialog *self;
+	GtkTreeModel *model;
+	GError *error = NULL;
+	gchar **choices;
+
+	choices = generate_username_choices_finish (result, &error);
+	if (choices == NULL) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("Failed to generate usernames: %s", error->message);
+		g_error_free (error);
+		return;
+	}
+
+	self = UM_ACCOUNT_DIALOG (user_data);
+	g_clear_object (&self->local_choices_cancellable);
+
+	/* Only refills the choices when they changed */
+	model = gtk_combo_box_get_model (GTK_COMBO_BOX (self->local_username));
+	set_username_choices (GTK_LIST_STORE (model), choices);
+	if (!self->has_custom_username)
+		gtk_combo_box_set_active (GTK_COMBO_BOX (self->local_username), 0);
+
+	g_strfreev (choices);
+}
+
+static void
+local_choices_cancel (UmAccountDialog *self)
+{
+	if (self->local_choices_cancellable != NULL) {
+		g_cancellable_cancel (self->local_choices_cancellable);
+		g_clear_object (&self->local_choices_cancellable);
+	}
+}
+
 static void
 on_name_changed (GtkEditable *editable,
                  gpointer     user_data)
@@ -430,17 +573,22 @@ on_name_changed (GtkEditable *editable,
 	const char *name;
 	GtkWidget *entry;
 
-	model = gtk_combo_box_get_model (GTK_COMBO_BOX (self->local_username));
-	gtk_list_store_clear (GTK_LIST_STORE (model));
+	local_choices_cancel (self);
 
 	name = gtk_entry_get_text (GTK_ENTRY (editable));
-	if ((name == NULL || strlen (name) == 0) && !self->has_custom_username) {
-		entry = gtk_bin_get_child (GTK_BIN (self->local_username));
-		gtk_entry_set_text (GTK_ENTRY (entry), "");
-	} else if (name != NULL && strlen (name) != 0) {
-		generate_username_choices (name, GTK_LIST_STORE (model));
-		if (!self->has_custom_username)
-			gtk_combo_box_set_active (GTK_COMBO_BOX (self->local_username), 0);
+	if (name == NULL || strlen (name) == 0) {
+		model = gtk_combo_box_get_model (GTK_COMBO_BOX (self->local_username));
+		gtk_list_store_clear (GTK_LIST_STORE (model));
+		if (!self->has_custom_username) {
+			entry = gtk_bin_get_child (GTK_BIN (self->local_username));
+			gtk_entry_set_text (GTK_ENTRY (entry), "");
+		}
+	} else {
+		self->local_choices_cancellable = g_cancellable_new ();
+		generate_username_choices_async (name,
+		                                 self->local_choices_cancellable,
+		                                 local_choices_done,
+		                                 self);
 	}
 
 	if (self->local_name_timeout_id != 0) {
@@ -482,13 +630,15 @@ on_generate (GtkEntry             *entry,
 	gchar *pwd;
 
 	pwd = pw_generate ();
+	if (pwd == NULL)
+		return;
 
 	gtk_entry_set_text (GTK_ENTRY (self->local_password), pwd);
 	gtk_entry_set_text (GTK_ENTRY (self->local_verify), pwd);
 	gtk_entry_set_visibility (GTK_ENTRY (self->local_password), TRUE);
 	gtk_widget_set_sensitive (self->local_verify, TRUE);
 
-	g_free (pwd);
+	secure_free (pwd);
 }
 
 static gboolean
@@ -496,6 +646,7 @@ local_password_timeout (UmAccountDialog *self)
 {
 	self->local_password_timeout_id = 0;
 
+	update_password_strength (self);
 	dialog_validate (self);
 	update_password_match (self);
 
@@ -550,6 +701,12 @@ on_password_changed (GtkEntry   *entry,
 	clear_entry_validation_error (GTK_ENTRY (self->local_verify));
 	gtk_dialog_set_response_sensitive (GTK_DIALOG (self), GTK_RESPONSE_OK, FALSE);
 
+	/* Any rating still running is about an older password */
+	if (entry == GTK_ENTRY (self->local_password)) {
+		cancel_password_strength (self);
+		self->local_strength_level = 0;
+	}
+
 	password = gtk_entry_get_text (GTK_ENTRY (self->local_password));
 	if (strlen (password) == 0) {
 		gtk_entry_set_visibility (GTK_ENTRY (self->local_password), FALSE);
@@ -583,7 +740,7 @@ local_init (UmAccountDialog *self)
 		G_CALLBACK (on_username_changed), self);
 	g_signal_connect_after (self->local_username, "focus-out-event", G_CALLBACK (on_username_focus_out), self);
 
-	g_signal_connect_swapped (self->local_username_entry, "activate", G_CALLBACK (dialog_validate), self);
+	g_signal_connect_swapped (self->local_username_entry, "activate", G_CALLBACK (local_username_check), self);
 
 	g_signal_connect (self->local_name, "changed", G_CALLBACK (on_name_changed), self);
 	g_signal_connect_after (self->local_name, "focus-out-event", G_CALLBACK (on_name_focus_out), self);
@@ -611,6 +768,7 @@ local_init (UmAccountDialog *self)
 
 	dialog_validate (self);
 	update_password_strength (self);
+	local_username_check (self);
 }
 
 static void
@@ -1624,6 +1782,10 @@ um_account_dialog_dispose (GObject *obj)
 		self->local_username_timeout_id = 0;
 	}
 
+	local_username_cancel_check (self);
+	local_choices_cancel (self);
+	cancel_password_strength (self);
+
 	if (self->enterprise_domain_timeout_id != 0) {
 		g_source_remove (self->enterprise_domain_timeout_id);
 		self->enterprise_domain_timeout_id = 0;
@@ -1687,6 +1849,9 @@ um_account_dialog_show (UmAccountDialog     *self,
 	g_clear_object (&self->permission);
 	self->permission = permission ? g_object_ref (permission) : NULL;
 
+	/* Have the dictionary ready by the time a password is typed */
+	pw_preload_dictionary ();
+
 	local_prepare (self);
 	enterprise_prepare (self);
 	mode_change (self, UM_LOCAL);
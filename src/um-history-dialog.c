@@ -33,6 +33,7 @@
 //#include "cc-util.h"
 
 #include "um-history-dialog.h"
+#include "um-login-history.h"
 #include "um-utils.h"
 
 struct _UmHistoryDialog {
@@ -43,13 +44,24 @@ struct _UmHistoryDialog {
 	GDateTime  *current_week;
 
 	ActUser    *user;
+
+	UmLoginHistory *history;
+
+	/* Rows of history-box, reused from week to week */
+	GPtrArray  *rows;
 };
 
 typedef struct {
-	gint64 login_time;
-	gint64 logout_time;
-	const gchar *type;
-} UmLoginHistory;
+	GtkWidget *row;
+	GtkWidget *event_label;
+	GtkWidget *time_label;
+} UmHistoryRow;
+
+/* Formatting state for one showing of a week */
+typedef struct {
+	GDateTime  *today;
+	GHashTable *day_labels;
+} UmDateContext;
 
 static GtkWidget *
 get_widget (UmHistoryDialog *um,
@@ -102,63 +114,86 @@ show_week_label (UmHistoryDialog *um)
 	g_free (label);
 }
 
-static void
-clear_history (UmHistoryDialog *um)
+/* Returns the row at position line, creating it the first time */
+static UmHistoryRow *
+get_history_row (UmHistoryDialog *um, guint line)
 {
+	UmHistoryRow *history_row;
 	GtkWidget *box;
-	GList *list, *it;
 
-	box = get_widget (um, "history-box");
-	list = gtk_container_get_children (GTK_CONTAINER (box));
-	for (it = list; it != NULL;  it = it->next) {
-		gtk_container_remove (GTK_CONTAINER (box), GTK_WIDGET (it->data));
+	if (line < um->rows->len)
+		return g_ptr_array_index (um->rows, line);
+
+	history_row = g_new0 (UmHistoryRow, 1);
+
+	box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 12);
+	gtk_box_set_homogeneous (GTK_BOX (box), TRUE);
+	gtk_container_set_border_width (GTK_CONTAINER (box), 6);
+
+	history_row->event_label = gtk_label_new (NULL);
+	gtk_widget_set_halign (history_row->event_label, GTK_ALIGN_START);
+	gtk_box_pack_start (GTK_BOX (box), history_row->event_label, TRUE, TRUE, 0);
+
+	history_row->time_label = gtk_label_new (NULL);
+	gtk_widget_set_halign (history_row->time_label, GTK_ALIGN_START);
+	gtk_box_pack_start (GTK_BOX (box), history_row->time_label, TRUE, TRUE, 0);
+
+	history_row->row = gtk_list_box_row_new ();
+	gtk_container_add (GTK_CONTAINER (history_row->row), box);
+	gtk_widget_show_all (history_row->row);
+
+	gtk_list_box_insert (GTK_LIST_BOX (get_widget (um, "history-box")), history_row->row, -1);
+	g_ptr_array_add (um->rows, history_row);
+
+	return history_row;
+}
+
+/* Hides the rows left over from a busier week */
+static void
+hide_history_rows (UmHistoryDialog *um, guint from_line)
+{
+	UmHistoryRow *history_row;
+	guint i;
+
+	for (i = from_line; i < um->rows->len; i++) {
+		history_row = g_ptr_array_index (um->rows, i);
+		gtk_widget_hide (history_row->row);
 	}
-	g_list_free (list);
 }
 
-static GArray *
-get_login_history (ActUser *user)
+static void
+clear_login_history (UmHistoryDialog *um)
 {
-	GArray *login_history;
-	GVariantIter *iter, *iter2;
-	GVariant *variant;
-	const GVariant *value;
-	const gchar *key;
-	UmLoginHistory history;
-
-	login_history = NULL;
-	value = act_user_get_login_history (user);
-	g_variant_get ((GVariant *) value, "a(xxa{sv})", &iter);
-	while (g_variant_iter_loop (iter, "(xxa{sv})", &history.login_time, &history.logout_time, &iter2)) {
-		while (g_variant_iter_loop (iter2, "{sv}", &key, &variant)) {
-			if (g_strcmp0 (key, "type") == 0) {
-				history.type = g_variant_get_string (variant, NULL);
-			}
-		}
+	g_clear_pointer (&um->history, um_login_history_free);
+}
 
-		if (login_history == NULL) {
-			login_history = g_array_new (FALSE, TRUE, sizeof (UmLoginHistory));
-		}
+/* Decodes the login history of the user, unless it is the one already
+ * decoded. accountsservice replaces the variant when wtmp changes, and
+ * the history keeps a reference, so comparing pointers is enough. */
+static void
+update_login_history (UmHistoryDialog *um)
+{
+	GVariant *value;
 
-		g_array_append_val (login_history, history);
-	}
+	value = (GVariant *) act_user_get_login_history (um->user);
+	if (value != NULL && um->history != NULL &&
+	    value == um_login_history_get_source (um->history))
+		return;
 
-	return login_history;
+	clear_login_history (um);
+	if (value == NULL)
+		return;
+
+	um->history = um_login_history_new (value);
 }
 
 static void
 set_sensitivity (UmHistoryDialog *um)
 {
-	GArray *login_history;
-	UmLoginHistory history;
-	gboolean sensitive = FALSE;
-
-	login_history = get_login_history (um->user);
-	if (login_history != NULL) {
-		history = g_array_index (login_history, UmLoginHistory, 0);
-		sensitive = g_date_time_to_unix (um->week) > history.login_time;
-		g_array_free (login_history, TRUE);
-	}
+	gboolean sensitive;
+
+	sensitive = um->history != NULL &&
+	            g_date_time_to_unix (um->week) > um_login_history_get_start (um->history);
 	gtk_widget_set_sensitive (get_widget (um, "previous-button"), sensitive);
 
 	sensitive = (g_date_time_compare (um->current_week, um->week) == 1);
@@ -166,12 +201,47 @@ set_sensitivity (UmHistoryDialog *um)
 }
 
 static void
-add_record (GtkWidget *box, GDateTime *datetime, gchar *record_string, gint line)
+date_context_init (UmDateContext *context)
 {
-	gchar *date, *time, *str;
-	GtkWidget *label, *row;
+	context->today = get_today_midnight ();
+	context->day_labels = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+}
+
+static void
+date_context_clear (UmDateContext *context)
+{
+	g_date_time_unref (context->today);
+	g_hash_table_destroy (context->day_labels);
+}
+
+/* Labels of a week only depend on the calendar day, so each is
+ * formatted once per showing */
+static const gchar *
+date_context_get_day_label (UmDateContext *context, GDateTime *datetime)
+{
+	gpointer day;
+	gchar *label;
+
+	day = GINT_TO_POINTER (g_date_time_get_year (datetime) * 1000 +
+	                       g_date_time_get_day_of_year (datetime));
+
+	label = g_hash_table_lookup (context->day_labels, day);
+	if (label == NULL) {
+		label = get_smart_date_relative (datetime, context->today);
+		g_hash_table_insert (context->day_labels, day, label);
+	}
+
+	return label;
+}
+
+static void
+add_record (UmHistoryDialog *um, UmDateContext *context, GDateTime *datetime, gchar *record_string, gint line)
+{
+	const gchar *date;
+	gchar *time, *str;
+	UmHistoryRow *history_row;
 
-	date = get_smart_date (datetime);
+	date = date_context_get_day_label (context, datetime);
 	/* Translators: This is a time format string in the style of "22:58".
 	 * It indicates a login time which follows a date. */
 	time = g_date_time_format (datetime, C_("login date-time", "%k:%M"));
@@ -179,88 +249,55 @@ add_record (GtkWidget *box, GDateTime *datetime, gchar *record_string, gint line
 	 * The first %s is a date, and the second %s a time. */
 	str = g_strdup_printf(C_("login date-time", "%s, %s"), date, time);
 
-	row = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 12);
-	gtk_box_set_homogeneous (GTK_BOX (row), TRUE);
-	gtk_container_set_border_width (GTK_CONTAINER (row), 6);
+	history_row = get_history_row (um, line);
+	gtk_label_set_text (GTK_LABEL (history_row->event_label), record_string);
+	gtk_label_set_text (GTK_LABEL (history_row->time_label), str);
+	gtk_widget_show (history_row->row);
 
-	label = gtk_label_new (record_string);
-	gtk_widget_set_halign (label, GTK_ALIGN_START);
-	gtk_box_pack_start (GTK_BOX (row), label, TRUE, TRUE, 0);
-
-	label = gtk_label_new (str);
-	gtk_widget_set_halign (label, GTK_ALIGN_START);
-	gtk_box_pack_start (GTK_BOX (row), label, TRUE, TRUE, 0);
 	g_free (str);
-	g_free (date);
 	g_free (time);
 	g_date_time_unref (datetime);
-
-	gtk_list_box_insert (GTK_LIST_BOX (box), row, line);
 }
 
 static void
 show_week (UmHistoryDialog *um)
 {
-	GArray *login_history;
 	GDateTime *datetime, *temp;
 	gint64 from, to;
-	gint i, line;
-	GtkWidget *box;
-	UmLoginHistory history;
+	guint i;
+	GArray *events;
+	UmLoginEvent *event;
+	UmDateContext context;
+
+	update_login_history (um);
 
 	show_week_label (um);
-	clear_history (um);
 	set_sensitivity (um);
 
-	login_history = get_login_history (um->user);
-	if (login_history == NULL) {
+	if (um->history == NULL) {
+		hide_history_rows (um, 0);
 		return;
 	}
 
-	/* Find first record for week */
 	from = g_date_time_to_unix (um->week);
 	temp = g_date_time_add_weeks (um->week, 1);
 	to = g_date_time_to_unix (temp);
 	g_date_time_unref (temp);
-	for (i = login_history->len - 1; i >= 0; i--) {
-		history = g_array_index (login_history, UmLoginHistory, i);
-		if (history.login_time < to) {
-			break;
-		}
-	}
+	events = um_login_history_get_events (um->history, from, to);
 
 	/* Add new session records */
-	box = get_widget (um, "history-box");
-	line = 0;
-	for (; i >= 0; i--) {
-		history = g_array_index (login_history, UmLoginHistory, i);
-
-		/* Display only x-session and tty records */
-		if (!g_str_has_prefix (history.type, ":") &&
-			!g_str_has_prefix (history.type, "tty")) {
-			continue;
-		}
-
-		if (history.logout_time > 0 && history.logout_time < from) {
-			break;
-		}
-
-		if (history.logout_time > 0 && history.logout_time < to) {
-			datetime = g_date_time_new_from_unix_local (history.logout_time);
-			add_record (box, datetime, _("Session Ended"), line);
-			line++;
-		}
-
-		if (history.login_time >= from) {
-			datetime = g_date_time_new_from_unix_local (history.login_time);
-			add_record (box, datetime, _("Session Started"), line);
-			line++;
-		}
+	date_context_init (&context);
+	for (i = 0; i < events->len; i++) {
+		event = &g_array_index (events, UmLoginEvent, i);
+		datetime = g_date_time_new_from_unix_local (event->time);
+		add_record (um, &context, datetime,
+		            event->login ? _("Session Started") : _("Session Ended"), i);
 	}
 
-	gtk_widget_show_all (box);
+	date_context_clear (&context);
 
-	g_array_free (login_history, TRUE);
+	hide_history_rows (um, events->len);
+	g_array_unref (events);
 }
 
 static void
@@ -316,6 +353,7 @@ um_history_dialog_set_user (UmHistoryDialog *um,
 		um->user = g_object_ref (user);
 	}
 
+	clear_login_history (um);
 	update_dialog_title (um);
 }
 
@@ -323,7 +361,7 @@ void
 um_history_dialog_show (UmHistoryDialog *um,
                         GtkWindow       *parent)
 {
-	GDateTime *temp, *local;
+	GDateTime *temp;
 	gint parent_width;
 
 	if (um->week)
@@ -332,14 +370,9 @@ um_history_dialog_show (UmHistoryDialog *um,
 		g_date_time_unref (um->current_week);
 
 	/* Set the first day of this week */
-	local = g_date_time_new_now_local ();
-	temp = g_date_time_new_local (g_date_time_get_year (local),
-	                              g_date_time_get_month (local),
-	                              g_date_time_get_day_of_month (local),
-	                              0, 0, 0);
-	um->week = g_date_time_add_days (temp, 1 - g_date_time_get_day_of_week (temp));
+	temp = g_date_time_new_now_local ();
+	um->week = um_login_history_week_start (temp);
 	um->current_week = g_date_time_ref (um->week);
-	g_date_time_unref (local);
 	g_date_time_unref (temp);
 
 	show_week (um);
@@ -372,6 +405,7 @@ um_history_dialog_new (void)
 	}
 
 	um->dialog = get_widget (um, "dialog");
+	um->rows = g_ptr_array_new_with_free_func (g_free);
 	g_signal_connect (um->dialog, "delete-event", G_CALLBACK (gtk_widget_hide_on_delete), NULL);
 
 	widget = get_widget (um, "next-button");
@@ -400,6 +434,8 @@ um_history_dialog_free (UmHistoryDialog *um)
 
 	g_clear_object (&um->user);
 	g_clear_object (&um->builder);
+	clear_login_history (um);
+	g_ptr_array_unref (um->rows);
 
 	if (um->week) {
 		g_date_time_unref (um->week);
@@ -0,0 +1,917 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <string.h>
+#include <crypt.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <gtk/gtk.h>
+#include <act/act.h>
+
+#include "um-import-dialog.h"
+#include "um-username-cache.h"
+#include "um-utils.h"
+#include "secure-memory.h"
+
+/* Creates local accounts in bulk from a CSV file, one per line:
+ *
+ *   name,username[,type[,password-mode[,password]]]
+ *
+ * The type is "standard" (the default) or "administrator", and the
+ * password mode is "set-at-login" (the default), "none" or "regular",
+ * which needs a password. Empty lines, lines starting with '#' and a
+ * first line naming the columns are ignored.
+ *
+ * Every row is validated before anything is created, and then a few
+ * accounts are created at the same time. The password mode and the
+ * password are set asynchronously too, the password being hashed in a
+ * worker thread.
+ */
+
+#define MAX_CREATIONS_IN_FLIGHT 4
+
+/* How long a created account may take to show up in the user manager */
+#define LOAD_TIMEOUT_SECONDS 30
+
+enum {
+	COL_LINE,
+	COL_NAME,
+	COL_USERNAME,
+	COL_STATUS,
+	N_COLUMNS
+};
+
+typedef enum {
+	ROW_INVALID,
+	ROW_PENDING,
+	ROW_CREATING,
+	ROW_CREATED,
+	ROW_FAILED
+} RowState;
+
+typedef struct {
+	UmImportDialog      *dialog;
+	guint                index;
+	guint                line;
+	gchar               *name;
+	gchar               *username;
+	ActUserAccountType   account_type;
+	ActUserPasswordMode  password_mode;
+	gchar               *password;      /* secure memory */
+	RowState             state;
+	gchar               *message;
+
+	ActUser             *user;
+	gulong               loaded_id;
+	guint                load_timeout_id;
+} ImportRow;
+
+struct _UmImportDialog {
+	GtkDialog     _parent_instance;
+
+	GtkWidget    *summary_label;
+	GtkWidget    *progress_bar;
+	GtkListStore *store;
+
+	GPermission  *permission;
+	GCancellable *cancellable;
+	gchar        *file_name;
+
+	GPtrArray    *rows;          /* ImportRow, in file order */
+	guint         n_pending;
+	guint         next_row;
+	guint         in_flight;
+	guint         n_done;
+	guint         n_created;
+	gint64        start_time;
+	gboolean      importing;
+};
+
+G_DEFINE_TYPE (UmImportDialog, um_import_dialog, GTK_TYPE_DIALOG);
+
+static void
+import_row_free (ImportRow *row)
+{
+	g_free (row->name);
+	g_free (row->username);
+	secure_free (row->password);
+	g_free (row->message);
+	g_clear_object (&row->user);
+	g_free (row);
+}
+
+static void
+import_row_set_state (ImportRow   *row,
+                      RowState     state,
+                      const gchar *message)
+{
+	UmImportDialog *self = row->dialog;
+	GtkTreeIter iter;
+	const gchar *status;
+
+	row->state = state;
+	if (message != NULL) {
+		g_free (row->message);
+		row->message = g_strdup (message);
+	}
+
+	switch (state) {
+	case ROW_PENDING:
+		status = _("Ready");
+		break;
+	case ROW_CREATING:
+		status = _("Creating…");
+		break;
+	case ROW_CREATED:
+		status = _("Created");
+		break;
+	default:
+		status = row->message;
+		break;
+	}
+
+	if (gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (self->store), &iter, NULL, row->index))
+		gtk_list_store_set (self->store, &iter, COL_STATUS, status, -1);
+}
+
+/* Splits a line into its comma separated fields. Fields may be quoted,
+ * with two double quotes standing for a literal one. */
+static gchar **
+parse_csv_line (const gchar *line)
+{
+	GPtrArray *fields;
+	GString *field;
+	const gchar *p;
+	gboolean quoted = FALSE;
+
+	fields = g_ptr_array_new ();
+	field = g_string_new (NULL);
+
+	for (p = line; *p != '\0'; p++) {
+		if (quoted) {
+			if (p[0] == '"' && p[1] == '"') {
+				g_string_append_c (field, '"');
+				p++;
+			}
+			else if (*p == '"') {
+				quoted = FALSE;
+			}
+			else {
+				g_string_append_c (field, *p);
+			}
+		}
+		else if (*p == '"') {
+			quoted = TRUE;
+		}
+		else if (*p == ',') {
+			g_ptr_array_add (fields, g_strstrip (g_string_free (field, FALSE)));
+			field = g_string_new (NULL);
+		}
+		else {
+			g_string_append_c (field, *p);
+		}
+	}
+
+	g_ptr_array_add (fields, g_strstrip (g_string_free (field, FALSE)));
+	g_ptr_array_add (fields, NULL);
+
+	return (gchar **) g_ptr_array_free (fields, FALSE);
+}
+
+/* Fills the row from the fields of its line. Returns an explanation
+ * when the row cannot be imported. The username itself is checked
+ * later, all rows at once. */
+static gchar *
+import_row_parse (ImportRow  *row,
+                  gchar     **fields)
+{
+	guint n_fields = g_strv_length (fields);
+	const gchar *type = n_fields > 2 ? fields[2] : "";
+	const gchar *mode = n_fields > 3 ? fields[3] : "";
+
+	if (n_fields < 2)
+		return g_strdup (_("Both a name and a username are needed."));
+
+	row->name = g_strdup (fields[0]);
+	row->username = g_strdup (fields[1]);
+
+	if (!is_valid_name (row->name))
+		return g_strdup (_("The name is empty."));
+
+	if (*type == '\0' || g_ascii_strcasecmp (type, "standard") == 0)
+		row->account_type = ACT_USER_ACCOUNT_TYPE_STANDARD;
+	else if (g_ascii_strcasecmp (type, "administrator") == 0)
+		row->account_type = ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR;
+	else
+		return g_strdup_printf (_("Unknown account type “%s”."), type);
+
+	if (*mode == '\0' || g_ascii_strcasecmp (mode, "set-at-login") == 0) {
+		row->password_mode = ACT_USER_PASSWORD_MODE_SET_AT_LOGIN;
+	}
+	else if (g_ascii_strcasecmp (mode, "none") == 0) {
+		row->password_mode = ACT_USER_PASSWORD_MODE_NONE;
+	}
+	else if (g_ascii_strcasecmp (mode, "regular") == 0) {
+		row->password_mode = ACT_USER_PASSWORD_MODE_REGULAR;
+		if (n_fields < 5 || *fields[4] == '\0')
+			return g_strdup (_("A password is needed."));
+		row->password = secure_strdup (fields[4]);
+	}
+	else {
+		return g_strdup_printf (_("Unknown password mode “%s”."), mode);
+	}
+
+	return NULL;
+}
+
+static void
+update_summary (UmImportDialog *self)
+{
+	guint n_invalid;
+	gchar *text;
+
+	n_invalid = self->rows->len - self->n_pending;
+	if (n_invalid == 0)
+		text = g_strdup_printf (ngettext ("%u account is ready to be created.",
+		                                  "%u accounts are ready to be created.",
+		                                  self->n_pending),
+		                        self->n_pending);
+	else
+		text = g_strdup_printf (ngettext ("%u of %u account can be created, see the errors below.",
+		                                  "%u of %u accounts can be created, see the errors below.",
+		                                  self->rows->len),
+		                        self->n_pending, self->rows->len);
+
+	gtk_label_set_text (GTK_LABEL (self->summary_label), text);
+	g_free (text);
+
+	gtk_dialog_set_response_sensitive (GTK_DIALOG (self), GTK_RESPONSE_OK,
+	                                   self->n_pending > 0);
+}
+
+static void
+usernames_checked (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+	UmImportDialog *self = user_data;
+	ImportRow *row;
+	GError *error = NULL;
+	gboolean *in_use;
+	gchar *tip;
+	guint i;
+
+	in_use = um_username_cache_check_many_finish (result, &error);
+	if (in_use == NULL) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("Failed to check usernames: %s", error->message);
+		g_error_free (error);
+		return;
+	}
+	g_free (in_use);
+
+	/* The usernames were all just looked up, so is_valid_username()
+	 * only has to ask the cache. */
+	for (i = 0; i < self->rows->len; i++) {
+		row = g_ptr_array_index (self->rows, i);
+		if (row->state != ROW_PENDING)
+			continue;
+
+		if (is_valid_username (row->username, &tip)) {
+			import_row_set_state (row, ROW_PENDING, NULL);
+			self->n_pending++;
+		}
+		else {
+			import_row_set_state (row, ROW_INVALID, tip);
+		}
+		g_free (tip);
+	}
+
+	update_summary (self);
+}
+
+static void
+parse_contents (UmImportDialog *self,
+                gchar          *contents)
+{
+	GHashTable *usernames;
+	GPtrArray *to_check;
+	ImportRow *row;
+	gchar **lines, **fields;
+	gchar *message;
+	guint i;
+
+	usernames = g_hash_table_new (g_str_hash, g_str_equal);
+	to_check = g_ptr_array_new ();
+
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		g_strchomp (lines[i]);
+		if (lines[i][0] == '\0' || lines[i][0] == '#')
+			continue;
+
+		fields = parse_csv_line (lines[i]);
+
+		/* A header naming the columns */
+		if (self->rows->len == 0 && g_ascii_strcasecmp (fields[0], "name") == 0) {
+			g_strfreev (fields);
+			continue;
+		}
+
+		row = g_new0 (ImportRow, 1);
+		row->dialog = self;
+		row->index = self->rows->len;
+		row->line = i + 1;
+		message = import_row_parse (row, fields);
+		g_strfreev (fields);
+
+		if (message == NULL && g_hash_table_contains (usernames, row->username))
+			message = g_strdup (_("This username is used by an earlier line."));
+
+		g_ptr_array_add (self->rows, row);
+		gtk_list_store_insert_with_values (self->store, NULL, -1,
+		                                   COL_LINE, row->line,
+		                                   COL_NAME, row->name,
+		                                   COL_USERNAME, row->username,
+		                                   -1);
+
+		if (message != NULL) {
+			import_row_set_state (row, ROW_INVALID, message);
+			g_free (message);
+			continue;
+		}
+
+		/* Marked pending until the username has been checked */
+		row->state = ROW_PENDING;
+		g_hash_table_add (usernames, row->username);
+		g_ptr_array_add (to_check, row->username);
+	}
+	g_strfreev (lines);
+
+	if (to_check->len == 0) {
+		update_summary (self);
+	}
+	else {
+		gtk_label_set_text (GTK_LABEL (self->summary_label), _("Checking usernames…"));
+		g_ptr_array_add (to_check, NULL);
+		um_username_cache_check_many_async ((const gchar * const *) to_check->pdata,
+		                                    self->cancellable,
+		                                    usernames_checked,
+		                                    self);
+	}
+
+	g_ptr_array_free (to_check, TRUE);
+	g_hash_table_destroy (usernames);
+}
+
+static void
+file_loaded (GObject      *source,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+	UmImportDialog *self = user_data;
+	GError *error = NULL;
+	gchar *contents;
+	gchar *text;
+
+	if (!g_file_load_contents_finish (G_FILE (source), result, &contents, NULL, NULL, &error)) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning ("Failed to read %s: %s", self->file_name, error->message);
+			text = g_strdup_printf (_("Failed to read %s: %s"), self->file_name, error->message);
+			gtk_label_set_text (GTK_LABEL (self->summary_label), text);
+			g_free (text);
+		}
+		g_error_free (error);
+		return;
+	}
+
+	if (!g_utf8_validate (contents, -1, NULL)) {
+		text = g_strdup_printf (_("%s is not a UTF-8 text file."), self->file_name);
+		gtk_label_set_text (GTK_LABEL (self->summary_label), text);
+		g_free (text);
+	}
+	else {
+		parse_contents (self, contents);
+	}
+
+	g_free (contents);
+}
+
+static void
+import_finished (UmImportDialog *self)
+{
+	gdouble seconds;
+	gchar *text;
+
+	self->importing = FALSE;
+	seconds = (gdouble) (g_get_monotonic_time () - self->start_time) / G_USEC_PER_SEC;
+
+	g_debug ("Imported %u of %u accounts in %.2f seconds",
+	         self->n_created, self->n_done, seconds);
+
+	text = g_strdup_printf (ngettext ("Created %u of %u account in %.1f seconds (%.1f per second).",
+	                                  "Created %u of %u accounts in %.1f seconds (%.1f per second).",
+	                                  self->n_done),
+	                        self->n_created, self->n_done, seconds,
+	                        seconds > 0 ? self->n_created / seconds : 0.0);
+	gtk_label_set_text (GTK_LABEL (self->summary_label), text);
+	g_free (text);
+
+	gtk_widget_hide (gtk_dialog_get_widget_for_response (GTK_DIALOG (self), GTK_RESPONSE_OK));
+	gtk_button_set_label (GTK_BUTTON (gtk_dialog_get_widget_for_response (GTK_DIALOG (self), GTK_RESPONSE_CANCEL)),
+	                      _("_Close"));
+}
+
+static void import_next (UmImportDialog *self);
+
+static void
+creation_done (ImportRow *row)
+{
+	UmImportDialog *self = row->dialog;
+
+	self->in_flight--;
+	self->n_done++;
+
+	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (self->progress_bar),
+	                               (gdouble) self->n_done / self->n_pending);
+
+	if (!g_cancellable_is_cancelled (self->cancellable))
+		import_next (self);
+
+	g_object_unref (self);
+}
+
+static void
+import_row_failed (ImportRow   *row,
+                   const gchar *format,
+                   GError      *error)
+{
+	gchar *message;
+
+	g_dbus_error_strip_remote_error (error);
+	message = g_strdup_printf (format, error->message);
+	g_debug ("Failed to import user %s: %s", row->username, message);
+	import_row_set_state (row, ROW_FAILED, message);
+	g_free (message);
+
+	creation_done (row);
+}
+
+static void
+password_set (GObject      *source,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+	ImportRow *row = user_data;
+	GError *error = NULL;
+
+	if (!call_user_method_finish (result, &error)) {
+		import_row_failed (row, _("The account was created, but its password could not be set: %s"), error);
+		g_error_free (error);
+		return;
+	}
+
+	row->dialog->n_created++;
+	import_row_set_state (row, ROW_CREATED, NULL);
+	creation_done (row);
+}
+
+/* Hashes the password as AccountsService expects it, with SHA-512 and
+ * a random salt */
+static void
+crypt_password_thread (GTask        *task,
+                       gpointer      source_object,
+                       gpointer      task_data,
+                       GCancellable *cancellable)
+{
+	static const gchar salt_chars[] =
+		"./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+	const gchar *password = task_data;
+	struct crypt_data *data;
+	guchar random[16];
+	gchar salt[3 + sizeof random + 2];
+	const gchar *hash;
+	guint i;
+
+	if (!secure_random (random, sizeof random)) {
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+		                         _("No random salt could be generated"));
+		return;
+	}
+
+	strcpy (salt, "$6$");
+	for (i = 0; i < sizeof random; i++)
+		salt[3 + i] = salt_chars[random[i] % 64];
+	strcpy (salt + 3 + sizeof random, "$");
+
+	/* Holds the hashing state, wiped when freed */
+	data = secure_alloc (sizeof (struct crypt_data));
+
+	hash = crypt_r (password, salt, data);
+	if (hash == NULL || hash[0] == '*')
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+		                         _("The password could not be hashed"));
+	else
+		g_task_return_pointer (task, g_strdup (hash), g_free);
+
+	secure_free (data);
+}
+
+static void
+password_crypted (GObject      *source,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+	ImportRow *row = user_data;
+	GError *error = NULL;
+	gchar *hash;
+
+	hash = g_task_propagate_pointer (G_TASK (result), &error);
+	if (hash == NULL) {
+		import_row_failed (row, _("The account was created, but its password could not be set: %s"), error);
+		g_error_free (error);
+		return;
+	}
+
+	call_user_method (row->user, "SetPassword",
+	                  g_variant_new ("(ss)", hash, ""),
+	                  row->dialog->cancellable,
+	                  password_set,
+	                  row);
+	g_free (hash);
+}
+
+static void
+password_mode_set (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+	ImportRow *row = user_data;
+	GError *error = NULL;
+	GTask *task;
+
+	if (!call_user_method_finish (result, &error)) {
+		import_row_failed (row, _("The account was created, but its password mode could not be set: %s"), error);
+		g_error_free (error);
+		return;
+	}
+
+	if (row->password_mode != ACT_USER_PASSWORD_MODE_REGULAR) {
+		row->dialog->n_created++;
+		import_row_set_state (row, ROW_CREATED, NULL);
+		creation_done (row);
+		return;
+	}
+
+	/* The row outlives the task, the dialog being referenced */
+	task = g_task_new (NULL, row->dialog->cancellable, password_crypted, row);
+	g_task_set_source_tag (task, password_mode_set);
+	g_task_set_task_data (task, row->password, NULL);
+	g_task_run_in_thread (task, crypt_password_thread);
+	g_object_unref (task);
+}
+
+static void
+stop_waiting_for_user (ImportRow *row)
+{
+	if (row->loaded_id != 0) {
+		g_signal_handler_disconnect (row->user, row->loaded_id);
+		row->loaded_id = 0;
+	}
+	if (row->load_timeout_id != 0) {
+		g_source_remove (row->load_timeout_id);
+		row->load_timeout_id = 0;
+	}
+}
+
+static void
+user_loaded_cb (ActUser    *user,
+                GParamSpec *pspec,
+                ImportRow  *row)
+{
+	stop_waiting_for_user (row);
+
+	call_user_method (user, "SetPasswordMode",
+	                  g_variant_new ("(i)", row->password_mode),
+	                  row->dialog->cancellable,
+	                  password_mode_set,
+	                  row);
+}
+
+/* Also used for every waiting row when the import is cancelled */
+static void
+give_up_on_user (ImportRow *row)
+{
+	stop_waiting_for_user (row);
+
+	g_debug ("User %s was created but never loaded", row->username);
+	import_row_set_state (row, ROW_FAILED, _("The account was created, but could not be set up."));
+	creation_done (row);
+}
+
+static gboolean
+user_load_timeout (gpointer user_data)
+{
+	ImportRow *row = user_data;
+
+	row->load_timeout_id = 0;
+	give_up_on_user (row);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+create_user_done (GObject      *source,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+	ImportRow *row = user_data;
+	ActUser *user;
+	GError *error = NULL;
+
+	/* Note that user is returned without an extra reference */
+	user = act_user_manager_create_user_finish (ACT_USER_MANAGER (source), result, &error);
+
+	if (user == NULL) {
+		g_debug ("Failed to create user %s: %s", row->username, error->message);
+		g_dbus_error_strip_remote_error (error);
+		import_row_set_state (row, ROW_FAILED, error->message);
+		g_error_free (error);
+		creation_done (row);
+		return;
+	}
+
+	row->user = g_object_ref (user);
+
+	if (act_user_is_loaded (user)) {
+		user_loaded_cb (user, NULL, row);
+	}
+	else if (g_cancellable_is_cancelled (row->dialog->cancellable)) {
+		give_up_on_user (row);
+	}
+	else {
+		row->loaded_id = g_signal_connect (user, "notify::is-loaded",
+		                                   G_CALLBACK (user_loaded_cb), row);
+		row->load_timeout_id = g_timeout_add_seconds (LOAD_TIMEOUT_SECONDS,
+		                                              user_load_timeout, row);
+	}
+}
+
+/* Keeps up to MAX_CREATIONS_IN_FLIGHT accounts being created */
+static void
+import_next (UmImportDialog *self)
+{
+	ActUserManager *manager;
+	ImportRow *row;
+
+	manager = act_user_manager_get_default ();
+
+	while (self->in_flight < MAX_CREATIONS_IN_FLIGHT && self->next_row < self->rows->len) {
+		row = g_ptr_array_index (self->rows, self->next_row++);
+		if (row->state != ROW_PENDING)
+			continue;
+
+		g_debug ("Creating local user: %s", row->username);
+
+		import_row_set_state (row, ROW_CREATING, NULL);
+		self->in_flight++;
+		act_user_manager_create_user_async (manager,
+		                                    row->username,
+		                                    row->name,
+		                                    row->account_type,
+		                                    self->cancellable,
+		                                    create_user_done,
+		                                    row);
+		g_object_ref (self);
+	}
+
+	if (self->in_flight == 0)
+		import_finished (self);
+}
+
+static void
+import_start (UmImportDialog *self)
+{
+	self->importing = TRUE;
+	self->start_time = g_get_monotonic_time ();
+
+	gtk_dialog_set_response_sensitive (GTK_DIALOG (self), GTK_RESPONSE_OK, FALSE);
+	gtk_label_set_text (GTK_LABEL (self->summary_label), _("Creating accounts…"));
+	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (self->progress_bar), 0.0);
+	gtk_widget_show (self->progress_bar);
+
+	import_next (self);
+}
+
+static void
+on_permission_acquired (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+	UmImportDialog *self = UM_IMPORT_DIALOG (user_data);
+	GError *error = NULL;
+
+	if (g_permission_acquire_finish (self->permission, res, &error)) {
+		g_return_if_fail (g_permission_get_allowed (self->permission));
+		import_start (self);
+	} else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_warning ("Failed to acquire permission: %s", error->message);
+	}
+
+	g_clear_error (&error);
+	g_object_unref (self);
+}
+
+/* Rows whose user has not loaded yet hold a reference on the dialog,
+ * they are given up on rather than waited for */
+static void
+stop_loading_users (UmImportDialog *self)
+{
+	ImportRow *row;
+	guint i;
+
+	for (i = 0; i < self->rows->len; i++) {
+		row = g_ptr_array_index (self->rows, i);
+		if (row->load_timeout_id != 0)
+			give_up_on_user (row);
+	}
+}
+
+static void
+um_import_dialog_response (GtkDialog *dialog,
+                           gint       response_id)
+{
+	UmImportDialog *self = UM_IMPORT_DIALOG (dialog);
+
+	switch (response_id) {
+		case GTK_RESPONSE_OK:
+			if (self->importing || self->n_pending == 0)
+				return;
+
+			/* We don't (or no longer) have necessary permissions */
+			if (self->permission && !g_permission_get_allowed (self->permission)) {
+				g_permission_acquire_async (self->permission,
+				                            self->cancellable,
+				                            on_permission_acquired,
+				                            g_object_ref (self));
+				return;
+			}
+
+			import_start (self);
+			break;
+		case GTK_RESPONSE_CANCEL:
+		case GTK_RESPONSE_DELETE_EVENT:
+			g_cancellable_cancel (self->cancellable);
+			stop_loading_users (self);
+			gtk_widget_destroy (GTK_WIDGET (self));
+			break;
+	}
+}
+
+static void
+um_import_dialog_init (UmImportDialog *self)
+{
+	GtkDialog *dialog = GTK_DIALOG (self);
+	GtkWidget *box, *scrolled, *treeview, *widget;
+	GtkCellRenderer *cell;
+
+	self->cancellable = g_cancellable_new ();
+	self->rows = g_ptr_array_new_with_free_func ((GDestroyNotify) import_row_free);
+	self->store = gtk_list_store_new (N_COLUMNS, G_TYPE_UINT, G_TYPE_STRING,
+	                                  G_TYPE_STRING, G_TYPE_STRING);
+
+	gtk_container_set_border_width (GTK_CONTAINER (dialog), 5);
+	gtk_window_set_title (GTK_WINDOW (dialog), _("Import Users"));
+	gtk_window_set_icon_name (GTK_WINDOW (dialog), "system-users");
+	gtk_window_set_default_size (GTK_WINDOW (dialog), 560, 420);
+
+	gtk_dialog_add_button (dialog, _("Cancel"), GTK_RESPONSE_CANCEL);
+	widget = gtk_dialog_add_button (dialog, _("_Import"), GTK_RESPONSE_OK);
+	gtk_dialog_set_default_response (dialog, GTK_RESPONSE_OK);
+	gtk_dialog_set_response_sensitive (dialog, GTK_RESPONSE_OK, FALSE);
+	gtk_widget_grab_default (widget);
+
+	box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
+	gtk_container_set_border_width (GTK_CONTAINER (box), 6);
+	gtk_box_pack_start (GTK_BOX (gtk_dialog_get_content_area (dialog)), box, TRUE, TRUE, 0);
+
+	self->summary_label = gtk_label_new (_("Reading the file…"));
+	gtk_label_set_xalign (GTK_LABEL (self->summary_label), 0.0);
+	gtk_label_set_line_wrap (GTK_LABEL (self->summary_label), TRUE);
+	gtk_box_pack_start (GTK_BOX (box), self->summary_label, FALSE, FALSE, 0);
+
+	scrolled = gtk_scrolled_window_new (NULL, NULL);
+	gtk_scrolled_window_set_shadow_type (GTK_SCROLLED_WINDOW (scrolled), GTK_SHADOW_IN);
+	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled),
+	                                GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+	gtk_box_pack_start (GTK_BOX (box), scrolled, TRUE, TRUE, 0);
+
+	treeview = gtk_tree_view_new_with_model (GTK_TREE_MODEL (self->store));
+	gtk_container_add (GTK_CONTAINER (scrolled), treeview);
+
+	cell = gtk_cell_renderer_text_new ();
+	gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview), -1,
+	                                             _("Line"), cell,
+	                                             "text", COL_LINE, NULL);
+	gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview), -1,
+	                                             _("Name"), cell,
+	                                             "text", COL_NAME, NULL);
+	gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview), -1,
+	                                             _("Username"), cell,
+	                                             "text", COL_USERNAME, NULL);
+	cell = gtk_cell_renderer_text_new ();
+	g_object_set (cell, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+	gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview), -1,
+	                                             _("Status"), cell,
+	                                             "text", COL_STATUS, NULL);
+	gtk_tree_view_column_set_expand (gtk_tree_view_get_column (GTK_TREE_VIEW (treeview), 3), TRUE);
+
+	self->progress_bar = gtk_progress_bar_new ();
+	gtk_box_pack_start (GTK_BOX (box), self->progress_bar, FALSE, FALSE, 0);
+
+	gtk_widget_show_all (box);
+	gtk_widget_hide (self->progress_bar);
+}
+
+static void
+um_import_dialog_dispose (GObject *obj)
+{
+	UmImportDialog *self = UM_IMPORT_DIALOG (obj);
+
+	if (self->cancellable)
+		g_cancellable_cancel (self->cancellable);
+
+	G_OBJECT_CLASS (um_import_dialog_parent_class)->dispose (obj);
+}
+
+static void
+um_import_dialog_finalize (GObject *obj)
+{
+	UmImportDialog *self = UM_IMPORT_DIALOG (obj);
+
+	g_clear_object (&self->cancellable);
+	g_clear_object (&self->permission);
+	g_clear_object (&self->store);
+	g_ptr_array_free (self->rows, TRUE);
+	g_free (self->file_name);
+
+	G_OBJECT_CLASS (um_import_dialog_parent_class)->finalize (obj);
+}
+
+static void
+um_import_dialog_class_init (UmImportDialogClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GtkDialogClass *dialog_class = GTK_DIALOG_CLASS (klass);
+
+	object_class->dispose = um_import_dialog_dispose;
+	object_class->finalize = um_import_dialog_finalize;
+
+	dialog_class->response = um_import_dialog_response;
+}
+
+UmImportDialog *
+um_import_dialog_new (void)
+{
+	return g_object_new (UM_TYPE_IMPORT_DIALOG, "use-header-bar", TRUE, NULL);
+}
+
+void
+um_import_dialog_show (UmImportDialog *self,
+                       GtkWindow      *parent,
+                       GPermission    *permission,
+                       GFile          *file)
+{
+	g_return_if_fail (UM_IS_IMPORT_DIALOG (self));
+	g_return_if_fail (G_IS_FILE (file));
+
+	/* Make sure not already doing an import */
+	g_return_if_fail (self->file_name == NULL);
+
+	g_clear_object (&self->permission);
+	self->permission = permission ? g_object_ref (permission) : NULL;
+	self->file_name = g_file_get_parse_name (file);
+
+	g_file_load_contents_async (file, self->cancellable, file_loaded, self);
+
+	gtk_window_set_transient_for (GTK_WINDOW (self), parent);
+	gtk_window_set_destroy_with_parent (GTK_WINDOW (self), TRUE);
+	gtk_window_present (GTK_WINDOW (self));
+}
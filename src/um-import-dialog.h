@@ -0,0 +1,36 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#ifndef __UM_IMPORT_DIALOG_H__
+#define __UM_IMPORT_DIALOG_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define UM_TYPE_IMPORT_DIALOG (um_import_dialog_get_type ())
+G_DECLARE_FINAL_TYPE (UmImportDialog, um_import_dialog, UM, IMPORT_DIALOG, GtkDialog)
+
+UmImportDialog *um_import_dialog_new  (void);
+void            um_import_dialog_show (UmImportDialog *self,
+                                       GtkWindow      *parent,
+                                       GPermission    *permission,
+                                       GFile          *file);
+
+G_END_DECLS
+
+#endif
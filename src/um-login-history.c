@@ -0,0 +1,186 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "um-login-history.h"
+
+/* The login history of a user, as accountsservice gives it, decoded
+ * once into session records sorted by login time. Weeks are found by
+ * binary search, so paging costs the records of the week shown. Kept
+ * free of GTK so that it can be checked on its own. */
+
+struct _UmLoginHistory {
+	GVariant *source;
+	GArray   *records;              /* UmLoginRecord, by login time */
+	gint64    start;                /* First login of any record */
+};
+
+static gint
+compare_login_time (gconstpointer a,
+                    gconstpointer b)
+{
+	const UmLoginRecord *ra = a;
+	const UmLoginRecord *rb = b;
+
+	return (ra->login_time > rb->login_time) - (ra->login_time < rb->login_time);
+}
+
+/* Display only x-session and tty records */
+static gboolean
+is_session_type (const gchar *type)
+{
+	return type != NULL &&
+	       (g_str_has_prefix (type, ":") || g_str_has_prefix (type, "tty"));
+}
+
+/* Decodes an a(xxa{sv}) login history, which is referenced so that
+ * callers can tell whether accountsservice replaced it since */
+UmLoginHistory *
+um_login_history_new (GVariant *value)
+{
+	UmLoginHistory *history;
+	UmLoginRecord record;
+	GVariant *details;
+	GVariantIter iter;
+	const gchar *type;
+
+	g_return_val_if_fail (value != NULL, NULL);
+
+	history = g_new0 (UmLoginHistory, 1);
+	history->source = g_variant_ref (value);
+	history->start = G_MAXINT64;
+	history->records = g_array_sized_new (FALSE, FALSE, sizeof (UmLoginRecord),
+	                                      g_variant_n_children (value));
+
+	g_variant_iter_init (&iter, value);
+	while (g_variant_iter_next (&iter, "(xx@a{sv})", &record.login_time, &record.logout_time, &details)) {
+		/* Any record counts for the first week there is to show */
+		history->start = MIN (history->start, record.login_time);
+
+		type = NULL;
+		g_variant_lookup (details, "type", "&s", &type);
+		if (is_session_type (type))
+			g_array_append_val (history->records, record);
+
+		g_variant_unref (details);
+	}
+
+	/* Stable, records logged in at the same second keep their order */
+	g_array_sort (history->records, compare_login_time);
+
+	return history;
+}
+
+void
+um_login_history_free (UmLoginHistory *history)
+{
+	if (history == NULL)
+		return;
+
+	g_variant_unref (history->source);
+	g_array_unref (history->records);
+	g_free (history);
+}
+
+GVariant *
+um_login_history_get_source (UmLoginHistory *history)
+{
+	return history->source;
+}
+
+/* G_MAXINT64 without any record */
+gint64
+um_login_history_get_start (UmLoginHistory *history)
+{
+	return history->start;
+}
+
+/* Returns the number of session records which started before time */
+guint
+um_login_history_count_before (UmLoginHistory *history,
+                               gint64          time)
+{
+	guint low, high, mid;
+
+	low = 0;
+	high = history->records->len;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (g_array_index (history->records, UmLoginRecord, mid).login_time < time)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/* Returns the UmLoginEvent between from and to, newest first: the
+ * sessions started in the week, and those ended in it */
+GArray *
+um_login_history_get_events (UmLoginHistory *history,
+                             gint64          from,
+                             gint64          to)
+{
+	UmLoginRecord *record;
+	UmLoginEvent event;
+	GArray *events;
+	gint i;
+
+	events = g_array_new (FALSE, FALSE, sizeof (UmLoginEvent));
+
+	for (i = (gint) um_login_history_count_before (history, to) - 1; i >= 0; i--) {
+		record = &g_array_index (history->records, UmLoginRecord, i);
+
+		if (record->logout_time > 0 && record->logout_time < from)
+			break;
+
+		if (record->logout_time > 0 && record->logout_time < to) {
+			event.time = record->logout_time;
+			event.login = FALSE;
+			g_array_append_val (events, event);
+		}
+
+		if (record->login_time >= from) {
+			event.time = record->login_time;
+			event.login = TRUE;
+			g_array_append_val (events, event);
+		}
+	}
+
+	return events;
+}
+
+/* Returns midnight of the Monday of the week of date, in its time zone */
+GDateTime *
+um_login_history_week_start (GDateTime *date)
+{
+	GDateTime *midnight, *start;
+
+	midnight = g_date_time_new (g_date_time_get_timezone (date),
+	                            g_date_time_get_year (date),
+	                            g_date_time_get_month (date),
+	                            g_date_time_get_day_of_month (date),
+	                            0, 0, 0);
+	start = g_date_time_add_days (midnight, 1 - g_date_time_get_day_of_week (midnight));
+	g_date_time_unref (midnight);
+
+	return start;
+}
@@ -0,0 +1,52 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#ifndef __UM_LOGIN_HISTORY_H__
+#define __UM_LOGIN_HISTORY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	gint64 login_time;
+	gint64 logout_time;             /* 0 while the session is open */
+} UmLoginRecord;
+
+typedef struct {
+	gint64   time;
+	gboolean login;                 /* Session started, or else ended */
+} UmLoginEvent;
+
+typedef struct _UmLoginHistory UmLoginHistory;
+
+UmLoginHistory *um_login_history_new          (GVariant       *value);
+void            um_login_history_free         (UmLoginHistory *history);
+
+GVariant       *um_login_history_get_source   (UmLoginHistory *history);
+gint64          um_login_history_get_start    (UmLoginHistory *history);
+guint           um_login_history_count_before (UmLoginHistory *history,
+                                               gint64          time);
+GArray         *um_login_history_get_events   (UmLoginHistory *history,
+                                               gint64          from,
+                                               gint64          to);
+
+GDateTime      *um_login_history_week_start   (GDateTime      *date);
+
+G_END_DECLS
+
+#endif
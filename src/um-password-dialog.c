@@ -34,6 +34,8 @@
 #include "um-utils.h"
 #include "run-passwd.h"
 #include "pw-utils.h"
+#include "secure-memory.h"
+#include "um-secure-entry-buffer.h"
 
 #define PASSWORD_CHECK_TIMEOUT 600
 
@@ -46,6 +48,8 @@ struct _UmPasswordDialog {
 	GtkWidget           *password_entry;
 	GtkWidget           *verify_entry;
 	gint                 password_entry_timeout_id;
+	GCancellable        *strength_cancellable;
+	gint                 strength_level;
 	GtkWidget           *strength_indicator;
 	GtkWidget           *ok_button;
 	GtkWidget           *password_hint;
@@ -62,26 +66,33 @@ struct _UmPasswordDialog {
 	PasswdHandler       *passwd_handler;
 };
 
-static gint
-update_password_strength (UmPasswordDialog *um)
+static void update_sensitivity (UmPasswordDialog *um);
+
+static void
+password_strength_done (GObject      *source,
+                        GAsyncResult *result,
+                        gpointer      user_data)
 {
+	UmPasswordDialog *um;
 	const gchar *password;
-	const gchar *old_password;
-	const gchar *username;
 	gint strength_level;
 	const gchar *hint;
 	const gchar *verify;
+	GError *error = NULL;
 
-	if (um->user == NULL) {
-		return 0;
+	if (!pw_strength_finish (result, NULL, &hint, &strength_level, &error)) {
+		/* A newer check replaced this one, or the dialog is gone */
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("Failed to check password strength: %s", error->message);
+		g_error_free (error);
+		return;
 	}
 
-	password = gtk_entry_get_text (GTK_ENTRY (um->password_entry));
-	old_password = gtk_entry_get_text (GTK_ENTRY (um->old_password_entry));
-	username = act_user_get_user_name (um->user);
+	um = user_data;
+	g_clear_object (&um->strength_cancellable);
+	um->strength_level = strength_level;
 
-	pw_strength (password, old_password, username,
-	             &hint, &strength_level);
+	password = gtk_entry_get_text (GTK_ENTRY (um->password_entry));
 
 	gtk_level_bar_set_value (GTK_LEVEL_BAR (um->strength_indicator), strength_level);
 	gtk_label_set_label (GTK_LABEL (um->password_hint), hint);
@@ -99,7 +110,75 @@ update_password_strength (UmPasswordDialog *um)
 		gtk_widget_set_sensitive (um->verify_entry, strength_level > 1);
 	}
 
-	return strength_level;
+	update_sensitivity (um);
+}
+
+static void
+cancel_password_strength (UmPasswordDialog *um)
+{
+	if (um->strength_cancellable != NULL) {
+		g_cancellable_cancel (um->strength_cancellable);
+		g_clear_object (&um->strength_cancellable);
+	}
+}
+
+static void
+update_password_strength (UmPasswordDialog *um)
+{
+	const gchar *password;
+	const gchar *old_password;
+	const gchar *username;
+
+	cancel_password_strength (um);
+
+	if (um->user == NULL) {
+		um->strength_level = 0;
+		return;
+	}
+
+	um->strength_cancellable = g_cancellable_new ();
+
+	password = gtk_entry_get_text (GTK_ENTRY (um->password_entry));
+	old_password = gtk_entry_get_text (GTK_ENTRY (um->old_password_entry));
+	username = act_user_get_user_name (um->user);
+
+	pw_strength_async (password, old_password, username,
+	                   um->strength_cancellable,
+	                   password_strength_done,
+	                   um);
+}
+
+/* The handler is only needed, and only created, once the current user
+ * types a password. It is kept while the dialog is up for that user, so
+ * a retry finds the backend it prepared after a failed attempt. */
+static PasswdHandler *
+get_passwd_handler (UmPasswordDialog *um)
+{
+	if (um->passwd_handler == NULL)
+		um->passwd_handler = passwd_init ();
+
+	return um->passwd_handler;
+}
+
+static gboolean
+destroy_passwd_handler (gpointer passwd_handler)
+{
+	passwd_destroy (passwd_handler);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* A backend left prompting is a root passwd holding a PAM conversation
+ * and the current password, it must not outlive the dialog. This may
+ * run from a callback of the handler, which still uses it afterwards,
+ * so it is destroyed once back in the main loop. */
+static void
+stop_passwd_handler (UmPasswordDialog *um)
+{
+	if (um->passwd_handler != NULL) {
+		g_idle_add (destroy_passwd_handler, um->passwd_handler);
+		um->passwd_handler = NULL;
+	}
 }
 
 static void
@@ -121,6 +200,16 @@ cancel_password_dialog (GtkButton        *button,
 	finish_password_change (um);
 }
 
+static gboolean
+dialog_delete_event (GtkWidget        *dialog,
+                     GdkEvent         *event,
+                     UmPasswordDialog *um)
+{
+	finish_password_change (um);
+
+	return TRUE;
+}
+
 static void
 dialog_closed (GtkWidget        *dialog,
                gint              response_id,
@@ -200,7 +289,7 @@ accept_password_dialog (GtkButton        *button,
 				 * use passwd directly, to preserve the audit trail
 				 * and to e.g. update the keyring password.
 				 */
-				passwd_change_password (um->passwd_handler, password,
+				passwd_change_password (get_passwd_handler (um), password,
 				                        (PasswdCallback) password_changed_cb, um);
 				gtk_widget_set_sensitive (um->dialog, FALSE);
 				display = gtk_widget_get_display (um->dialog);
@@ -232,14 +321,13 @@ update_sensitivity (UmPasswordDialog *um)
 {
 	const gchar *password, *verify;
 	gboolean can_change;
-	int strength;
 
 	password = gtk_entry_get_text (GTK_ENTRY (um->password_entry));
 	verify = gtk_entry_get_text (GTK_ENTRY (um->verify_entry));
 
 	if (um->password_mode == ACT_USER_PASSWORD_MODE_REGULAR) {
-		strength = update_password_strength (um);
-		can_change = strength > 1 && strcmp (password, verify) == 0 &&
+		/* Updated by password_strength_done() */
+		can_change = um->strength_level > 1 && strcmp (password, verify) == 0 &&
 		(um->old_password_ok || !gtk_widget_get_visible (um->old_password_entry));
 	}
 	else {
@@ -329,6 +417,12 @@ password_entry_changed (GtkEntry         *entry,
 	clear_entry_validation_error (GTK_ENTRY (um->verify_entry));
 	gtk_widget_set_sensitive (um->ok_button, FALSE);
 
+	/* Any rating still running is about an older password */
+	if (entry == GTK_ENTRY (um->password_entry)) {
+		cancel_password_strength (um);
+		um->strength_level = 0;
+	}
+
 	password = gtk_entry_get_text (GTK_ENTRY (um->password_entry));
 	if (strlen (password) == 0) {
 		gtk_entry_set_visibility (GTK_ENTRY (um->password_entry), FALSE);
@@ -374,6 +468,11 @@ auth_cb (PasswdHandler    *handler,
 {
 	if (error) {
 		um->old_password_ok = FALSE;
+
+		/* A wrong password is obvious, a stalled backend is not */
+		if (error->code == PASSWD_ERROR_TIMEOUT)
+			set_entry_validation_error (GTK_ENTRY (um->old_password_entry),
+			                            error->message);
 	}
 	else {
 		um->old_password_ok = TRUE;
@@ -388,11 +487,13 @@ old_password_entry_timeout (UmPasswordDialog *um)
 {
 	const char *text;
 
+	/* The new password is rated against the old one too */
+	update_password_strength (um);
 	update_sensitivity (um);
 
 	text = gtk_entry_get_text (GTK_ENTRY (um->old_password_entry));
 	if (!um->old_password_ok) {
-		passwd_authenticate (um->passwd_handler, text, (PasswdCallback)auth_cb, um);
+		passwd_authenticate (get_passwd_handler (um), text, (PasswdCallback)auth_cb, um);
 	}
 
 	um->old_password_entry_timeout_id = 0;
@@ -443,13 +544,26 @@ on_generate (GtkEntry             *entry,
 	gchar *pwd;
 
 	pwd = pw_generate ();
+	if (pwd == NULL)
+		return;
 
 	gtk_entry_set_text (GTK_ENTRY (um->password_entry), pwd);
 	gtk_entry_set_text (GTK_ENTRY (um->verify_entry), pwd);
 	gtk_entry_set_visibility (GTK_ENTRY (um->password_entry), TRUE);
 	gtk_widget_set_sensitive (um->verify_entry, TRUE);
 
-	g_free (pwd);
+	secure_free (pwd);
+}
+
+/* Keeps what is typed in the entry out of the regular heap */
+static void
+set_secure_buffer (GtkWidget *entry)
+{
+	GtkEntryBuffer *buffer;
+
+	buffer = um_secure_entry_buffer_new ();
+	gtk_entry_set_buffer (GTK_ENTRY (entry), buffer);
+	g_object_unref (buffer);
 }
 
 UmPasswordDialog *
@@ -483,7 +597,7 @@ um_password_dialog_new (void)
 
 	widget = (GtkWidget *) gtk_builder_get_object (builder, "dialog");
 	g_signal_connect (widget, "delete-event",
-		G_CALLBACK (gtk_widget_hide_on_delete), NULL);
+		G_CALLBACK (dialog_delete_event), um);
 	um->dialog = widget;
 
 	widget = (GtkWidget *) gtk_builder_get_object (builder, "cancel-button");
@@ -497,6 +611,7 @@ um_password_dialog_new (void)
 	um->ok_button = widget;
 
 	widget = (GtkWidget *) gtk_builder_get_object (builder, "password-entry");
+	set_secure_buffer (widget);
 	g_signal_connect (widget, "notify::text",
 		G_CALLBACK (password_entry_changed), um);
 	g_signal_connect_after (widget, "focus-out-event",
@@ -509,6 +624,7 @@ um_password_dialog_new (void)
 	g_signal_connect (widget, "icon-press", G_CALLBACK (on_generate), um);
 
 	widget = (GtkWidget *) gtk_builder_get_object (builder, "old-password-entry");
+	set_secure_buffer (widget);
 	g_signal_connect_after (widget, "focus-out-event",
 		G_CALLBACK (old_password_entry_focus_out), um);
 	g_signal_connect (widget, "notify::text",
@@ -519,6 +635,7 @@ um_password_dialog_new (void)
 	um->old_password_label = (GtkWidget *) gtk_builder_get_object (builder, "old-password-label");
 
 	widget = (GtkWidget *) gtk_builder_get_object (builder, "verify-entry");
+	set_secure_buffer (widget);
 	g_signal_connect (widget, "notify::text",
 		G_CALLBACK (password_entry_changed), um);
 	g_signal_connect_after (widget, "focus-out-event",
@@ -542,6 +659,8 @@ um_password_dialog_new (void)
 void
 um_password_dialog_free (UmPasswordDialog *um)
 {
+	cancel_password_strength (um);
+
 	gtk_widget_destroy (um->dialog);
 
 	g_clear_object (&um->user);
@@ -568,6 +687,9 @@ um_password_dialog_set_user (UmPasswordDialog *um,
 {
 	gboolean visible;
 
+	if (um->user != user)
+		stop_passwd_handler (um);
+
 	if (um->user) {
 		g_object_unref (um->user);
 		um->user = NULL;
@@ -599,11 +721,6 @@ um_password_dialog_set_user (UmPasswordDialog *um,
 			gtk_widget_hide (um->old_password_entry);
 			um->old_password_ok = TRUE;
 		}
-		if (act_user_get_uid (um->user) == getuid()) {
-			if (um->passwd_handler != NULL)
-				passwd_destroy (um->passwd_handler);
-			um->passwd_handler = passwd_init ();
-		}
 	}
 }
 
@@ -611,6 +728,9 @@ void
 um_password_dialog_show (UmPasswordDialog *um,
                          GtkWindow        *parent)
 {
+	/* Have the dictionary ready by the time a password is typed */
+	pw_preload_dictionary ();
+
 	gtk_window_set_transient_for (GTK_WINDOW (um->dialog), parent);
 	gtk_window_present (GTK_WINDOW (um->dialog));
 	if (um->old_password_ok == FALSE)
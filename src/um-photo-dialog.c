@@ -42,7 +42,6 @@
 
 #include "xings-user-accounts-common.h"
 
-#define DEFAULT_IMAGE_SIZE 512
 #define ROW_SPAN 6
 
 #define PREVIEW_IMAGE_WIDTH 96
@@ -68,6 +67,7 @@ crop_dialog_response (GtkWidget     *dialog,
                       UmPhotoDialog *um)
 {
 	GdkPixbuf *pb, *pb2;
+	GError *error = NULL;
 
 	if (response_id != GTK_RESPONSE_ACCEPT) {
 		um->crop_area = NULL;
@@ -76,15 +76,15 @@ crop_dialog_response (GtkWidget     *dialog,
 	}
 
 	pb = cc_crop_area_get_picture (CC_CROP_AREA (um->crop_area));
-	pb2 = gdk_pixbuf_scale_simple (pb,
-	                               DEFAULT_IMAGE_SIZE,
-	                               DEFAULT_IMAGE_SIZE,
-	                               GDK_INTERP_BILINEAR);
+	pb2 = crop_user_icon (pb, &error);
+	g_object_unref (pb);
 
-	set_user_icon_data (um->user, pb2);
+	if (pb2 == NULL || !set_user_icon_data (um->user, pb2, &error)) {
+		g_warning ("Failed to set the picture: %s", error->message);
+		g_error_free (error);
+	}
 
-	g_object_unref (pb2);
-	g_object_unref (pb);
+	g_clear_object (&pb2);
 
 	um->crop_area = NULL;
 	gtk_widget_destroy (dialog);
@@ -263,17 +263,18 @@ webcam_response_cb (GtkDialog     *dialog,
 {
 	if (response == GTK_RESPONSE_ACCEPT) {
 		GdkPixbuf *pb, *pb2;
+		GError *error = NULL;
 
 		g_object_get (G_OBJECT (dialog), "pixbuf", &pb, NULL);
-		pb2 = gdk_pixbuf_scale_simple (pb,
-		                               DEFAULT_IMAGE_SIZE,
-		                               DEFAULT_IMAGE_SIZE,
-		                               GDK_INTERP_BILINEAR);
+		pb2 = crop_user_icon (pb, &error);
+		g_object_unref (pb);
 
-		set_user_icon_data (um->user, pb2);
+		if (pb2 == NULL || !set_user_icon_data (um->user, pb2, &error)) {
+			g_warning ("Failed to set the picture: %s", error->message);
+			g_error_free (error);
+		}
 
-		g_object_unref (pb2);
-		g_object_unref (pb);
+		g_clear_object (&pb2);
 	}
 
 	if (response != GTK_RESPONSE_DELETE_EVENT &&
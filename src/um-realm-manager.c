@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include "um-realm-manager.h"
+#include "secure-memory.h"
 
 #include <krb5/krb5.h>
 #include <krb5.h>
@@ -602,7 +603,7 @@ typedef struct {
 	gchar *domain;
 	gchar *realm;
 	gchar *user;
-	gchar *password;
+	gchar *password;     /* In secure memory */
 } LoginClosure;
 
 static void
@@ -612,7 +613,7 @@ login_closure_free (gpointer data)
 	g_free (login->domain);
 	g_free (login->realm);
 	g_free (login->user);
-	g_free (login->password);
+	secure_free (login->password);
 	g_slice_free (LoginClosure, login);
 }
 
@@ -794,7 +795,7 @@ um_realm_login (UmRealmObject      *realm,
 	login->domain = g_strdup (um_realm_kerberos_get_domain_name (kerberos));
 	login->realm = g_strdup (um_realm_kerberos_get_realm_name (kerberos));
 	login->user = g_strdup (user);
-	login->password = g_strdup (password);
+	login->password = secure_strdup (password);
 	g_task_set_task_data (task, login, login_closure_free);
 
 	g_task_set_return_on_cancel (task, TRUE);
@@ -0,0 +1,165 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "secure-memory.h"
+#include "um-secure-entry-buffer.h"
+
+/* Entry buffer keeping its text in secure memory, for passwords. The
+ * text is moved to a bigger block as it grows, and what is deleted or
+ * left behind is wiped.
+ */
+
+#define MIN_SIZE 16
+
+struct _UmSecureEntryBuffer {
+	GtkEntryBuffer  parent_instance;
+
+	gchar          *text;
+	gsize           text_size;    /* Allocated bytes */
+	gsize           text_bytes;   /* Used bytes, without the nul */
+	guint           text_chars;
+};
+
+G_DEFINE_TYPE (UmSecureEntryBuffer, um_secure_entry_buffer, GTK_TYPE_ENTRY_BUFFER)
+
+static const gchar *
+um_secure_entry_buffer_get_text (GtkEntryBuffer *buffer,
+                                 gsize          *n_bytes)
+{
+	UmSecureEntryBuffer *self = UM_SECURE_ENTRY_BUFFER (buffer);
+
+	if (n_bytes != NULL)
+		*n_bytes = self->text_bytes;
+
+	return self->text != NULL ? self->text : "";
+}
+
+static guint
+um_secure_entry_buffer_get_length (GtkEntryBuffer *buffer)
+{
+	return UM_SECURE_ENTRY_BUFFER (buffer)->text_chars;
+}
+
+static guint
+um_secure_entry_buffer_insert_text (GtkEntryBuffer *buffer,
+                                    guint           position,
+                                    const gchar    *chars,
+                                    guint           n_chars)
+{
+	UmSecureEntryBuffer *self = UM_SECURE_ENTRY_BUFFER (buffer);
+	gsize n_bytes, at, size;
+	gchar *text;
+
+	n_bytes = g_utf8_offset_to_pointer (chars, n_chars) - chars;
+
+	if (self->text_bytes + n_bytes + 1 > self->text_size) {
+		size = MAX (self->text_size, MIN_SIZE);
+		while (self->text_bytes + n_bytes + 1 > size)
+			size *= 2;
+
+		text = secure_alloc (size);
+		if (self->text != NULL)
+			memcpy (text, self->text, self->text_bytes + 1);
+		secure_free (self->text);
+
+		self->text = text;
+		self->text_size = size;
+	}
+
+	position = MIN (position, self->text_chars);
+	at = g_utf8_offset_to_pointer (self->text, position) - self->text;
+
+	memmove (self->text + at + n_bytes, self->text + at, self->text_bytes - at);
+	memcpy (self->text + at, chars, n_bytes);
+
+	self->text_bytes += n_bytes;
+	self->text_chars += n_chars;
+	self->text[self->text_bytes] = '\0';
+
+	gtk_entry_buffer_emit_inserted_text (buffer, position, chars, n_chars);
+
+	return n_chars;
+}
+
+static guint
+um_secure_entry_buffer_delete_text (GtkEntryBuffer *buffer,
+                                    guint           position,
+                                    guint           n_chars)
+{
+	UmSecureEntryBuffer *self = UM_SECURE_ENTRY_BUFFER (buffer);
+	gsize start, end;
+
+	position = MIN (position, self->text_chars);
+	n_chars = MIN (n_chars, self->text_chars - position);
+	if (n_chars == 0)
+		return 0;
+
+	start = g_utf8_offset_to_pointer (self->text, position) - self->text;
+	end = g_utf8_offset_to_pointer (self->text, position + n_chars) - self->text;
+
+	memmove (self->text + start, self->text + end, self->text_bytes + 1 - end);
+	self->text_bytes -= end - start;
+	self->text_chars -= n_chars;
+
+	/* The tail still holds what was moved down */
+	secure_wipe (self->text + self->text_bytes + 1, end - start);
+
+	gtk_entry_buffer_emit_deleted_text (buffer, position, n_chars);
+
+	return n_chars;
+}
+
+static void
+um_secure_entry_buffer_finalize (GObject *object)
+{
+	UmSecureEntryBuffer *self = UM_SECURE_ENTRY_BUFFER (object);
+
+	secure_free (self->text);
+
+	G_OBJECT_CLASS (um_secure_entry_buffer_parent_class)->finalize (object);
+}
+
+static void
+um_secure_entry_buffer_class_init (UmSecureEntryBufferClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GtkEntryBufferClass *buffer_class = GTK_ENTRY_BUFFER_CLASS (klass);
+
+	object_class->finalize = um_secure_entry_buffer_finalize;
+
+	buffer_class->get_text = um_secure_entry_buffer_get_text;
+	buffer_class->get_length = um_secure_entry_buffer_get_length;
+	buffer_class->insert_text = um_secure_entry_buffer_insert_text;
+	buffer_class->delete_text = um_secure_entry_buffer_delete_text;
+}
+
+static void
+um_secure_entry_buffer_init (UmSecureEntryBuffer *self)
+{
+}
+
+GtkEntryBuffer *
+um_secure_entry_buffer_new (void)
+{
+	return g_object_new (UM_TYPE_SECURE_ENTRY_BUFFER, NULL);
+}
@@ -0,0 +1,32 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#ifndef __UM_SECURE_ENTRY_BUFFER_H__
+#define __UM_SECURE_ENTRY_BUFFER_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define UM_TYPE_SECURE_ENTRY_BUFFER (um_secure_entry_buffer_get_type ())
+G_DECLARE_FINAL_TYPE (UmSecureEntryBuffer, um_secure_entry_buffer, UM, SECURE_ENTRY_BUFFER, GtkEntryBuffer)
+
+GtkEntryBuffer *um_secure_entry_buffer_new (void);
+
+G_END_DECLS
+
+#endif
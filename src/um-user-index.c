@@ -0,0 +1,338 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <act/act.h>
+
+#include "um-user-index.h"
+
+/* Every user is indexed by a case folded "haystack" made of the real
+ * name, the login name and the uid, one per line. The trigrams of the
+ * haystack point back to the users containing them, so a query only
+ * has to verify the users sharing its rarest trigram.
+ */
+
+struct _UmUserIndex {
+	GHashTable *haystacks;   /* uid -> folded haystack */
+	GHashTable *trigrams;    /* trigram -> set of uids */
+
+	gchar      *query;       /* folded query, NULL when not filtering */
+	GHashTable *results;     /* set of uids matching query */
+};
+
+#define UID_KEY(uid) (GUINT_TO_POINTER ((guint) (uid)))
+
+static gchar *
+fold_text (const gchar *text)
+{
+	gchar *normalized;
+	gchar *folded;
+
+	normalized = g_utf8_normalize (text, -1, G_NORMALIZE_ALL);
+	if (normalized == NULL)
+		return NULL;
+
+	folded = g_utf8_casefold (normalized, -1);
+	g_free (normalized);
+
+	return folded;
+}
+
+static gchar *
+get_user_haystack (ActUser *user)
+{
+	GString *haystack;
+	const gchar *real_name;
+	gchar *folded;
+
+	haystack = g_string_new (NULL);
+
+	real_name = act_user_get_real_name (user);
+	if (real_name != NULL)
+		g_string_append (haystack, real_name);
+	g_string_append_c (haystack, '\n');
+	g_string_append (haystack, act_user_get_user_name (user));
+	g_string_append_printf (haystack, "\n%u", (guint) act_user_get_uid (user));
+
+	folded = fold_text (haystack->str);
+	g_string_free (haystack, TRUE);
+
+	return folded;
+}
+
+static void
+index_trigrams (UmUserIndex *index,
+                const gchar *haystack,
+                gpointer     uid_key,
+                gboolean     add)
+{
+	const gchar *p0, *p1, *p2, *p3;
+	GHashTable *uids;
+	gchar *trigram;
+
+	for (p0 = haystack; *p0 != '\0'; p0 = g_utf8_next_char (p0)) {
+		p1 = g_utf8_next_char (p0);
+		if (*p1 == '\0')
+			break;
+		p2 = g_utf8_next_char (p1);
+		if (*p2 == '\0')
+			break;
+		p3 = g_utf8_next_char (p2);
+
+		/* A query never spans two fields */
+		if (memchr (p0, '\n', p3 - p0) != NULL)
+			continue;
+
+		trigram = g_strndup (p0, p3 - p0);
+		uids = g_hash_table_lookup (index->trigrams, trigram);
+
+		if (add) {
+			if (uids == NULL) {
+				uids = g_hash_table_new (NULL, NULL);
+				g_hash_table_insert (index->trigrams, trigram, uids);
+				trigram = NULL;
+			}
+			g_hash_table_add (uids, uid_key);
+		}
+		else if (uids != NULL) {
+			g_hash_table_remove (uids, uid_key);
+			if (g_hash_table_size (uids) == 0)
+				g_hash_table_remove (index->trigrams, trigram);
+		}
+
+		g_free (trigram);
+	}
+}
+
+/* Returns the smallest set of uids that may contain the query, or
+ * NULL when the query is too short to use the trigrams and every
+ * user is a candidate. An empty set is returned when some trigram
+ * of the query is unknown.
+ */
+static GHashTable *
+get_trigram_candidates (UmUserIndex *index,
+                        const gchar *query,
+                        gboolean    *none)
+{
+	const gchar *p0, *p1, *p2, *p3;
+	GHashTable *uids, *best = NULL;
+	gchar *trigram;
+
+	*none = FALSE;
+
+	for (p0 = query; *p0 != '\0'; p0 = g_utf8_next_char (p0)) {
+		p1 = g_utf8_next_char (p0);
+		if (*p1 == '\0')
+			break;
+		p2 = g_utf8_next_char (p1);
+		if (*p2 == '\0')
+			break;
+		p3 = g_utf8_next_char (p2);
+
+		trigram = g_strndup (p0, p3 - p0);
+		uids = g_hash_table_lookup (index->trigrams, trigram);
+		g_free (trigram);
+
+		if (uids == NULL) {
+			*none = TRUE;
+			return NULL;
+		}
+
+		if (best == NULL || g_hash_table_size (uids) < g_hash_table_size (best))
+			best = uids;
+	}
+
+	return best;
+}
+
+static gboolean
+haystack_matches (UmUserIndex *index,
+                  gpointer     uid_key)
+{
+	const gchar *haystack;
+
+	haystack = g_hash_table_lookup (index->haystacks, uid_key);
+
+	return haystack != NULL && strstr (haystack, index->query) != NULL;
+}
+
+UmUserIndex *
+um_user_index_new (void)
+{
+	UmUserIndex *index;
+
+	index = g_new0 (UmUserIndex, 1);
+	index->haystacks = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+	index->trigrams = g_hash_table_new_full (g_str_hash, g_str_equal,
+	                                         g_free, (GDestroyNotify) g_hash_table_destroy);
+
+	return index;
+}
+
+void
+um_user_index_free (UmUserIndex *index)
+{
+	g_hash_table_destroy (index->haystacks);
+	g_hash_table_destroy (index->trigrams);
+	g_clear_pointer (&index->results, g_hash_table_destroy);
+	g_free (index->query);
+	g_free (index);
+}
+
+/* Adds a user to the index, or refreshes it when already indexed.
+ * Returns TRUE when the indexed text of the user changed. */
+gboolean
+um_user_index_add (UmUserIndex *index,
+                   ActUser     *user)
+{
+	gpointer uid_key;
+	const gchar *old_haystack;
+	gchar *haystack;
+
+	g_return_val_if_fail (ACT_IS_USER (user), FALSE);
+
+	uid_key = UID_KEY (act_user_get_uid (user));
+	haystack = get_user_haystack (user);
+	if (haystack == NULL)
+		return FALSE;
+
+	old_haystack = g_hash_table_lookup (index->haystacks, uid_key);
+	if (old_haystack != NULL) {
+		if (g_strcmp0 (old_haystack, haystack) == 0) {
+			g_free (haystack);
+			return FALSE;
+		}
+		index_trigrams (index, old_haystack, uid_key, FALSE);
+	}
+
+	index_trigrams (index, haystack, uid_key, TRUE);
+	g_hash_table_insert (index->haystacks, uid_key, haystack);
+
+	if (index->query != NULL) {
+		if (haystack_matches (index, uid_key))
+			g_hash_table_add (index->results, uid_key);
+		else
+			g_hash_table_remove (index->results, uid_key);
+	}
+
+	return TRUE;
+}
+
+void
+um_user_index_remove (UmUserIndex *index,
+                      ActUser     *user)
+{
+	gpointer uid_key;
+	const gchar *haystack;
+
+	g_return_if_fail (ACT_IS_USER (user));
+
+	uid_key = UID_KEY (act_user_get_uid (user));
+	haystack = g_hash_table_lookup (index->haystacks, uid_key);
+	if (haystack == NULL)
+		return;
+
+	index_trigrams (index, haystack, uid_key, FALSE);
+	g_hash_table_remove (index->haystacks, uid_key);
+
+	if (index->results != NULL)
+		g_hash_table_remove (index->results, uid_key);
+}
+
+/* Sets the text to filter by. Returns TRUE when the set of matching
+ * users may have changed and the view needs to be refiltered. */
+gboolean
+um_user_index_set_query (UmUserIndex *index,
+                         const gchar *text)
+{
+	GHashTable *previous = NULL;
+	GHashTable *candidates;
+	GHashTable *results;
+	GHashTableIter iter;
+	gpointer uid_key;
+	gchar *stripped;
+	gchar *query = NULL;
+	gboolean none;
+
+	stripped = g_strstrip (g_strdup (text != NULL ? text : ""));
+	if (*stripped != '\0')
+		query = fold_text (stripped);
+	g_free (stripped);
+
+	if (g_strcmp0 (query, index->query) == 0) {
+		g_free (query);
+		return FALSE;
+	}
+
+	if (query == NULL) {
+		g_clear_pointer (&index->query, g_free);
+		g_clear_pointer (&index->results, g_hash_table_destroy);
+		return TRUE;
+	}
+
+	/* When narrowing the previous search, only its results can match */
+	previous = index->results;
+	if (index->query != NULL && strstr (query, index->query) != NULL) {
+		candidates = previous;
+		none = FALSE;
+	}
+	else {
+		candidates = get_trigram_candidates (index, query, &none);
+		if (candidates == NULL && !none)
+			candidates = index->haystacks;
+	}
+	index->results = NULL;
+
+	g_free (index->query);
+	index->query = query;
+
+	results = g_hash_table_new (NULL, NULL);
+	if (!none) {
+		g_hash_table_iter_init (&iter, candidates);
+		while (g_hash_table_iter_next (&iter, &uid_key, NULL)) {
+			if (haystack_matches (index, uid_key))
+				g_hash_table_add (results, uid_key);
+		}
+	}
+
+	if (previous != NULL)
+		g_hash_table_destroy (previous);
+	index->results = results;
+
+	return TRUE;
+}
+
+gboolean
+um_user_index_is_filtering (UmUserIndex *index)
+{
+	return index->query != NULL;
+}
+
+gboolean
+um_user_index_matches (UmUserIndex *index,
+                       ActUser     *user)
+{
+	if (index->query == NULL)
+		return TRUE;
+
+	return g_hash_table_contains (index->results,
+	                              UID_KEY (act_user_get_uid (user)));
+}
@@ -0,0 +1,44 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#ifndef __UM_USER_INDEX_H__
+#define __UM_USER_INDEX_H__
+
+#include <glib.h>
+#include <act/act.h>
+
+G_BEGIN_DECLS
+
+typedef struct _UmUserIndex UmUserIndex;
+
+UmUserIndex *um_user_index_new          (void);
+void         um_user_index_free         (UmUserIndex *index);
+
+gboolean     um_user_index_add          (UmUserIndex *index,
+                                         ActUser     *user);
+void         um_user_index_remove       (UmUserIndex *index,
+                                         ActUser     *user);
+
+gboolean     um_user_index_set_query    (UmUserIndex *index,
+                                         const gchar *text);
+gboolean     um_user_index_is_filtering (UmUserIndex *index);
+gboolean     um_user_index_matches      (UmUserIndex *index,
+                                         ActUser     *user);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,401 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <pwd.h>
+
+#include <gio/gio.h>
+
+#include "um-username-cache.h"
+
+/* Knowing if a username is taken may need a slow directory lookup
+ * through NSS (sss, LDAP...). The local passwd file is kept in a
+ * hash set, refreshed when the file changes, and every other answer
+ * is cached for a while. Lookups may be run in a worker thread. */
+
+#define PASSWD_FILE   "/etc/passwd"
+
+#define POSITIVE_TTL  (5 * 60 * G_TIME_SPAN_SECOND)
+#define NEGATIVE_TTL  (30 * G_TIME_SPAN_SECOND)
+
+typedef struct {
+	gboolean in_use;
+	gint64   expires;
+} CacheEntry;
+
+static GMutex        cache_lock;
+static GHashTable   *local_names = NULL;      /* names in PASSWD_FILE */
+static gboolean      local_names_stale = TRUE;
+static GHashTable   *lookups = NULL;          /* username -> CacheEntry */
+static GFileMonitor *passwd_monitor = NULL;
+
+static void
+passwd_changed (GFileMonitor      *monitor,
+                GFile             *file,
+                GFile             *other_file,
+                GFileMonitorEvent  event_type,
+                gpointer           data)
+{
+	g_mutex_lock (&cache_lock);
+	local_names_stale = TRUE;
+	g_hash_table_remove_all (lookups);
+	g_mutex_unlock (&cache_lock);
+}
+
+static void
+cache_init (void)
+{
+	GFile *file;
+
+	if (lookups != NULL)
+		return;
+
+	local_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	lookups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	file = g_file_new_for_path (PASSWD_FILE);
+	passwd_monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+	if (passwd_monitor != NULL)
+		g_signal_connect (passwd_monitor, "changed", G_CALLBACK (passwd_changed), NULL);
+	g_object_unref (file);
+}
+
+static void
+load_local_names (void)
+{
+	GError *error = NULL;
+	gchar *contents;
+	gchar *line, *end, *colon;
+
+	g_hash_table_remove_all (local_names);
+	local_names_stale = FALSE;
+
+	if (!g_file_get_contents (PASSWD_FILE, &contents, NULL, &error)) {
+		g_debug ("Failed to read %s: %s", PASSWD_FILE, error->message);
+		g_error_free (error);
+		return;
+	}
+
+	for (line = contents; line != NULL && *line != '\0'; line = end) {
+		end = strchr (line, '\n');
+		if (end != NULL)
+			*end++ = '\0';
+
+		/* Skip NIS compat entries, they are resolved through NSS */
+		if (*line == '+' || *line == '-')
+			continue;
+
+		colon = strchr (line, ':');
+		if (colon != NULL && colon != line)
+			g_hash_table_add (local_names, g_strndup (line, colon - line));
+	}
+
+	g_free (contents);
+}
+
+static gboolean
+lookup_locked (const gchar *username,
+               gboolean    *in_use)
+{
+	CacheEntry *entry;
+
+	cache_init ();
+
+	if (local_names_stale)
+		load_local_names ();
+
+	if (g_hash_table_contains (local_names, username)) {
+		*in_use = TRUE;
+		return TRUE;
+	}
+
+	entry = g_hash_table_lookup (lookups, username);
+	if (entry != NULL) {
+		if (entry->expires > g_get_monotonic_time ()) {
+			*in_use = entry->in_use;
+			return TRUE;
+		}
+		g_hash_table_remove (lookups, username);
+	}
+
+	return FALSE;
+}
+
+static void
+store_locked (const gchar *username,
+              gboolean     in_use)
+{
+	CacheEntry *entry;
+
+	cache_init ();
+
+	entry = g_new (CacheEntry, 1);
+	entry->in_use = in_use;
+	entry->expires = g_get_monotonic_time () + (in_use ? POSITIVE_TTL : NEGATIVE_TTL);
+
+	g_hash_table_replace (lookups, g_strdup (username), entry);
+}
+
+static gboolean
+nss_lookup (const gchar *username)
+{
+	struct passwd pwd;
+	struct passwd *result = NULL;
+	gchar *buffer;
+	glong size;
+	gint ret;
+
+	size = sysconf (_SC_GETPW_R_SIZE_MAX);
+	if (size <= 0)
+		size = 16384;
+
+	buffer = g_malloc (size);
+	while ((ret = getpwnam_r (username, &pwd, buffer, size, &result)) == ERANGE) {
+		size *= 2;
+		buffer = g_realloc (buffer, size);
+	}
+	g_free (buffer);
+
+	if (ret != 0)
+		g_debug ("Failed to look up user %s: %s", username, g_strerror (ret));
+
+	return result != NULL;
+}
+
+/* Returns TRUE and sets in_use if the answer is already known,
+ * without blocking on any directory lookup. */
+gboolean
+um_username_cache_lookup (const gchar *username,
+                          gboolean    *in_use)
+{
+	gboolean known;
+
+	if (username == NULL || username[0] == '\0') {
+		*in_use = FALSE;
+		return TRUE;
+	}
+
+	g_mutex_lock (&cache_lock);
+	known = lookup_locked (username, in_use);
+	g_mutex_unlock (&cache_lock);
+
+	return known;
+}
+
+/* Blocking version, only to be used when an answer is needed now. */
+gboolean
+um_username_cache_is_used (const gchar *username)
+{
+	gboolean in_use;
+
+	if (um_username_cache_lookup (username, &in_use))
+		return in_use;
+
+	in_use = nss_lookup (username);
+
+	g_mutex_lock (&cache_lock);
+	store_locked (username, in_use);
+	g_mutex_unlock (&cache_lock);
+
+	return in_use;
+}
+
+static void
+check_thread (GTask        *task,
+              gpointer      source_object,
+              gpointer      task_data,
+              GCancellable *cancellable)
+{
+	const gchar *username = task_data;
+	gboolean in_use;
+
+	in_use = nss_lookup (username);
+
+	g_mutex_lock (&cache_lock);
+	store_locked (username, in_use);
+	g_mutex_unlock (&cache_lock);
+
+	g_task_return_int (task, in_use);
+}
+
+void
+um_username_cache_check_async (const gchar         *username,
+                               GCancellable        *cancellable,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data)
+{
+	GTask *task;
+	gboolean in_use;
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, um_username_cache_check_async);
+
+	if (um_username_cache_lookup (username, &in_use)) {
+		g_task_return_int (task, in_use);
+		g_object_unref (task);
+		return;
+	}
+
+	/* The lookup result is cached even if the caller gives up on it */
+	g_task_set_task_data (task, g_strdup (username), g_free);
+	g_task_set_return_on_cancel (task, TRUE);
+	g_task_run_in_thread (task, check_thread);
+	g_object_unref (task);
+}
+
+gboolean
+um_username_cache_check_finish (GAsyncResult  *result,
+                                gboolean      *in_use,
+                                GError       **error)
+{
+	gssize ret;
+
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+	ret = g_task_propagate_int (G_TASK (result), error);
+	if (ret < 0)
+		return FALSE;
+
+	if (in_use != NULL)
+		*in_use = (ret != 0);
+
+	return TRUE;
+}
+
+typedef struct {
+	gboolean *in_use;
+	gint      pending;
+	gboolean  returned;
+} CheckManyData;
+
+typedef struct {
+	GTask *task;
+	gint   index;
+} CheckManyItem;
+
+static void
+check_many_data_free (CheckManyData *data)
+{
+	g_free (data->in_use);
+	g_free (data);
+}
+
+static void
+check_many_return (GTask         *task,
+                   CheckManyData *data)
+{
+	data->returned = TRUE;
+	g_task_return_pointer (task, g_steal_pointer (&data->in_use), g_free);
+}
+
+static void
+check_many_item_done (GObject      *source,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+	CheckManyItem *item = user_data;
+	CheckManyData *data = g_task_get_task_data (item->task);
+	GError *error = NULL;
+	gboolean in_use;
+
+	data->pending--;
+
+	if (!um_username_cache_check_finish (result, &in_use, &error)) {
+		if (!data->returned) {
+			data->returned = TRUE;
+			g_task_return_error (item->task, error);
+		}
+		else {
+			g_error_free (error);
+		}
+	}
+	else if (!data->returned) {
+		data->in_use[item->index] = in_use;
+		if (data->pending == 0)
+			check_many_return (item->task, data);
+	}
+
+	g_object_unref (item->task);
+	g_free (item);
+}
+
+/* Checks a batch of usernames. The cache is consulted once for all of
+ * them, and the names it does not know are looked up in parallel. */
+void
+um_username_cache_check_many_async (const gchar * const *usernames,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+	CheckManyData *data;
+	CheckManyItem *item;
+	GTask *task;
+	gboolean *known;
+	gint i, n;
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, um_username_cache_check_many_async);
+
+	n = g_strv_length ((gchar **) usernames);
+	data = g_new0 (CheckManyData, 1);
+	data->in_use = g_new0 (gboolean, n + 1);
+	g_task_set_task_data (task, data, (GDestroyNotify) check_many_data_free);
+
+	known = g_new0 (gboolean, n + 1);
+
+	g_mutex_lock (&cache_lock);
+	for (i = 0; i < n; i++) {
+		if (usernames[i][0] == '\0')
+			known[i] = TRUE;
+		else
+			known[i] = lookup_locked (usernames[i], &data->in_use[i]);
+		if (!known[i])
+			data->pending++;
+	}
+	g_mutex_unlock (&cache_lock);
+
+	if (data->pending == 0)
+		check_many_return (task, data);
+
+	for (i = 0; i < n; i++) {
+		if (known[i])
+			continue;
+
+		item = g_new (CheckManyItem, 1);
+		item->task = g_object_ref (task);
+		item->index = i;
+		um_username_cache_check_async (usernames[i], cancellable, check_many_item_done, item);
+	}
+
+	g_free (known);
+	g_object_unref (task);
+}
+
+/* Returns an array telling, for each username, if it is taken */
+gboolean *
+um_username_cache_check_many_finish (GAsyncResult  *result,
+                                     GError       **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
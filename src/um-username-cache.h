@@ -0,0 +1,46 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#ifndef __UM_USERNAME_CACHE_H__
+#define __UM_USERNAME_CACHE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+gboolean  um_username_cache_lookup            (const gchar          *username,
+                                               gboolean             *in_use);
+gboolean  um_username_cache_is_used           (const gchar          *username);
+
+void      um_username_cache_check_async       (const gchar          *username,
+                                               GCancellable         *cancellable,
+                                               GAsyncReadyCallback   callback,
+                                               gpointer              user_data);
+gboolean  um_username_cache_check_finish      (GAsyncResult         *result,
+                                               gboolean             *in_use,
+                                               GError              **error);
+
+void      um_username_cache_check_many_async  (const gchar * const  *usernames,
+                                               GCancellable         *cancellable,
+                                               GAsyncReadyCallback   callback,
+                                               gpointer              user_data);
+gboolean *um_username_cache_check_many_finish (GAsyncResult         *result,
+                                               GError              **error);
+
+G_END_DECLS
+
+#endif
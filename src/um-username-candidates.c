@@ -0,0 +1,421 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "um-username-candidates.h"
+
+/* Names are folded to ASCII with a table covering the Latin, Greek
+ * and Cyrillic blocks, built once from the Unicode decompositions
+ * plus the letters below, which do not decompose. Anything else goes
+ * through iconv's ASCII//TRANSLIT as before, which handles Vietnamese
+ * letters, ligatures and punctuation such as ’, and gives '?' for what
+ * it cannot convert. */
+#define FOLD_TABLE_START  0x00a0
+#define FOLD_TABLE_END    0x052f
+#define FOLD_MAX_LEN      4
+
+static const struct {
+	gunichar     c;
+	const gchar *ascii;
+} fold_exceptions[] = {
+	/* Latin */
+	{ 0x00df, "ss" }, { 0x00e6, "ae" }, { 0x00f0, "d" },  { 0x00f8, "o" },
+	{ 0x00fe, "th" }, { 0x0111, "d" },  { 0x0127, "h" },  { 0x0131, "i" },
+	{ 0x0138, "q" },  { 0x0142, "l" },  { 0x014b, "ng" }, { 0x0153, "oe" },
+	{ 0x0167, "t" },  { 0x0180, "b" },  { 0x0192, "f" },  { 0x01a5, "p" },
+	/* Greek */
+	{ 0x03b1, "a" },  { 0x03b2, "v" },  { 0x03b3, "g" },  { 0x03b4, "d" },
+	{ 0x03b5, "e" },  { 0x03b6, "z" },  { 0x03b7, "i" },  { 0x03b8, "th" },
+	{ 0x03b9, "i" },  { 0x03ba, "k" },  { 0x03bb, "l" },  { 0x03bc, "m" },
+	{ 0x03bd, "n" },  { 0x03be, "x" },  { 0x03bf, "o" },  { 0x03c0, "p" },
+	{ 0x03c1, "r" },  { 0x03c2, "s" },  { 0x03c3, "s" },  { 0x03c4, "t" },
+	{ 0x03c5, "y" },  { 0x03c6, "f" },  { 0x03c7, "ch" }, { 0x03c8, "ps" },
+	{ 0x03c9, "o" },
+	/* Cyrillic */
+	{ 0x0430, "a" },  { 0x0431, "b" },  { 0x0432, "v" },  { 0x0433, "g" },
+	{ 0x0434, "d" },  { 0x0435, "e" },  { 0x0436, "zh" }, { 0x0437, "z" },
+	{ 0x0438, "i" },  { 0x043a, "k" },  { 0x043b, "l" },  { 0x043c, "m" },
+	{ 0x043d, "n" },  { 0x043e, "o" },  { 0x043f, "p" },  { 0x0440, "r" },
+	{ 0x0441, "s" },  { 0x0442, "t" },  { 0x0443, "u" },  { 0x0444, "f" },
+	{ 0x0445, "kh" }, { 0x0446, "ts" }, { 0x0447, "ch" }, { 0x0448, "sh" },
+	{ 0x0449, "shch" }, { 0x044a, "" }, { 0x044b, "y" },  { 0x044c, "" },
+	{ 0x044d, "e" },  { 0x044e, "yu" }, { 0x044f, "ya" }, { 0x0452, "dj" },
+	{ 0x0454, "ye" }, { 0x0455, "dz" }, { 0x0456, "i" },  { 0x0458, "j" },
+	{ 0x0459, "lj" }, { 0x045a, "nj" }, { 0x045b, "c" },  { 0x045f, "dz" },
+	{ 0x0491, "g" },  { 0x0493, "gh" }, { 0x049b, "q" },  { 0x04a3, "ng" },
+	{ 0x04af, "u" },  { 0x04b1, "u" },  { 0x04bb, "h" },  { 0x04d9, "a" },
+	{ 0x04e9, "o" }
+};
+
+static gchar fold_table[FOLD_TABLE_END - FOLD_TABLE_START + 1][FOLD_MAX_LEN + 1];
+
+static const gchar *
+fold_exception (gunichar c)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (fold_exceptions); i++) {
+		if (fold_exceptions[i].c == c)
+			return fold_exceptions[i].ascii;
+	}
+
+	return NULL;
+}
+
+static void
+fold_table_fill (gunichar  c,
+                 gchar    *ascii)
+{
+	gunichar decomposition[G_UNICHAR_MAX_DECOMPOSITION_LENGTH];
+	const gchar *folded;
+	gchar buf[2] = { 0, 0 };
+	gsize i, n, len;
+
+	len = 0;
+	n = g_unichar_fully_decompose (g_unichar_tolower (c), TRUE,
+	                               decomposition, G_N_ELEMENTS (decomposition));
+	for (i = 0; i < n; i++) {
+		if (decomposition[i] < 0x80) {
+			buf[0] = (gchar) decomposition[i];
+			folded = buf;
+		}
+		else if (g_unichar_ismark (decomposition[i])) {
+			continue;
+		}
+		else {
+			folded = fold_exception (decomposition[i]);
+			if (folded == NULL)
+				folded = "?";
+		}
+
+		if (len + strlen (folded) > FOLD_MAX_LEN) {
+			folded = "?";
+			len = MIN (len, FOLD_MAX_LEN - 1);
+		}
+
+		strcpy (ascii + len, folded);
+		len += strlen (folded);
+	}
+}
+
+static void
+fold_table_init (void)
+{
+	static gsize initialized = 0;
+	gunichar c;
+
+	if (g_once_init_enter (&initialized)) {
+		for (c = FOLD_TABLE_START; c <= FOLD_TABLE_END; c++)
+			fold_table_fill (c, fold_table[c - FOLD_TABLE_START]);
+
+		g_once_init_leave (&initialized, 1);
+	}
+}
+
+/* One converter for the process, opened at the first character outside
+ * the table and shared under a lock. What it gives for each character
+ * is remembered, names being typed one character at a time. */
+static GMutex      translit_lock;
+static GIConv      translit = (GIConv) -1;
+static GHashTable *translit_cache = NULL;
+
+static gchar *
+translit_convert (const gchar *utf8,
+                  gsize        len)
+{
+	gchar buf[32];
+	gchar *in, *out;
+	gsize in_left, out_left;
+
+	if (translit == (GIConv) -1)
+		return g_strdup ("?");
+
+	in = (gchar *) utf8;
+	in_left = len;
+	out = buf;
+	out_left = sizeof buf;
+
+	g_iconv (translit, NULL, NULL, NULL, NULL);
+	if (g_iconv (translit, &in, &in_left, &out, &out_left) == (gsize) -1 ||
+	    g_iconv (translit, NULL, NULL, &out, &out_left) == (gsize) -1)
+		return g_strdup ("?");
+
+	return g_strndup (buf, out - buf);
+}
+
+static void
+append_transliterated (GString     *ascii,
+                       gunichar     c,
+                       const gchar *utf8)
+{
+	const gchar *folded;
+
+	g_mutex_lock (&translit_lock);
+
+	if (translit_cache == NULL) {
+		translit_cache = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+		translit = g_iconv_open ("ASCII//TRANSLIT", "UTF-8");
+	}
+
+	folded = g_hash_table_lookup (translit_cache, GUINT_TO_POINTER (c));
+	if (folded == NULL) {
+		folded = translit_convert (utf8, g_utf8_next_char (utf8) - utf8);
+		g_hash_table_insert (translit_cache, GUINT_TO_POINTER (c), (gpointer) folded);
+	}
+
+	g_string_append (ascii, folded);
+
+	g_mutex_unlock (&translit_lock);
+}
+
+gchar *
+um_username_transliterate (const gchar *name)
+{
+	GString *ascii;
+	const gchar *p;
+	gunichar c;
+
+	if (!g_utf8_validate (name, -1, NULL))
+		return NULL;
+
+	fold_table_init ();
+
+	ascii = g_string_sized_new (strlen (name));
+	for (p = name; *p != '\0'; p = g_utf8_next_char (p)) {
+		c = g_utf8_get_char (p);
+		if (c < 0x80)
+			g_string_append_c (ascii, (gchar) c);
+		else if (c >= FOLD_TABLE_START && c <= FOLD_TABLE_END)
+			g_string_append (ascii, fold_table[c - FOLD_TABLE_START]);
+		else
+			append_transliterated (ascii, c, p);
+	}
+
+	return g_string_free (ascii, FALSE);
+}
+
+typedef struct {
+	gchar *str;
+	gsize  len;
+} Slice;
+
+static void
+slice_init (Slice *slice, gchar *str)
+{
+	slice->str = str;
+	slice->str[0] = '\0';
+	slice->len = 0;
+}
+
+static void
+slice_append (Slice *slice, const gchar *text, gsize len)
+{
+	memcpy (slice->str + slice->len, text, len);
+	slice->len += len;
+	slice->str[slice->len] = '\0';
+}
+
+static void
+slice_prepend (Slice *slice, const Slice *text)
+{
+	memmove (slice->str + text->len, slice->str, slice->len + 1);
+	memcpy (slice->str, text->str, text->len);
+	slice->len += text->len;
+}
+
+static void
+username_candidates_add (UmUsernameCandidates *candidates,
+                         const gchar          *item)
+{
+	gint i;
+
+	if (g_ascii_isdigit (item[0]))
+		return;
+
+	for (i = 0; i < candidates->n_items; i++) {
+		if (strcmp (candidates->items[i], item) == 0)
+			return;
+	}
+
+	candidates->items[candidates->n_items++] = item;
+}
+
+void
+um_username_candidates_clear (UmUsernameCandidates *candidates)
+{
+	if (candidates->arena != candidates->stack)
+		g_free (candidates->arena);
+	candidates->arena = NULL;
+	candidates->n_items = 0;
+}
+
+/* Proposes usernames for a full name, in order of preference, not yet
+ * checking if they are available. All the strings live in one buffer
+ * owned by candidates, to be released with um_username_candidates_clear().
+ */
+void
+um_username_candidates_get (const gchar          *name,
+                            UmUsernameCandidates *candidates)
+{
+	gchar *ascii_name;
+	gchar *stripped, *slot;
+	Slice item0, item1, item2, item3, item4;
+	Slice first_word, last_word;
+	const gchar *w, *word_end, *p, *part_end;
+	gsize len, slot_size, needed, i, n;
+	gint nwords1, nwords2;
+	gboolean is_last;
+	gchar c;
+
+	candidates->arena = NULL;
+	candidates->n_items = 0;
+
+	ascii_name = um_username_transliterate (name);
+	if (ascii_name == NULL)
+		return;
+
+	/* Each candidate is at most as long as the stripped name, leave
+	 * twice that room so that no item can overflow its slot. */
+	len = strlen (ascii_name);
+	slot_size = 2 * len + 2;
+	needed = (len + 1) + UM_USERNAME_CANDIDATES_MAX * slot_size;
+	candidates->arena = needed <= sizeof (candidates->stack) ?
+	                    candidates->stack : g_malloc (needed);
+
+	/* Remove all non ASCII alphanumeric chars from the name,
+	 * apart from the few allowed symbols.
+	 *
+	 * We do remove '.', even though it is usually allowed,
+	 * since it often comes in via an abbreviated middle name,
+	 * and the dot looks just wrong in the proposals then.
+	 */
+	stripped = candidates->arena;
+	for (i = 0, n = 0; ascii_name[i] != '\0'; i++) {
+		c = g_ascii_tolower (ascii_name[i]);
+		if (!(g_ascii_isdigit (c) || g_ascii_islower (c) ||
+		    c == ' ' || c == '-' || c == '_' ||
+		    /* used to track invalid words, skipped below */
+		    c == '?'))
+			continue;
+
+		stripped[n++] = c;
+	}
+	stripped[n] = '\0';
+	g_free (ascii_name);
+
+	if (n == 0)
+		return;
+
+	slot = stripped + len + 1;
+	slice_init (&item0, slot); slot += slot_size;
+	slice_init (&item1, slot); slot += slot_size;
+	slice_init (&item2, slot); slot += slot_size;
+	slice_init (&item3, slot); slot += slot_size;
+	slice_init (&item4, slot); slot += slot_size;
+	slice_init (&first_word, slot); slot += slot_size;
+	slice_init (&last_word, slot);
+
+	/* The default item (item0) is a concatenation of all words.
+	 *
+	 * We split name on spaces, and then on dashes, so that we can
+	 * treat words linked with dashes the same way, i.e. both fully
+	 * shown, or both abbreviated. Then concatenate the whole first
+	 * word with the first letter of each word (item1), and the last
+	 * word with the first letter of each word (item2). item3 and item4
+	 * are symmetrical respectively to item1 and item2.
+	 */
+	nwords1 = 0;
+	nwords2 = 0;
+	for (w = stripped; ; w = word_end + 1) {
+		word_end = strchr (w, ' ');
+		if (word_end == NULL)
+			word_end = w + strlen (w);
+		is_last = (*word_end == '\0');
+
+		/* skip empty words, and words with '?', most likely
+		 * resulting from failed transliteration to ASCII
+		 */
+		if (word_end > w && memchr (w, '?', word_end - w) == NULL) {
+			nwords1++;
+			slice_append (&item0, w, word_end - w);
+
+			/* reset last word if a new non-empty word has been found */
+			if (*w != '-')
+				last_word.len = 0;
+
+			for (p = w; ; p = part_end + 1) {
+				part_end = memchr (p, '-', word_end - p);
+				if (part_end == NULL)
+					part_end = word_end;
+
+				if (part_end > p) {
+					nwords2++;
+
+					/* part of the first "toplevel" real word */
+					if (nwords1 == 1) {
+						slice_append (&item1, p, part_end - p);
+						slice_append (&first_word, p, part_end - p);
+					}
+					else {
+						slice_append (&item1, p, 1);
+						slice_append (&item3, p, 1);
+					}
+
+					/* not part of the last "toplevel" word */
+					if (!is_last) {
+						slice_append (&item2, p, 1);
+						slice_append (&item4, p, 1);
+					}
+
+					/* always save current word so that we have it if last one reveals empty */
+					slice_append (&last_word, p, part_end - p);
+				}
+
+				if (part_end == word_end)
+					break;
+			}
+		}
+
+		if (is_last)
+			break;
+	}
+
+	slice_append (&item2, last_word.str, last_word.len);
+	slice_append (&item3, first_word.str, first_word.len);
+	slice_prepend (&item4, &last_word);
+
+	username_candidates_add (candidates, item0.str);
+
+	if (nwords2 > 0)
+		username_candidates_add (candidates, item1.str);
+
+	/* if there's only one word, would be the same as item1 */
+	if (nwords2 > 1) {
+		username_candidates_add (candidates, item2.str);
+		username_candidates_add (candidates, item3.str);
+		username_candidates_add (candidates, item4.str);
+
+		/* add the last word, and then the first one */
+		username_candidates_add (candidates, last_word.str);
+		username_candidates_add (candidates, first_word.str);
+	}
+}
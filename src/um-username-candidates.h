@@ -0,0 +1,43 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#ifndef __UM_USERNAME_CANDIDATES_H__
+#define __UM_USERNAME_CANDIDATES_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* At most item0..item4, the last word and the first word */
+#define UM_USERNAME_CANDIDATES_MAX 7
+
+typedef struct {
+	gchar       *arena;
+	gchar        stack[512];
+	const gchar *items[UM_USERNAME_CANDIDATES_MAX];
+	gint         n_items;
+} UmUsernameCandidates;
+
+gchar *um_username_transliterate     (const gchar          *name);
+
+void   um_username_candidates_get    (const gchar          *name,
+                                      UmUsernameCandidates *candidates);
+void   um_username_candidates_clear  (UmUsernameCandidates *candidates);
+
+G_END_DECLS
+
+#endif
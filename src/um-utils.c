@@ -20,12 +20,13 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <limits.h>
 #include <unistd.h>
-#include <pwd.h>
 
 #include <gio/gio.h>
 #include <gio/gunixoutputstream.h>
@@ -34,9 +35,12 @@
 #include <glib/gstdio.h>
 
 #include "um-utils.h"
+#include "um-username-cache.h"
+#include "um-username-candidates.h"
 
 #define LOGGED_IN_EMBLEM_SIZE 15
 #define LOGGED_IN_EMBLEM_ICON "emblem-default"
+#define USER_ICON_SIZE 512
 
 typedef struct {
 	gchar   *text;
@@ -485,15 +489,11 @@ get_login_name_max (void)
 static gboolean
 is_username_used (const gchar *username)
 {
-	struct passwd *pwent;
-
 	if (username == NULL || username[0] == '\0') {
 		return FALSE;
 	}
 
-	pwent = getpwnam (username);
-
-	return pwent != NULL;
+	return um_username_cache_is_used (username);
 }
 
 gboolean
@@ -525,11 +525,10 @@ is_valid_name (const gchar *name)
 	return !is_empty;
 }
 
-gboolean
-is_valid_username (const gchar *username, gchar **tip)
+static gboolean
+check_username (const gchar *username, gboolean in_use, gchar **tip)
 {
 	gboolean empty;
-	gboolean in_use;
 	gboolean too_long;
 	gboolean valid;
 	const gchar *c;
@@ -540,7 +539,6 @@ is_valid_username (const gchar *username, gchar **tip)
 		too_long = FALSE;
 	} else {
 		empty = FALSE;
-		in_use = is_username_used (username);
 		too_long = strlen (username) > MAXNAMELEN;
 	}
 	valid = TRUE;
@@ -582,256 +580,297 @@ is_valid_username (const gchar *username, gchar **tip)
 	return valid;
 }
 
+gboolean
+is_valid_username (const gchar *username, gchar **tip)
+{
+	return check_username (username, is_username_used (username), tip);
+}
+
+typedef struct {
+	gboolean  valid;
+	gchar    *tip;
+} UsernameCheck;
+
+static void
+username_check_free (UsernameCheck *check)
+{
+	g_free (check->tip);
+	g_free (check);
+}
+
+static void
+username_lookup_done (GObject      *source,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+	GTask *task = G_TASK (user_data);
+	UsernameCheck *check;
+	GError *error = NULL;
+	gboolean in_use;
+
+	if (!um_username_cache_check_finish (result, &in_use, &error)) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	check = g_new0 (UsernameCheck, 1);
+	check->valid = check_username (g_task_get_task_data (task), in_use, &check->tip);
+
+	g_task_return_pointer (task, check, (GDestroyNotify) username_check_free);
+	g_object_unref (task);
+}
+
+/* Same as is_valid_username(), but the lookup of the username in the
+ * user database, which may need the network, is done in a thread. */
 void
-generate_username_choices (const gchar  *name,
-                           GtkListStore *store)
+is_valid_username_async (const gchar         *username,
+                         GCancellable        *cancellable,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
 {
-	gboolean in_use, same_as_initial;
-	char *lc_name, *ascii_name, *stripped_name;
-	char **words1;
-	char **words2 = NULL;
-	char **w1, **w2;
-	char *c;
-	char *unicode_fallback = "?";
-	GString *first_word, *last_word;
-	GString *item0, *item1, *item2, *item3, *item4;
-	int len;
-	int nwords1, nwords2, i;
-	GHashTable *items;
-	GtkTreeIter iter;
+	GTask *task;
 
-	gtk_list_store_clear (store);
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, is_valid_username_async);
+	g_task_set_task_data (task, g_strdup (username), g_free);
 
-	ascii_name = g_convert_with_fallback (name, -1, "ASCII//TRANSLIT", "UTF-8",
-	                                      unicode_fallback, NULL, NULL, NULL);
+	um_username_cache_check_async (username, cancellable, username_lookup_done, task);
+}
 
-	lc_name = g_ascii_strdown (ascii_name, -1);
+gboolean
+is_valid_username_finish (GAsyncResult  *result,
+                          gchar        **tip,
+                          GError       **error)
+{
+	UsernameCheck *check;
+	gboolean valid;
+
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+	check = g_task_propagate_pointer (G_TASK (result), error);
+	if (check == NULL)
+		return FALSE;
+
+	valid = check->valid;
+	*tip = g_steal_pointer (&check->tip);
+	username_check_free (check);
+
+	return valid;
+}
+
+/* Numbered names offered when every candidate is taken, from 2 */
+#define N_USERNAME_FALLBACKS 3
+
+static gboolean
+store_has_choices (GtkListStore *store,
+                   const gchar **choices,
+                   gint          n_choices)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL (store);
+	GtkTreeIter iter;
+	gboolean valid;
+	gboolean same = TRUE;
+	gchar *choice;
+	gint i = 0;
+
+	valid = gtk_tree_model_get_iter_first (model, &iter);
+	while (valid && same) {
+		if (i >= n_choices)
+			return FALSE;
+
+		gtk_tree_model_get (model, &iter, 0, &choice, -1);
+		same = (g_strcmp0 (choice, choices[i]) == 0);
+		g_free (choice);
 
-	/* Remove all non ASCII alphanumeric chars from the name,
-	 * apart from the few allowed symbols.
-	 *
-	 * We do remove '.', even though it is usually allowed,
-	 * since it often comes in via an abbreviated middle name,
-	 * and the dot looks just wrong in the proposals then.
-	 */
-	stripped_name = g_strnfill (strlen (lc_name) + 1, '\0');
-	i = 0;
-	for (c = lc_name; *c; c++) {
-		if (!(g_ascii_isdigit (*c) || g_ascii_islower (*c) ||
-		    *c == ' ' || *c == '-' || *c == '_' ||
-		    /* used to track invalid words, removed below */
-		    *c == '?'))
-			continue;
-
-		stripped_name[i] = *c;
 		i++;
+		valid = gtk_tree_model_iter_next (model, &iter);
 	}
 
-	if (strlen (stripped_name) == 0) {
-		g_free (ascii_name);
-		g_free (lc_name);
-		g_free (stripped_name);
+	return same && i == n_choices;
+}
+
+typedef struct {
+	UmUsernameCandidates  candidates;
+	gchar                *names[UM_USERNAME_CANDIDATES_MAX + N_USERNAME_FALLBACKS + 1];
+} UsernameChoices;
+
+static void
+username_choices_free (UsernameChoices *choices)
+{
+	gint i;
+
+	/* The candidates live in the arena, only fallbacks are owned */
+	for (i = choices->candidates.n_items; choices->names[i] != NULL; i++)
+		g_free (choices->names[i]);
+
+	um_username_candidates_clear (&choices->candidates);
+	g_free (choices);
+}
+
+static void
+username_choices_checked (GObject      *source,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+	GTask *task = G_TASK (user_data);
+	UsernameChoices *choices = g_task_get_task_data (task);
+	GPtrArray *available;
+	GError *error = NULL;
+	gboolean *in_use;
+	gint i;
+
+	in_use = um_username_cache_check_many_finish (result, &error);
+	if (in_use == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
 		return;
 	}
 
-	/* we split name on spaces, and then on dashes, so that we can treat
-	 * words linked with dashes the same way, i.e. both fully shown, or
-	 * both abbreviated
-	 */
-	words1 = g_strsplit_set (stripped_name, " ", -1);
-	len = g_strv_length (words1);
-
-	/* The default item is a concatenation of all words without ? */
-	item0 = g_string_sized_new (strlen (stripped_name));
-
-	g_free (ascii_name);
-	g_free (lc_name);
-	g_free (stripped_name);
-
-	/* Concatenate the whole first word with the first letter of each
-	 * word (item1), and the last word with the first letter of each
-	 * word (item2). item3 and item4 are symmetrical respectively to
-	 * item1 and item2.
-	 *
-	 * Constant 5 is the max reasonable number of words we may get when
-	 * splitting on dashes, since we can't guess it at this point,
-	 * and reallocating would be too bad.
-	 */
-	item1 = g_string_sized_new (strlen (words1[0]) + len - 1 + 5);
-	item3 = g_string_sized_new (strlen (words1[0]) + len - 1 + 5);
+	available = g_ptr_array_new ();
+	for (i = 0; i < choices->candidates.n_items; i++) {
+		if (!in_use[i])
+			g_ptr_array_add (available, g_strdup (choices->names[i]));
+	}
 
-	item2 = g_string_sized_new (strlen (words1[len - 1]) + len - 1 + 5);
-	item4 = g_string_sized_new (strlen (words1[len - 1]) + len - 1 + 5);
+	/* Every candidate is taken, offer the numbered ones instead */
+	if (available->len == 0) {
+		for (; choices->names[i] != NULL; i++) {
+			if (!in_use[i])
+				g_ptr_array_add (available, g_strdup (choices->names[i]));
+		}
+	}
+	g_ptr_array_add (available, NULL);
+	g_free (in_use);
 
-	/* again, guess at the max size of names */
-	first_word = g_string_sized_new (20);
-	last_word = g_string_sized_new (20);
+	g_task_return_pointer (task,
+	                       g_ptr_array_free (available, FALSE),
+	                       (GDestroyNotify) g_strfreev);
+	g_object_unref (task);
+}
 
-	nwords1 = 0;
-	nwords2 = 0;
-	for (w1 = words1; *w1; w1++) {
-		if (strlen (*w1) == 0)
-			continue;
+/* Proposes available usernames for a full name. All candidates, and
+ * the numbered fallbacks of the preferred one, are checked at once. */
+void
+generate_username_choices_async (const gchar         *name,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+	UsernameChoices *choices;
+	GTask *task;
+	const gchar *base;
+	gint i, n;
 
-		/* skip words with string '?', most likely resulting
-		 * from failed transliteration to ASCII
-		 */
-		if (strstr (*w1, unicode_fallback) != NULL)
-			continue;
-
-		nwords1++; /* count real words, excluding empty string */
-
-		item0 = g_string_append (item0, *w1);
-
-		words2 = g_strsplit_set (*w1, "-", -1);
-		/* reset last word if a new non-empty word has been found */
-		if (strlen (*words2) > 0)
-			last_word = g_string_set_size (last_word, 0);
-
-		for (w2 = words2; *w2; w2++) {
-			if (strlen (*w2) == 0)
-				continue;
-
-			nwords2++;
-
-			/* part of the first "toplevel" real word */
-			if (nwords1 == 1) {
-				item1 = g_string_append (item1, *w2);
-				first_word = g_string_append (first_word, *w2);
-			}
-			else {
-				item1 = g_string_append_unichar (item1,
-				                                 g_utf8_get_char (*w2));
-				item3 = g_string_append_unichar (item3,
-				                                 g_utf8_get_char (*w2));
-			}
-
-			/* not part of the last "toplevel" word */
-			if (w1 != words1 + len - 1) {
-				item2 = g_string_append_unichar (item2,
-				                                 g_utf8_get_char (*w2));
-				item4 = g_string_append_unichar (item4,
-				                                 g_utf8_get_char (*w2));
-			}
-
-			/* always save current word so that we have it if last one reveals empty */
-			last_word = g_string_append (last_word, *w2);
-		}
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, generate_username_choices_async);
 
-		g_strfreev (words2);
-	}
+	choices = g_new0 (UsernameChoices, 1);
+	g_task_set_task_data (task, choices, (GDestroyNotify) username_choices_free);
 
-	item2 = g_string_append (item2, last_word->str);
-	item3 = g_string_append (item3, first_word->str);
-	item4 = g_string_prepend (item4, last_word->str);
+	um_username_candidates_get (name, &choices->candidates);
 
-	items = g_hash_table_new (g_str_hash, g_str_equal);
+	n = choices->candidates.n_items;
+	for (i = 0; i < n; i++)
+		choices->names[i] = (gchar *) choices->candidates.items[i];
 
-	in_use = is_username_used (item0->str);
-	if (!in_use && !g_ascii_isdigit (item0->str[0])) {
-		gtk_list_store_append (store, &iter);
-		gtk_list_store_set (store, &iter, 0, item0->str, -1);
-		g_hash_table_insert (items, item0->str, item0->str);
+	base = n > 0 ? choices->candidates.items[0] : NULL;
+	if (base != NULL && base[0] != '\0') {
+		for (i = 0; i < N_USERNAME_FALLBACKS; i++)
+			choices->names[n + i] = g_strdup_printf ("%s%d", base, i + 2);
 	}
 
-	in_use = is_username_used (item1->str);
-	same_as_initial = (g_strcmp0 (item0->str, item1->str) == 0);
-	if (!same_as_initial && nwords2 > 0 && !in_use && !g_ascii_isdigit (item1->str[0])) {
-		gtk_list_store_append (store, &iter);
-		gtk_list_store_set (store, &iter, 0, item1->str, -1);
-		g_hash_table_insert (items, item1->str, item1->str);
+	if (choices->names[0] == NULL) {
+		g_task_return_pointer (task, g_new0 (gchar *, 1), (GDestroyNotify) g_strfreev);
+		g_object_unref (task);
+		return;
 	}
 
-	/* if there's only one word, would be the same as item1 */
-	if (nwords2 > 1) {
-		/* add other items */
-		in_use = is_username_used (item2->str);
-		if (!in_use && !g_ascii_isdigit (item2->str[0]) &&
-		   !g_hash_table_lookup (items, item2->str)) {
-			gtk_list_store_append (store, &iter);
-			gtk_list_store_set (store, &iter, 0, item2->str, -1);
-			g_hash_table_insert (items, item2->str, item2->str);
-		}
+	um_username_cache_check_many_async ((const gchar * const *) choices->names,
+	                                    cancellable,
+	                                    username_choices_checked,
+	                                    task);
+}
 
-		in_use = is_username_used (item3->str);
-		if (!in_use && !g_ascii_isdigit (item3->str[0]) &&
-		    !g_hash_table_lookup (items, item3->str)) {
-			gtk_list_store_append (store, &iter);
-			gtk_list_store_set (store, &iter, 0, item3->str, -1);
-			g_hash_table_insert (items, item3->str, item3->str);
-		}
+gchar **
+generate_username_choices_finish (GAsyncResult  *result,
+                                  GError       **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
 
-		in_use = is_username_used (item4->str);
-		if (!in_use && !g_ascii_isdigit (item4->str[0]) &&
-		    !g_hash_table_lookup (items, item4->str)) {
-			gtk_list_store_append (store, &iter);
-			gtk_list_store_set (store, &iter, 0, item4->str, -1);
-			g_hash_table_insert (items, item4->str, item4->str);
-		}
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
 
-		/* add the last word */
-		in_use = is_username_used (last_word->str);
-		if (!in_use && !g_ascii_isdigit (last_word->str[0]) &&
-		    !g_hash_table_lookup (items, last_word->str)) {
-			gtk_list_store_append (store, &iter);
-			gtk_list_store_set (store, &iter, 0, last_word->str, -1);
-			g_hash_table_insert (items, last_word->str, last_word->str);
-		}
+void
+set_username_choices (GtkListStore  *store,
+                      gchar        **choices)
+{
+	GtkTreeIter iter;
+	gint i, n_choices;
 
-		/* ...and the first one */
-		in_use = is_username_used (first_word->str);
-		if (!in_use && !g_ascii_isdigit (first_word->str[0]) &&
-		    !g_hash_table_lookup (items, first_word->str)) {
-			gtk_list_store_append (store, &iter);
-			gtk_list_store_set (store, &iter, 0, first_word->str, -1);
-			g_hash_table_insert (items, first_word->str, first_word->str);
-		}
-	}
+	n_choices = g_strv_length (choices);
 
-	g_hash_table_destroy (items);
-	g_strfreev (words1);
-	g_string_free (first_word, TRUE);
-	g_string_free (last_word, TRUE);
-	g_string_free (item0, TRUE);
-	g_string_free (item1, TRUE);
-	g_string_free (item2, TRUE);
-	g_string_free (item3, TRUE);
-	g_string_free (item4, TRUE);
+	/* Avoid resetting the combo when nothing changed */
+	if (store_has_choices (store, (const gchar **) choices, n_choices))
+		return;
+
+	gtk_list_store_clear (store);
+	for (i = 0; i < n_choices; i++) {
+		gtk_list_store_append (store, &iter);
+		gtk_list_store_set (store, &iter, 0, choices[i], -1);
+	}
 }
 
+/* Same as get_smart_date(), against a midnight of today computed by
+ * the caller, for callers labelling many dates at once */
 gchar *
-get_smart_date (GDateTime *date)
+get_smart_date_relative (GDateTime *date,
+                         GDateTime *today)
 {
-	gchar *label;
-	GDateTime *today, *local;
 	GTimeSpan span;
 
-	/* Set today date */
-	local = g_date_time_new_now_local ();
-	today = g_date_time_new_local (g_date_time_get_year (local),
-	                               g_date_time_get_month (local),
-	                               g_date_time_get_day_of_month (local),
-	                               0, 0, 0);
-
 	span = g_date_time_difference (today, date);
 	if (span <= 0) {
-		label = g_strdup (_("Today"));
+		return g_strdup (_("Today"));
 	}
 	else if (span <= G_TIME_SPAN_DAY) {
-		label = g_strdup (_("Yesterday"));
+		return g_strdup (_("Yesterday"));
 	}
 	else {
 		if (g_date_time_get_year (date) == g_date_time_get_year (today)) {
 			/* Translators: This is a date format string in the style of "Feb 24". */
-			label = g_date_time_format (date, _("%b %e"));
+			return g_date_time_format (date, _("%b %e"));
 		}
 		else {
 			/* Translators: This is a date format string in the style of "Feb 24, 2013". */
-			label = g_date_time_format (date, _("%b %e, %Y"));
+			return g_date_time_format (date, _("%b %e, %Y"));
 		}
 	}
+}
 
+GDateTime *
+get_today_midnight (void)
+{
+	GDateTime *today, *local;
+
+	local = g_date_time_new_now_local ();
+	today = g_date_time_new_local (g_date_time_get_year (local),
+	                               g_date_time_get_month (local),
+	                               g_date_time_get_day_of_month (local),
+	                               0, 0, 0);
 	g_date_time_unref (local);
+
+	return today;
+}
+
+gchar *
+get_smart_date (GDateTime *date)
+{
+	gchar *label;
+	GDateTime *today;
+
+	today = get_today_midnight ();
+	label = get_smart_date_relative (date, today);
 	g_date_time_unref (today);
 
 	return label;
@@ -975,57 +1014,259 @@ round_image (GdkPixbuf *pixbuf)
 	return dest;
 }
 
+/* ActUser setters only warn when AccountsService refuses a change, the
+ * methods are called directly wherever the caller has to know. */
+gboolean
+call_user_method_sync (ActUser      *user,
+                       const gchar  *method,
+                       GVariant     *parameters,
+                       GError      **error)
+{
+	GDBusConnection *bus;
+	GVariant *ret;
+
+	g_variant_ref_sink (parameters);
+
+	bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, error);
+	if (bus == NULL) {
+		g_variant_unref (parameters);
+		return FALSE;
+	}
+
+	ret = g_dbus_connection_call_sync (bus,
+	                                   "org.freedesktop.Accounts",
+	                                   act_user_get_object_path (user),
+	                                   "org.freedesktop.Accounts.User",
+	                                   method,
+	                                   parameters,
+	                                   NULL,
+	                                   G_DBUS_CALL_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION,
+	                                   -1,
+	                                   NULL,
+	                                   error);
+	g_object_unref (bus);
+	g_variant_unref (parameters);
+
+	if (ret == NULL) {
+		if (error != NULL)
+			g_dbus_error_strip_remote_error (*error);
+		return FALSE;
+	}
+
+	g_variant_unref (ret);
+
+	return TRUE;
+}
+
+static void
+call_user_method_done (GObject      *source,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+	GTask *task = user_data;
+	GVariant *ret;
+	GError *error = NULL;
+
+	ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+	if (ret == NULL) {
+		g_dbus_error_strip_remote_error (error);
+		g_task_return_error (task, error);
+	}
+	else {
+		g_variant_unref (ret);
+		g_task_return_boolean (task, TRUE);
+	}
+
+	g_object_unref (task);
+}
+
 void
-set_user_icon_data (ActUser   *user,
-                    GdkPixbuf *pixbuf)
+call_user_method (ActUser             *user,
+                  const gchar         *method,
+                  GVariant            *parameters,
+                  GCancellable        *cancellable,
+                  GAsyncReadyCallback  callback,
+                  gpointer             user_data)
+{
+	GDBusConnection *bus;
+	GTask *task;
+	GError *error = NULL;
+
+	task = g_task_new (user, cancellable, callback, user_data);
+	g_task_set_source_tag (task, call_user_method);
+
+	/* The system bus is already connected for the user manager */
+	bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, cancellable, &error);
+	if (bus == NULL) {
+		g_variant_unref (g_variant_ref_sink (parameters));
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	g_dbus_connection_call (bus,
+	                        "org.freedesktop.Accounts",
+	                        act_user_get_object_path (user),
+	                        "org.freedesktop.Accounts.User",
+	                        method,
+	                        parameters,
+	                        NULL,
+	                        G_DBUS_CALL_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION,
+	                        -1,
+	                        cancellable,
+	                        call_user_method_done,
+	                        task);
+	g_object_unref (bus);
+}
+
+gboolean
+call_user_method_finish (GAsyncResult  *result,
+                         GError       **error)
+{
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Crops the picture to a centered square at the size of account
+ * pictures. The crop dialog hands in squares already. */
+GdkPixbuf *
+crop_user_icon (GdkPixbuf  *pixbuf,
+                GError    **error)
+{
+	GdkPixbuf *square, *scaled;
+	gint width, height, size;
+
+	width = gdk_pixbuf_get_width (pixbuf);
+	height = gdk_pixbuf_get_height (pixbuf);
+	size = MIN (width, height);
+
+	square = gdk_pixbuf_new_subpixbuf (pixbuf, (width - size) / 2, (height - size) / 2, size, size);
+	scaled = gdk_pixbuf_scale_simple (square, USER_ICON_SIZE, USER_ICON_SIZE, GDK_INTERP_BILINEAR);
+	g_object_unref (square);
+
+	if (scaled == NULL)
+		g_set_error_literal (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+		                     _("Not enough memory to scale the picture"));
+
+	return scaled;
+}
+
+gboolean
+set_user_icon_data (ActUser    *user,
+                    GdkPixbuf  *pixbuf,
+                    GError    **error)
 {
 	gchar *path;
-	gint fd;
+	gint fd, errsv;
 	GOutputStream *stream;
-	GError *error;
+	gboolean ret;
 
 	path = g_build_filename (g_get_tmp_dir (), "xings-user-icon-XXXXXX", NULL);
 	fd = g_mkstemp (path);
 
 	if (fd == -1) {
-		g_warning ("failed to create temporary file for image data");
+		errsv = errno;
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+		             _("Failed to create a temporary file for the picture: %s"),
+		             g_strerror (errsv));
 		g_free (path);
-		return;
+		return FALSE;
 	}
 
 	stream = g_unix_output_stream_new (fd, TRUE);
 
-	error = NULL;
-	if (!gdk_pixbuf_save_to_stream (pixbuf, stream, "png", NULL, &error, NULL)) {
-		g_warning ("failed to save image: %s", error->message);
-		g_error_free (error);
-		g_object_unref (stream);
-		return;
-	}
-
+	ret = gdk_pixbuf_save_to_stream (pixbuf, stream, "png", NULL, error, NULL);
 	g_object_unref (stream);
 
-	act_user_set_icon_file (user, path);
+	/* The call is synchronous, the file can go right after it */
+	if (ret)
+		ret = call_user_method_sync (user, "SetIconFile", g_variant_new ("(s)", path), error);
 
-	/* if we ever make the dbus call async, the g_remove call needs
-	 * to wait for its completion
-	 */
 	g_remove (path);
-
 	g_free (path);
+
+	return ret;
 }
 
-static guint
+/* The enabled administrators are tracked from the user manager
+ * signals, so that would_demote_only_admin() and the batch actions of
+ * the panel do not have to list every user each time they ask. */
+static GHashTable *active_admins = NULL;
+static gboolean active_admins_loaded = FALSE;
+
+gboolean
+is_active_admin (ActUser *user)
+{
+	return act_user_get_account_type (user) == ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR &&
+	       !act_user_get_locked (user);
+}
+
+static void
+active_admin_changed (ActUserManager *um,
+                      ActUser        *user,
+                      gpointer        data)
+{
+	gpointer uid = GUINT_TO_POINTER (act_user_get_uid (user));
+
+	if (is_active_admin (user))
+		g_hash_table_add (active_admins, uid);
+	else
+		g_hash_table_remove (active_admins, uid);
+}
+
+static void
+active_admin_removed (ActUserManager *um,
+                      ActUser        *user,
+                      gpointer        data)
+{
+	g_hash_table_remove (active_admins, GUINT_TO_POINTER (act_user_get_uid (user)));
+}
+
+static void
+active_admins_is_loaded (ActUserManager *um,
+                         GParamSpec     *pspec,
+                         gpointer        data)
+{
+	GSList *list;
+	GSList *l;
+
+	g_object_get (um, "is-loaded", &active_admins_loaded, NULL);
+	if (!active_admins_loaded)
+		return;
+
+	g_hash_table_remove_all (active_admins);
+
+	list = act_user_manager_list_users (um);
+	for (l = list; l != NULL; l = l->next)
+		active_admin_changed (um, l->data, NULL);
+	g_slist_free (list);
+}
+
+guint
 get_num_active_admin (ActUserManager *um)
 {
 	GSList *list;
 	GSList *l;
 	guint num_admin = 0;
 
+	if (active_admins == NULL) {
+		active_admins = g_hash_table_new (NULL, NULL);
+
+		g_signal_connect (um, "user-added", G_CALLBACK (active_admin_changed), NULL);
+		g_signal_connect (um, "user-changed", G_CALLBACK (active_admin_changed), NULL);
+		g_signal_connect (um, "user-removed", G_CALLBACK (active_admin_removed), NULL);
+		g_signal_connect (um, "notify::is-loaded", G_CALLBACK (active_admins_is_loaded), NULL);
+
+		active_admins_is_loaded (um, NULL, NULL);
+	}
+
+	if (active_admins_loaded)
+		return g_hash_table_size (active_admins);
+
+	/* Not every user is known yet, count them the slow way */
 	list = act_user_manager_list_users (um);
 	for (l = list; l != NULL; l = l->next) {
 		ActUser *u = l->data;
-		if (act_user_get_account_type (u) == ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR && !act_user_get_locked (u)) {
+		if (is_active_admin (u)) {
 			num_admin++;
 		}
 	}
@@ -69,11 +69,27 @@ void     down_arrow                       (GtkStyleContext *context,
 gboolean is_valid_name                    (const gchar     *name);
 gboolean is_valid_username                (const gchar     *name,
                                            gchar          **tip);
-
-void     generate_username_choices        (const gchar     *name,
-                                           GtkListStore    *store);
+void     is_valid_username_async          (const gchar         *name,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+gboolean is_valid_username_finish         (GAsyncResult        *result,
+                                           gchar              **tip,
+                                           GError             **error);
+
+void     generate_username_choices_async  (const gchar         *name,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+gchar  **generate_username_choices_finish (GAsyncResult        *result,
+                                           GError             **error);
+void     set_username_choices             (GtkListStore        *store,
+                                           gchar              **choices);
 
 gchar *  get_smart_date                   (GDateTime *date);
+gchar *  get_smart_date_relative          (GDateTime *date,
+                                           GDateTime *today);
+GDateTime *get_today_midnight             (void);
 
 cairo_surface_t *render_user_icon         (ActUser         *user,
                                            UmIconStyle      style,
@@ -82,10 +98,28 @@ cairo_surface_t *render_user_icon         (ActUser         *user,
 
 GdkPixbuf *round_image                    (GdkPixbuf  *pixbuf);
 
-void     set_user_icon_data               (ActUser         *user,
-                                           GdkPixbuf       *pixbuf);
-
-gboolean would_demote_only_admin          (ActUser *user);
+GdkPixbuf *crop_user_icon                 (GdkPixbuf  *pixbuf,
+                                           GError    **error);
+gboolean set_user_icon_data               (ActUser         *user,
+                                           GdkPixbuf       *pixbuf,
+                                           GError         **error);
+
+gboolean call_user_method_sync            (ActUser              *user,
+                                           const gchar          *method,
+                                           GVariant             *parameters,
+                                           GError              **error);
+void     call_user_method                 (ActUser              *user,
+                                           const gchar          *method,
+                                           GVariant             *parameters,
+                                           GCancellable         *cancellable,
+                                           GAsyncReadyCallback   callback,
+                                           gpointer              user_data);
+gboolean call_user_method_finish          (GAsyncResult         *result,
+                                           GError              **error);
+
+gboolean is_active_admin                  (ActUser        *user);
+guint    get_num_active_admin             (ActUserManager *um);
+gboolean would_demote_only_admin          (ActUser        *user);
 
 G_END_DECLS
 
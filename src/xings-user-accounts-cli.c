@@ -0,0 +1,448 @@
+/*************************************************************************/
+/* Copyright (C) 2021 matias <mati86dl@gmail.com>                        */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*************************************************************************/
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <act/act.h>
+
+#include "um-utils.h"
+#include "pw-utils.h"
+
+#include "xings-user-accounts-common.h"
+#include "xings-user-accounts-cli.h"
+
+/* Account management from the command line, for scripts. GTK is never
+ * initialised, only the user manager is waited for, and only when the
+ * operation needs every user to be known. */
+
+static gboolean  opt_list = FALSE;
+static gchar    *opt_create = NULL;
+static gchar    *opt_username = NULL;
+static gboolean  opt_admin = FALSE;
+static gchar    *opt_user = NULL;
+static gchar    *opt_set_type = NULL;
+static gchar    *opt_set_icon = NULL;
+static gint      opt_generate = 0;
+static gint      opt_entropy = 0;
+
+static const GOptionEntry cli_entries[] = {
+	{ "list", 0, 0, G_OPTION_ARG_NONE, &opt_list,
+	  N_("List the user accounts and exit"), NULL },
+	{ "create", 0, 0, G_OPTION_ARG_STRING, &opt_create,
+	  N_("Create an account for the given full name and exit"), N_("NAME") },
+	{ "username", 0, 0, G_OPTION_ARG_STRING, &opt_username,
+	  N_("Username of the account to create, proposed from the name if not given"), N_("USERNAME") },
+	{ "admin", 0, 0, G_OPTION_ARG_NONE, &opt_admin,
+	  N_("Make the created account an administrator"), NULL },
+	{ "user", 0, 0, G_OPTION_ARG_STRING, &opt_user,
+	  N_("Account changed by --set-type and --set-icon"), N_("USERNAME") },
+	{ "set-type", 0, 0, G_OPTION_ARG_STRING, &opt_set_type,
+	  N_("Set the account type, “standard” or “administrator”"), N_("TYPE") },
+	{ "set-icon", 0, 0, G_OPTION_ARG_FILENAME, &opt_set_icon,
+	  N_("Set the account picture from an image file"), N_("FILE") },
+	{ "generate-passwords", 0, 0, G_OPTION_ARG_INT, &opt_generate,
+	  N_("Print the given number of generated passwords and exit"), N_("COUNT") },
+	{ "entropy-bits", 0, 0, G_OPTION_ARG_INT, &opt_entropy,
+	  N_("Entropy of the generated passwords, the configured length if not given"), N_("BITS") },
+	{ NULL }
+};
+
+static GMainLoop *loop = NULL;
+
+static void
+wait_for_loaded (gpointer object)
+{
+	gboolean loaded;
+	gulong id;
+
+	id = g_signal_connect_swapped (object, "notify::is-loaded",
+	                               G_CALLBACK (g_main_loop_quit), loop);
+
+	g_object_get (object, "is-loaded", &loaded, NULL);
+	while (!loaded) {
+		g_main_loop_run (loop);
+		g_object_get (object, "is-loaded", &loaded, NULL);
+	}
+
+	g_signal_handler_disconnect (object, id);
+}
+
+static ActUserManager *
+get_loaded_manager (void)
+{
+	ActUserManager *manager;
+
+	manager = act_user_manager_get_default ();
+	wait_for_loaded (manager);
+
+	if (act_user_manager_no_service (manager)) {
+		g_printerr ("%s\n", _("Failed to contact the accounts service"));
+		return NULL;
+	}
+
+	return manager;
+}
+
+static ActUser *
+get_loaded_user (const gchar *username)
+{
+	ActUser *user;
+
+	user = act_user_manager_get_user (act_user_manager_get_default (), username);
+	wait_for_loaded (user);
+
+	if (act_user_is_nonexistent (user)) {
+		g_printerr (_("No such user: %s\n"), username);
+		return NULL;
+	}
+
+	return user;
+}
+
+/* Changes go through call_user_method_sync() so that a refusal of
+ * AccountsService reaches the exit status */
+static gboolean
+change_user (ActUser     *user,
+             const gchar *method,
+             GVariant    *parameters)
+{
+	GError *error = NULL;
+
+	if (!call_user_method_sync (user, method, parameters, &error)) {
+		g_printerr (_("Failed to change account %s: %s\n"),
+		            act_user_get_user_name (user), error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static const gchar *
+get_account_type_name (ActUserAccountType account_type)
+{
+	return account_type == ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR ? "administrator" : "standard";
+}
+
+static gint
+compare_users (gconstpointer a,
+               gconstpointer b)
+{
+	return act_user_collate ((ActUser *) a, (ActUser *) b);
+}
+
+static int
+cli_list (void)
+{
+	ActUserManager *manager;
+	GSList *list, *l;
+	ActUser *user;
+
+	manager = get_loaded_manager ();
+	if (manager == NULL)
+		return EXIT_FAILURE;
+
+	list = g_slist_sort (act_user_manager_list_users (manager), compare_users);
+	for (l = list; l != NULL; l = l->next) {
+		user = l->data;
+		if (act_user_is_system_account (user))
+			continue;
+
+		g_print ("%u\t%s\t%s\t%s\t%s\n",
+		         (guint) act_user_get_uid (user),
+		         act_user_get_user_name (user),
+		         get_account_type_name (act_user_get_account_type (user)),
+		         act_user_get_locked (user) ? "disabled" : "enabled",
+		         act_user_get_real_name (user) != NULL ? act_user_get_real_name (user) : "");
+	}
+	g_slist_free (list);
+
+	return EXIT_SUCCESS;
+}
+
+static int
+cli_generate_passwords (void)
+{
+	PwGenerateStats stats;
+	gchar **passwords;
+	guint i;
+
+	if (opt_generate < 0 || opt_entropy < 0) {
+		g_printerr ("%s\n", _("The count and entropy must be positive."));
+		return EXIT_FAILURE;
+	}
+
+	passwords = pw_generate_many (opt_generate, opt_entropy);
+	if (passwords == NULL) {
+		g_printerr ("%s\n", _("Failed to generate passwords"));
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; passwords[i] != NULL; i++)
+		g_print ("%s\n", passwords[i]);
+
+	pw_get_generate_stats (&stats);
+	g_debug ("Generated %u passwords in %.1f ms, %.1f ms at most",
+	         stats.generated, stats.total_ms, stats.max_ms);
+
+	pw_free_passwords (passwords);
+
+	return i == (guint) opt_generate ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void
+username_choices_done (GObject      *source,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+	gchar ***choices = user_data;
+	GError *error = NULL;
+
+	*choices = generate_username_choices_finish (result, &error);
+	if (*choices == NULL) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+	}
+
+	g_main_loop_quit (loop);
+}
+
+static gchar *
+propose_username (const gchar *name)
+{
+	gchar **choices = NULL;
+	gchar *username = NULL;
+
+	generate_username_choices_async (name, NULL, username_choices_done, &choices);
+	g_main_loop_run (loop);
+
+	if (choices != NULL && choices[0] != NULL)
+		username = g_strdup (choices[0]);
+	g_strfreev (choices);
+
+	return username;
+}
+
+static gboolean
+set_default_avatar (ActUser *user)
+{
+	GSettingsSchemaSource *source;
+	GSettingsSchema *schema;
+	GSettings *settings;
+	gchar *avatar;
+	gboolean ret = TRUE;
+
+	source = g_settings_schema_source_get_default ();
+	schema = source != NULL ? g_settings_schema_source_lookup (source, XUA_SETTINGS_SCHEMA, TRUE) : NULL;
+	if (schema == NULL)
+		return TRUE;
+
+	settings = g_settings_new_full (schema, NULL, NULL);
+	avatar = g_settings_get_string (settings, XUA_SETTINGS_KEY_DEFAULT_AVATAR);
+	if (avatar != NULL && *avatar != '\0' && g_file_test (avatar, G_FILE_TEST_EXISTS))
+		ret = change_user (user, "SetIconFile", g_variant_new ("(s)", avatar));
+
+	g_free (avatar);
+	g_object_unref (settings);
+	g_settings_schema_unref (schema);
+
+	return ret;
+}
+
+static int
+cli_create (void)
+{
+	ActUser *user;
+	GError *error = NULL;
+	gchar *username;
+	gchar *tip = NULL;
+	gboolean valid;
+
+	if (!is_valid_name (opt_create)) {
+		g_printerr ("%s\n", _("The name is empty."));
+		return EXIT_FAILURE;
+	}
+
+	if (opt_username != NULL)
+		username = g_strdup (opt_username);
+	else
+		username = propose_username (opt_create);
+
+	if (username == NULL) {
+		g_printerr ("%s\n", _("No username could be proposed for this name, please give one."));
+		return EXIT_FAILURE;
+	}
+
+	valid = is_valid_username (username, &tip);
+	if (!valid) {
+		g_printerr ("%s: %s\n", username, tip);
+		g_free (tip);
+		g_free (username);
+		return EXIT_FAILURE;
+	}
+	g_free (tip);
+
+	user = act_user_manager_create_user (act_user_manager_get_default (),
+	                                     username,
+	                                     opt_create,
+	                                     opt_admin ? ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR : ACT_USER_ACCOUNT_TYPE_STANDARD,
+	                                     &error);
+	if (user == NULL) {
+		g_dbus_error_strip_remote_error (error);
+		g_printerr (_("Failed to add account: %s\n"), error->message);
+		g_error_free (error);
+		g_free (username);
+		return EXIT_FAILURE;
+	}
+
+	wait_for_loaded (user);
+
+	/* The account exists either way, print it for the caller to clean up */
+	g_print ("%s\n", username);
+
+	g_free (username);
+
+	if (!change_user (user, "SetPasswordMode",
+	                g_variant_new ("(i)", ACT_USER_PASSWORD_MODE_SET_AT_LOGIN)) ||
+	    !set_default_avatar (user))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
+
+/* Cropped and saved as the photo dialog does */
+static gboolean
+set_icon (ActUser     *user,
+          const gchar *filename)
+{
+	GdkPixbuf *pixbuf, *icon;
+	GError *error = NULL;
+
+	pixbuf = gdk_pixbuf_new_from_file (filename, &error);
+	if (pixbuf == NULL) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+
+	icon = crop_user_icon (pixbuf, &error);
+	g_object_unref (pixbuf);
+
+	if (icon == NULL || !set_user_icon_data (user, icon, &error)) {
+		g_printerr (_("Failed to change account %s: %s\n"),
+		            act_user_get_user_name (user), error->message);
+		g_error_free (error);
+		g_clear_object (&icon);
+		return FALSE;
+	}
+
+	g_object_unref (icon);
+
+	return TRUE;
+}
+
+static int
+cli_modify (void)
+{
+	ActUserAccountType account_type;
+	ActUser *user;
+
+	if (opt_set_type == NULL && opt_set_icon == NULL) {
+		g_printerr ("%s\n", _("Nothing to change, use --set-type or --set-icon."));
+		return EXIT_FAILURE;
+	}
+
+	if (opt_set_type != NULL) {
+		if (g_ascii_strcasecmp (opt_set_type, "standard") == 0)
+			account_type = ACT_USER_ACCOUNT_TYPE_STANDARD;
+		else if (g_ascii_strcasecmp (opt_set_type, "administrator") == 0)
+			account_type = ACT_USER_ACCOUNT_TYPE_ADMINISTRATOR;
+		else {
+			g_printerr (_("Unknown account type “%s”.\n"), opt_set_type);
+			return EXIT_FAILURE;
+		}
+
+		/* would_demote_only_admin() needs every user to be known */
+		if (account_type == ACT_USER_ACCOUNT_TYPE_STANDARD && get_loaded_manager () == NULL)
+			return EXIT_FAILURE;
+	}
+
+	user = get_loaded_user (opt_user);
+	if (user == NULL)
+		return EXIT_FAILURE;
+
+	if (opt_set_type != NULL && account_type != act_user_get_account_type (user)) {
+		if (account_type == ACT_USER_ACCOUNT_TYPE_STANDARD && would_demote_only_admin (user)) {
+			g_printerr (_("%s is the only administrator and cannot be demoted.\n"), opt_user);
+			return EXIT_FAILURE;
+		}
+		if (!change_user (user, "SetAccountType", g_variant_new ("(i)", account_type)))
+			return EXIT_FAILURE;
+	}
+
+	if (opt_set_icon != NULL && !set_icon (user, opt_set_icon))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
+
+const GOptionEntry *
+xua_cli_get_option_entries (void)
+{
+	return cli_entries;
+}
+
+/* Whether the command line asked for an operation instead of the UI */
+gboolean
+xua_cli_requested (void)
+{
+	return opt_list || opt_create != NULL || opt_user != NULL ||
+	       opt_set_type != NULL || opt_set_icon != NULL ||
+	       opt_generate != 0;
+}
+
+int
+xua_cli_run (void)
+{
+	int status;
+
+	if (opt_user == NULL && (opt_set_type != NULL || opt_set_icon != NULL)) {
+		g_printerr ("%s\n", _("--set-type and --set-icon need --user."));
+		return EXIT_FAILURE;
+	}
+
+	loop = g_main_loop_new (NULL, FALSE);
+
+	if (opt_generate != 0)
+		status = cli_generate_passwords ();
+	else if (opt_list)
+		status = cli_list ();
+	else if (opt_create != NULL)
+		status = cli_create ();
+	else
+		status = cli_modify ();
+
+	g_main_loop_unref (loop);
+
+	return status;
+}
@@ -27,6 +27,8 @@
 
 #define XUA_SETTINGS_KEY_DEFAULT_AVATAR         "default-avatar"
 #define XUA_SETTINGS_KEY_AVATAR_DIRECTORIES     "avatar-directories"
+#define XUA_SETTINGS_KEY_PASSWD_BACKEND         "passwd-backend"
+#define XUA_SETTINGS_KEY_PRELOAD_PASSWORD_CHECKS "preload-password-checks"
 
 
 #endif /* __XUA_COMMON_H */
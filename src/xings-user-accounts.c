@@ -20,6 +20,8 @@
 #include <config.h>
 #endif
 
+#include <stdlib.h>
+
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <gio/gio.h>
@@ -32,6 +34,15 @@
 #include "cc-user-panel.h"
 
 #include "xings-user-accounts-common.h"
+#include "xings-user-accounts-cli.h"
+
+static gchar *import_file = NULL;
+
+static const GOptionEntry entries[] = {
+	{ "import", 0, 0, G_OPTION_ARG_FILENAME, &import_file,
+	  N_("Create the accounts listed in a CSV file"), N_("FILE") },
+	{ NULL }
+};
 
 static void
 xings_user_accounts_application_activate (GtkApplication *application,
@@ -51,7 +62,31 @@ xings_user_accounts_application_activate (GtkApplication *application,
 	}
 
 	gtk_window_present (window);
+}
+
+/* Files reach the primary instance through here, wherever --import
+ * was given */
+static void
+xings_user_accounts_application_open (GApplication  *application,
+                                      GFile        **files,
+                                      gint           n_files,
+                                      const gchar   *hint,
+                                      gpointer       user_data)
+{
+	GtkWindow *window;
+	gint i;
+
+	g_application_activate (application);
+
+	if (g_strcmp0 (hint, "import") != 0)
+		return;
+
+	window = gtk_application_get_active_window (GTK_APPLICATION (application));
+	if (!CC_IS_USER_PANEL (window))
+		return;
 
+	for (i = 0; i < n_files; i++)
+		cc_user_panel_import_users (CC_USER_PANEL (window), files[i]);
 }
 
 int
@@ -60,6 +95,7 @@ main (int    argc,
 {
 	GtkApplication *app;
 	GOptionContext *context;
+	GError *error = NULL;
 	int status;
 
 	/* Translation */
@@ -71,9 +107,43 @@ main (int    argc,
 
 	/* Debug options */
 
+	/* Parsed with GLib alone, so that the command line operations
+	 * never initialise GTK. Toolkit and GApplication options are left
+	 * in argv for the UI. */
 	context = g_option_context_new (NULL);
 	g_option_context_set_summary (context, _("User Accounts"));
-	g_option_context_parse (context, &argc, &argv, NULL);
+	g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+	g_option_context_add_main_entries (context, xua_cli_get_option_entries (), GETTEXT_PACKAGE);
+	g_option_context_set_ignore_unknown_options (context, TRUE);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		g_option_context_free (context);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free (context);
+
+	/* Command line operations, without any UI */
+	if (xua_cli_requested ()) {
+		if (argc > 1) {
+			g_printerr (_("Unknown option %s\n"), argv[1]);
+			return EXIT_FAILURE;
+		}
+		return xua_cli_run ();
+	}
+
+	/* GTK options */
+
+	context = g_option_context_new (NULL);
+	g_option_context_set_summary (context, _("User Accounts"));
+	g_option_context_add_group (context, gtk_get_option_group (TRUE));
+	g_option_context_set_ignore_unknown_options (context, TRUE);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		g_option_context_free (context);
+		return EXIT_FAILURE;
+	}
 	g_option_context_free (context);
 
 	/* Dependencies */
@@ -83,9 +153,29 @@ main (int    argc,
 
 	/* GtkApplication */
 
-	app = gtk_application_new (XUA_DBUS_NAME, G_APPLICATION_FLAGS_NONE);
+	app = gtk_application_new (XUA_DBUS_NAME, G_APPLICATION_HANDLES_OPEN);
 	g_signal_connect (app, "activate",
 	                  G_CALLBACK (xings_user_accounts_application_activate), NULL);
+	g_signal_connect (app, "open",
+	                  G_CALLBACK (xings_user_accounts_application_open), NULL);
+
+	/* Registering first tells whether an instance is already running,
+	 * the file is then opened there */
+	if (import_file != NULL) {
+		GFile *file;
+
+		if (!g_application_register (G_APPLICATION (app), NULL, &error)) {
+			g_printerr ("%s\n", error->message);
+			g_error_free (error);
+			g_object_unref (app);
+			return EXIT_FAILURE;
+		}
+
+		file = g_file_new_for_commandline_arg (import_file);
+		g_application_open (G_APPLICATION (app), &file, 1, "import");
+		g_object_unref (file);
+		g_clear_pointer (&import_file, g_free);
+	}
 
 	status = g_application_run (G_APPLICATION (app), argc, argv);
 	g_object_unref (app);